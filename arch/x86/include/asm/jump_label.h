@@ -1,13 +1,6 @@
 #ifndef _ASM_X86_JUMP_LABEL_H
 #define _ASM_X86_JUMP_LABEL_H
 
-#ifndef __ASSEMBLY__
-
-#include <linux/stringify.h>
-#include <linux/types.h>
-#include <asm/nops.h>
-#include <asm/asm.h>
-
 #define JUMP_LABEL_NOP_SIZE 5
 
 #ifdef CONFIG_X86_64
@@ -16,6 +9,14 @@
 # define STATIC_KEY_INIT_NOP GENERIC_NOP5_ATOMIC
 #endif
 
+#include <asm/asm.h>
+#include <asm/nops.h>
+
+#ifndef __ASSEMBLY__
+
+#include <linux/stringify.h>
+#include <linux/types.h>
+
 static __always_inline bool arch_static_branch(struct static_key *key, bool branch)
 {
 	asm_volatile_goto("1:"
@@ -59,5 +60,37 @@ struct jump_entry {
 	jump_label_t key;
 };
 
-#endif  /* __ASSEMBLY__ */
+#else	/* __ASSEMBLY__ */
+
+/*
+ * Jump to \target if the static key \key is enabled. \def is the initial
+ * state of the key: 0 for DEFINE_STATIC_KEY_FALSE, 1 for _TRUE. Like
+ * static_branch_unlikely() and static_branch_likely() respectively, the
+ * jump is patched in and out as the key changes.
+ *
+ * Without asm goto the jump table is never processed, so fall back to
+ * testing the key's count, as the C side does.
+ */
+.macro STATIC_JUMP_IF_TRUE target, key, def
+#if defined(CONFIG_JUMP_LABEL) && defined(CC_HAVE_ASM_GOTO)
+.Lstatic_jump_\@:
+	.if \def
+	/* Equivalent to "jmp.d32 \target" */
+	.byte		0xe9
+	.long		\target - .Lstatic_jump_after_\@
+.Lstatic_jump_after_\@:
+	.else
+	.byte		STATIC_KEY_INIT_NOP
+	.endif
+	.pushsection __jump_table, "aw"
+	_ASM_ALIGN
+	_ASM_PTR	.Lstatic_jump_\@, \target, \key
+	.popsection
+#else
+	cmpl		$0, \key(%rip)
+	jne		\target
+#endif
+.endm
+
+#endif	/* __ASSEMBLY__ */
 #endif
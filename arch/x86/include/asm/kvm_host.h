@@ -380,6 +380,18 @@ struct kvm_vcpu_hv {
 	s64 runtime_offset;
 };
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+/* What the host was doing while a vcpu was out of guest mode */
+enum zerosim_missing {
+	ZEROSIM_MISSING_KVM,		/* none of the below */
+	ZEROSIM_MISSING_HARDIRQ,	/* host interrupt handlers */
+	ZEROSIM_MISSING_SOFTIRQ,	/* host softirqs */
+	ZEROSIM_MISSING_PREEMPT,	/* vcpu thread preempted */
+	ZEROSIM_MISSING_SLEEP,		/* vcpu thread blocked or in the VMM */
+	ZEROSIM_MISSING_NR,
+};
+#endif
+
 struct kvm_vcpu_arch {
 	/*
 	 * rip and regs accesses must go through
@@ -493,6 +505,42 @@ struct kvm_vcpu_arch {
 		struct kvm_steal_time steal;
 	} st;
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	/* guest TSC at the last communication with each vcpu, by vcpu_id */
+	u64 *zerosim_peer_comm;
+
+	/* breakdown of the time between an exit and the next entry */
+	struct {
+		u64 hardirq_snap;
+		u64 softirq_snap;
+		/* host TSC when the thread was scheduled out, or 0 */
+		u64 sched_out;
+		enum zerosim_missing sched_out_kind;
+		/* the current gap, then the sums of all gaps */
+		u64 gap[ZEROSIM_MISSING_NR];
+		u64 total[ZEROSIM_MISSING_NR];
+	} missing;
+
+	/* guest cycles hidden but not yet applied to TSC_OFFSET */
+	u64 tsc_offset_pending;
+
+	/* vcpu whose clock kvm_arch_vcpu_guest_ns() follows while halted */
+	struct kvm_vcpu *halt_clock_leader;
+
+	/* MSR_KVM_ZEROSIM_TIME */
+	struct {
+		u64 msr_val;
+		struct gfn_to_hva_cache cache;
+		/* accounted at entry, not yet written to the guest */
+		bool dirty;
+		u32 version;
+		u64 elapsed;
+		u64 compensated;
+		u64 exits;
+		u64 guest_tsc;
+	} zt;
+#endif
+
 	u64 last_guest_tsc;
 	u64 last_host_tsc;
 	u64 tsc_offset_adjustment;
@@ -504,6 +552,11 @@ struct kvm_vcpu_arch {
 	s8 virtual_tsc_shift;
 	u32 virtual_tsc_mult;
 	u32 virtual_tsc_khz;
+	/*
+	 * Rate at which the guest TSC actually advances, in host time.  The
+	 * same as virtual_tsc_khz unless the VM is time-dilated.
+	 */
+	u32 dilated_tsc_khz;
 	s64 ia32_tsc_adjust_msr;
 	u64 tsc_scaling_ratio;
 
@@ -695,6 +748,20 @@ struct kvm_arch {
 
 	bool irqchip_split;
 	u8 nr_reserved_ioapic_pins;
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	/* record/replay log, written under kvm->lock, read at VM entry */
+	struct zerosim_timeline __rcu *zerosim_timeline;
+
+	/* KVM_CAP_ZEROSIM_DILATION, in KVM_ZEROSIM_DILATION_ONE units */
+	u32 zerosim_dilation;
+
+	/* set up with the first vcpu, see kvm_zerosim_vm_start() */
+	bool zerosim_started;
+
+	/* last vcpu to fault on each hashed gfn, for adaptive sync */
+	u64 *zerosim_gfn_owner;
+#endif
 };
 
 struct kvm_vm_stat {
@@ -736,6 +803,7 @@ struct kvm_vcpu_stat {
 	u32 hypercalls;
 	u32 irq_injections;
 	u32 nmi_injections;
+	u32 tsc_offset_skipped;
 };
 
 struct x86_instruction_info;
@@ -916,6 +984,13 @@ struct kvm_x86_ops {
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
     /* Returns true if TSC offsetting is enabled. False otherwise. */
     bool (*tsc_offsetting_enabled)(void);
+
+    /*
+     * Returns true if the LAPIC timer can be armed in guest TSC units on
+     * each VM entry, in which case kvm_lapic_guest_timer_deadline() is
+     * consulted right before entering the guest.  Optional.
+     */
+    bool (*guest_timer_supported)(struct kvm_vcpu *vcpu);
 #endif
 };
 
@@ -1264,4 +1339,8 @@ void kvm_set_msi_irq(struct kvm_kernel_irq_routing_entry *e,
 static inline void kvm_arch_vcpu_blocking(struct kvm_vcpu *vcpu) {}
 static inline void kvm_arch_vcpu_unblocking(struct kvm_vcpu *vcpu) {}
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+#define __KVM_HAVE_ARCH_GUEST_CLOCK
+#endif
+
 #endif /* _ASM_X86_KVM_HOST_H */
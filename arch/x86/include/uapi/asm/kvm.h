@@ -357,4 +357,43 @@ struct kvm_sync_regs {
 #define KVM_X86_QUIRK_LINT0_REENABLED	(1 << 0)
 #define KVM_X86_QUIRK_CD_NW_CLEARED	(1 << 1)
 
+/* for KVM_ZEROSIM_TIMELINE */
+#define KVM_ZEROSIM_TIMELINE_STOP	0
+#define KVM_ZEROSIM_TIMELINE_RECORD	1
+#define KVM_ZEROSIM_TIMELINE_REPLAY	2
+#define KVM_ZEROSIM_TIMELINE_GET	3
+
+struct kvm_zerosim_timeline {
+	__u32 op;
+	__u32 flags;
+	/* RECORD: capacity; REPLAY, GET: records at addr; out: records logged */
+	__u64 nr;
+	__u64 addr;
+	/* out: records dropped because the log was full */
+	__u64 lost;
+	/* out: injections during replay that did not match the log */
+	__u64 diverged;
+};
+
+#define KVM_ZEROSIM_TL_ADJUST		1
+#define KVM_ZEROSIM_TL_IRQ		2
+
+struct kvm_zerosim_timeline_rec {
+	/* ADJUST: cycles hidden from the guest; IRQ: guest TSC at injection */
+	__u64 value;
+	/* number of entries of the vcpu up to this record */
+	__u32 seq;
+	__u16 vcpu_id;
+	__u8 type;
+	__u8 vector;
+};
+
+/*
+ * for KVM_CAP_ZEROSIM_DILATION: guest time advances ONE/args[0] times as
+ * fast as host time, so 2000 runs the guest at half speed.
+ */
+#define KVM_ZEROSIM_DILATION_ONE	1000
+#define KVM_ZEROSIM_DILATION_MIN	100
+#define KVM_ZEROSIM_DILATION_MAX	100000
+
 #endif /* _ASM_X86_KVM_H */
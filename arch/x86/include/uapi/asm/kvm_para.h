@@ -24,6 +24,8 @@
 #define KVM_FEATURE_STEAL_TIME		5
 #define KVM_FEATURE_PV_EOI		6
 #define KVM_FEATURE_PV_UNHALT		7
+/* 0sim: per-vcpu hidden time published in MSR_KVM_ZEROSIM_TIME's page */
+#define KVM_FEATURE_ZEROSIM_TIME	16
 
 /* The last 8 bits are used to indicate how to interpret the flags field
  * in pvclock structure. If no bits are set, all flags are ignored.
@@ -40,6 +42,7 @@
 #define MSR_KVM_ASYNC_PF_EN 0x4b564d02
 #define MSR_KVM_STEAL_TIME  0x4b564d03
 #define MSR_KVM_PV_EOI_EN      0x4b564d04
+#define MSR_KVM_ZEROSIM_TIME   0x4b564d80
 
 struct kvm_steal_time {
 	__u64 steal;
@@ -52,6 +55,33 @@ struct kvm_steal_time {
 #define KVM_STEAL_VALID_BITS ((-1ULL << (KVM_STEAL_ALIGNMENT_BITS + 1)))
 #define KVM_STEAL_RESERVED_MASK (((1 << KVM_STEAL_ALIGNMENT_BITS) - 1 ) << 1)
 
+/*
+ * Updated by the host before every VM entry that follows an exit, with the
+ * figures accounted up to the previous entry.  The version is odd while an
+ * update is in progress; readers retry until they see the same even
+ * version before and after reading the other fields.  All figures are
+ * cumulative host TSC cycles or counts since the MSR was written.
+ */
+struct kvm_zerosim_time {
+	__u32 version;
+	__u32 flags;
+	/* time spent outside the guest and hidden from its TSC */
+	__u64 elapsed;
+	/* further cycles removed to hide entry/exit and page fault cost */
+	__u64 compensated;
+	/* VM exits taken */
+	__u64 exits;
+	/* guest TSC at the entry these figures were accounted at */
+	__u64 guest_tsc;
+	__u32 pad[6];
+};
+
+#define KVM_ZEROSIM_TIME_ALIGNMENT_BITS 6
+#define KVM_ZEROSIM_TIME_VALID_BITS \
+	((-1ULL << (KVM_ZEROSIM_TIME_ALIGNMENT_BITS + 1)))
+#define KVM_ZEROSIM_TIME_RESERVED_MASK \
+	(((1 << KVM_ZEROSIM_TIME_ALIGNMENT_BITS) - 1 ) << 1)
+
 #define KVM_MAX_MMU_OP_BATCH           32
 
 #define KVM_ASYNC_PF_ENABLED			(1 << 0)
@@ -78,6 +78,8 @@ early_param("no-kvmclock-vsyscall", parse_no_kvmclock_vsyscall);
 static DEFINE_PER_CPU(struct kvm_vcpu_pv_apf_data, apf_reason) __aligned(64);
 static DEFINE_PER_CPU(struct kvm_steal_time, steal_time) __aligned(64);
 static int has_steal_clock = 0;
+static DEFINE_PER_CPU(struct kvm_zerosim_time, zerosim_time) __aligned(64);
+static int has_zerosim_time;
 
 /*
  * No need for any "IO delay" on KVM
@@ -315,6 +317,44 @@ static void kvm_register_steal_time(void)
 		cpu, (unsigned long long) slow_virt_to_phys(st));
 }
 
+static void kvm_register_zerosim_time(void)
+{
+	struct kvm_zerosim_time *zt = this_cpu_ptr(&zerosim_time);
+
+	memset(zt, 0, sizeof(*zt));
+	wrmsrl(MSR_KVM_ZEROSIM_TIME, slow_virt_to_phys(zt) | KVM_MSR_ENABLED);
+}
+
+static void kvm_disable_zerosim_time(void)
+{
+	if (has_zerosim_time)
+		wrmsrl(MSR_KVM_ZEROSIM_TIME, 0);
+}
+
+/*
+ * Snapshot the hidden-time figures the host publishes for @cpu, without
+ * exiting.  Returns false if the host does not provide them.
+ */
+bool kvm_zerosim_time_read(int cpu, struct kvm_zerosim_time *zt)
+{
+	struct kvm_zerosim_time *src;
+	u32 version;
+
+	if (!has_zerosim_time)
+		return false;
+
+	src = &per_cpu(zerosim_time, cpu);
+	do {
+		version = READ_ONCE(src->version);
+		rmb();
+		*zt = *src;
+		rmb();
+	} while ((version & 1) || (version != READ_ONCE(src->version)));
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(kvm_zerosim_time_read);
+
 static DEFINE_PER_CPU(unsigned long, kvm_apic_eoi) = KVM_PV_EOI_DISABLED;
 
 static void kvm_guest_apic_eoi_write(u32 reg, u32 val)
@@ -360,6 +400,9 @@ static void kvm_guest_cpu_init(void)
 
 	if (has_steal_clock)
 		kvm_register_steal_time();
+
+	if (has_zerosim_time)
+		kvm_register_zerosim_time();
 }
 
 static void kvm_pv_disable_apf(void)
@@ -385,6 +428,7 @@ static void kvm_pv_guest_cpu_reboot(void *unused)
 		wrmsrl(MSR_KVM_PV_EOI_EN, 0);
 	kvm_pv_disable_apf();
 	kvm_disable_steal_time();
+	kvm_disable_zerosim_time();
 }
 
 static int kvm_pv_reboot_notify(struct notifier_block *nb,
@@ -440,6 +484,7 @@ static void kvm_guest_cpu_online(void *dummy)
 static void kvm_guest_cpu_offline(void *dummy)
 {
 	kvm_disable_steal_time();
+	kvm_disable_zerosim_time();
 	if (kvm_para_has_feature(KVM_FEATURE_PV_EOI))
 		wrmsrl(MSR_KVM_PV_EOI_EN, 0);
 	kvm_pv_disable_apf();
@@ -495,6 +540,9 @@ void __init kvm_guest_init(void)
 		pv_time_ops.steal_clock = kvm_steal_clock;
 	}
 
+	if (kvm_para_has_feature(KVM_FEATURE_ZEROSIM_TIME))
+		has_zerosim_time = 1;
+
 	if (kvm_para_has_feature(KVM_FEATURE_PV_EOI))
 		apic_set_eoi_write(kvm_guest_apic_eoi_write);
 
@@ -550,6 +550,10 @@ static inline int __do_cpuid_ent(struct kvm_cpuid_entry2 *entry, u32 function,
 		if (sched_info_on())
 			entry->eax |= (1 << KVM_FEATURE_STEAL_TIME);
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+		entry->eax |= (1 << KVM_FEATURE_ZEROSIM_TIME);
+#endif
+
 		entry->ebx = 0;
 		entry->ecx = 0;
 		entry->edx = 0;
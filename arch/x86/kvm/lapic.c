@@ -80,10 +80,19 @@
 
 ZEROSIM_PROC_CREATE(int, zerosim_lapic_adjust, true, "%d");
 
+// If set, oneshot/periodic/TSC-deadline timers are kept as a guest TSC
+// deadline and armed through the vendor module (the VMX preemption timer)
+// on every VM entry, instead of by a host hrtimer that has to keep
+// re-arming itself until the guest catches up.
+ZEROSIM_PROC_CREATE(int, zerosim_lapic_guest_timer, false, "%d");
+
 static int zerosim_instrumentation_init(void)
 {
 	zerosim_lapic_adjust_ent =
         proc_create("zerosim_lapic_adjust", 0444, NULL, &zerosim_lapic_adjust_ops);
+	zerosim_lapic_guest_timer_ent =
+        proc_create("zerosim_lapic_guest_timer", 0444, NULL,
+                    &zerosim_lapic_guest_timer_ops);
 
     printk(KERN_WARNING "inited zerosim LAPIC\n");
 
@@ -1040,8 +1049,32 @@ static void apic_send_ipi(struct kvm_lapic *apic)
 		   irq.vector, irq.msi_redir_hint);
 
 	kvm_irq_delivery_to_apic(apic->vcpu->kvm, apic, &irq, NULL);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	kvm_zerosim_note_ipi(apic, &irq);
+#endif
 }
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+/*
+ * Time left until a guest-time timer fires, from the guest TSC deadline:
+ * the hrtimer is not armed while the timer runs in guest time.
+ */
+static ktime_t apic_guest_timer_remaining(struct kvm_lapic *apic)
+{
+	struct kvm_vcpu *vcpu = apic->vcpu;
+	u64 guest_tsc = kvm_read_l1_tsc(vcpu, rdtsc());
+	u64 ns;
+
+	if (apic->lapic_timer.guest_tscdeadline <= guest_tsc ||
+	    !vcpu->arch.virtual_tsc_khz)
+		return ktime_set(0, 0);
+
+	ns = (apic->lapic_timer.guest_tscdeadline - guest_tsc) * 1000000ULL;
+	do_div(ns, vcpu->arch.virtual_tsc_khz);
+	return ns_to_ktime(ns);
+}
+#endif
+
 static u32 apic_get_tmcct(struct kvm_lapic *apic)
 {
 	ktime_t remaining;
@@ -1055,6 +1088,11 @@ static u32 apic_get_tmcct(struct kvm_lapic *apic)
 		apic->lapic_timer.period == 0)
 		return 0;
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	if (apic->lapic_timer.guest_timer)
+		remaining = apic_guest_timer_remaining(apic);
+	else
+#endif
 	remaining = hrtimer_get_remaining(&apic->lapic_timer.timer);
 	if (ktime_to_ns(remaining) < 0)
 		remaining = ktime_set(0, 0);
@@ -1198,6 +1236,14 @@ static void update_divide_count(struct kvm_lapic *apic)
 				   apic->divide_count);
 }
 
+static void apic_cancel_timer(struct kvm_lapic *apic)
+{
+	hrtimer_cancel(&apic->lapic_timer.timer);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	apic->lapic_timer.guest_timer = false;
+#endif
+}
+
 static void apic_update_lvtt(struct kvm_lapic *apic)
 {
 	u32 timer_mode = kvm_apic_get_reg(apic, APIC_LVTT) &
@@ -1205,7 +1251,7 @@ static void apic_update_lvtt(struct kvm_lapic *apic)
 
 	if (apic->lapic_timer.timer_mode != timer_mode) {
 		apic->lapic_timer.timer_mode = timer_mode;
-		hrtimer_cancel(&apic->lapic_timer.timer);
+		apic_cancel_timer(apic);
 	}
 }
 
@@ -1228,6 +1274,112 @@ static void apic_timer_expired(struct kvm_lapic *apic)
 		ktimer->expired_tscdeadline = ktimer->tscdeadline;
 }
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+static bool apic_use_guest_timer(struct kvm_lapic *apic)
+{
+	return zerosim_lapic_guest_timer &&
+	       kvm_x86_ops->guest_timer_supported &&
+	       kvm_x86_ops->guest_timer_supported(apic->vcpu);
+}
+
+static u64 apic_ns_to_guest_tsc(struct kvm_lapic *apic, u64 ns)
+{
+	u64 cycles = ns * apic->vcpu->arch.virtual_tsc_khz;
+
+	do_div(cycles, 1000000ULL);
+	return cycles;
+}
+
+/*
+ * The guest deadline has passed: deliver the interrupt and either move
+ * the deadline on by one period or disarm.
+ */
+static void apic_guest_timer_fire(struct kvm_lapic *apic)
+{
+	struct kvm_timer *ktimer = &apic->lapic_timer;
+
+	apic_timer_expired(apic);
+
+	if (apic_lvtt_period(apic))
+		ktimer->guest_tscdeadline +=
+			apic_ns_to_guest_tsc(apic, ktimer->period);
+	else
+		ktimer->guest_timer = false;
+}
+
+/*
+ * Returns the guest TSC at which the vendor module should exit to deliver
+ * the timer interrupt, or 0 if no guest timer is armed.  Called with
+ * interrupts disabled right before VM entry, after the TSC offset has
+ * been adjusted for the time spent outside the guest.
+ */
+u64 kvm_lapic_guest_timer_deadline(struct kvm_vcpu *vcpu)
+{
+	struct kvm_lapic *apic = vcpu->arch.apic;
+
+	if (!kvm_vcpu_has_lapic(vcpu) || !apic->lapic_timer.guest_timer)
+		return 0;
+
+	return apic->lapic_timer.guest_tscdeadline;
+}
+EXPORT_SYMBOL_GPL(kvm_lapic_guest_timer_deadline);
+
+/*
+ * Called on the exit caused by the deadline returned above.  The hardware
+ * timer may have been clamped and fire early, in which case the next
+ * entry just arms it again for the remainder.
+ */
+void kvm_lapic_guest_timer_expired(struct kvm_vcpu *vcpu)
+{
+	struct kvm_lapic *apic = vcpu->arch.apic;
+
+	if (!kvm_vcpu_has_lapic(vcpu) || !apic->lapic_timer.guest_timer)
+		return;
+
+	if (kvm_read_l1_tsc(vcpu, rdtsc()) < apic->lapic_timer.guest_tscdeadline)
+		return;
+
+	apic_guest_timer_fire(apic);
+}
+EXPORT_SYMBOL_GPL(kvm_lapic_guest_timer_expired);
+
+/*
+ * The hardware timer only counts while the vcpu is in the guest, so a
+ * blocked vcpu needs the hrtimer to wake it up.  apic_timer_fn() still
+ * checks the guest deadline before delivering.
+ */
+void kvm_lapic_switch_to_sw_timer(struct kvm_vcpu *vcpu)
+{
+	struct kvm_lapic *apic = vcpu->arch.apic;
+	struct kvm_timer *ktimer;
+	u64 guest_tsc, ns = 0;
+
+	if (!kvm_vcpu_has_lapic(vcpu) || !apic->lapic_timer.guest_timer)
+		return;
+
+	ktimer = &apic->lapic_timer;
+	guest_tsc = kvm_read_l1_tsc(vcpu, rdtsc());
+	if (ktimer->guest_tscdeadline > guest_tsc) {
+		ns = (ktimer->guest_tscdeadline - guest_tsc) * 1000000ULL;
+		do_div(ns, vcpu->arch.dilated_tsc_khz);
+	}
+
+	hrtimer_start(&ktimer->timer,
+		      ktime_add_ns(ktimer->timer.base->get_time(), ns),
+		      HRTIMER_MODE_ABS);
+}
+
+void kvm_lapic_switch_to_hv_timer(struct kvm_vcpu *vcpu)
+{
+	struct kvm_lapic *apic = vcpu->arch.apic;
+
+	if (!kvm_vcpu_has_lapic(vcpu) || !apic->lapic_timer.guest_timer)
+		return;
+
+	hrtimer_cancel(&apic->lapic_timer.timer);
+}
+#endif
+
 /*
  * On APICv, this test will cause a busy wait
  * during a higher-priority task.
@@ -1285,7 +1437,6 @@ static void start_apic_timer(struct kvm_lapic *apic)
 	if (apic_lvtt_period(apic) || apic_lvtt_oneshot(apic)) {
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
 		struct kvm_vcpu *vcpu = apic->vcpu;
-		unsigned long this_tsc_khz = vcpu->arch.virtual_tsc_khz;
         u64 guest_tscdeadline;
 #endif
 
@@ -1316,11 +1467,14 @@ static void start_apic_timer(struct kvm_lapic *apic)
 
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
         // Compute the target guest tsc and store with the timer.
-        guest_tscdeadline = apic->lapic_timer.period;
-        do_div(guest_tscdeadline, 1000000ULL);
-        guest_tscdeadline *= this_tsc_khz;
+        guest_tscdeadline = apic_ns_to_guest_tsc(apic, apic->lapic_timer.period);
         guest_tscdeadline += kvm_read_l1_tsc(vcpu, rdtsc());
         apic->lapic_timer.guest_tscdeadline = guest_tscdeadline;
+
+        if (apic_use_guest_timer(apic)) {
+            apic->lapic_timer.guest_timer = true;
+            return;
+        }
 #endif
 
 		hrtimer_start(&apic->lapic_timer.timer,
@@ -1342,7 +1496,7 @@ static void start_apic_timer(struct kvm_lapic *apic)
 		u64 ns = 0;
 		ktime_t expire;
 		struct kvm_vcpu *vcpu = apic->vcpu;
-		unsigned long this_tsc_khz = vcpu->arch.virtual_tsc_khz;
+		unsigned long this_tsc_khz = vcpu->arch.dilated_tsc_khz;
 		unsigned long flags;
 
 		if (unlikely(!tscdeadline || !this_tsc_khz))
@@ -1361,8 +1515,11 @@ static void start_apic_timer(struct kvm_lapic *apic)
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
             // Store the guest TSC deadline with the timer.
             apic->lapic_timer.guest_tscdeadline = tscdeadline;
-#endif
 
+            if (apic_use_guest_timer(apic))
+                apic->lapic_timer.guest_timer = true;
+            else
+#endif
 			hrtimer_start(&apic->lapic_timer.timer,
 				      expire, HRTIMER_MODE_ABS);
 		} else
@@ -1485,7 +1642,7 @@ static int apic_reg_write(struct kvm_lapic *apic, u32 reg, u32 val)
 		if (apic_lvtt_tscdeadline(apic))
 			break;
 
-		hrtimer_cancel(&apic->lapic_timer.timer);
+		apic_cancel_timer(apic);
 		apic_set_reg(apic, APIC_TMICT, val);
 		start_apic_timer(apic);
 		break;
@@ -1581,7 +1738,7 @@ void kvm_free_lapic(struct kvm_vcpu *vcpu)
 	if (!vcpu->arch.apic)
 		return;
 
-	hrtimer_cancel(&apic->lapic_timer.timer);
+	apic_cancel_timer(apic);
 
 	if (!(vcpu->arch.apic_base & MSR_IA32_APICBASE_ENABLE))
 		static_key_slow_dec_deferred(&apic_hw_disabled);
@@ -1620,7 +1777,7 @@ void kvm_set_lapic_tscdeadline_msr(struct kvm_vcpu *vcpu, u64 data)
 			apic_lvtt_period(apic))
 		return;
 
-	hrtimer_cancel(&apic->lapic_timer.timer);
+	apic_cancel_timer(apic);
 	apic->lapic_timer.tscdeadline = data;
 	start_apic_timer(apic);
 }
@@ -1703,7 +1860,7 @@ void kvm_lapic_reset(struct kvm_vcpu *vcpu, bool init_event)
 	ASSERT(apic != NULL);
 
 	/* Stop the timer in case it's a reset to an active apic */
-	hrtimer_cancel(&apic->lapic_timer.timer);
+	apic_cancel_timer(apic);
 
 	if (!init_event)
 		kvm_apic_set_id(apic, vcpu->vcpu_id);
@@ -1808,10 +1965,10 @@ static enum hrtimer_restart apic_timer_fn(struct hrtimer *data)
 	struct kvm_lapic *apic = container_of(ktimer, struct kvm_lapic, lapic_timer);
 
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
-    if (zerosim_lapic_adjust) {
+    if (zerosim_lapic_adjust || ktimer->guest_timer) {
         struct kvm_vcpu *vcpu = apic->vcpu;
         u64 guest_tsc = kvm_read_l1_tsc(vcpu, rdtsc());
-        unsigned long this_tsc_khz = vcpu->arch.virtual_tsc_khz;
+        unsigned long this_tsc_khz = vcpu->arch.dilated_tsc_khz;
 
         // Check here if we actually expired all of the guest time. Add time to
         // the timer and restart it if not (i.e. keep waiting).
@@ -1822,6 +1979,15 @@ static enum hrtimer_restart apic_timer_fn(struct hrtimer *data)
             return HRTIMER_RESTART;
         }
     }
+
+    // Standing in for the hardware timer while the vcpu is blocked.
+    if (ktimer->guest_timer) {
+        apic_guest_timer_fire(apic);
+        if (!ktimer->guest_timer)
+            return HRTIMER_NORESTART;
+        hrtimer_add_expires_ns(&ktimer->timer, ktimer->period);
+        return HRTIMER_RESTART;
+    }
 #endif
 
 	apic_timer_expired(apic);
@@ -1956,7 +2122,7 @@ void kvm_apic_post_state_restore(struct kvm_vcpu *vcpu,
 	kvm_apic_set_version(vcpu);
 
 	apic_update_ppr(apic);
-	hrtimer_cancel(&apic->lapic_timer.timer);
+	apic_cancel_timer(apic);
 	apic_update_lvtt(apic);
 	apic_manage_nmi_watchdog(apic, kvm_apic_get_reg(apic, APIC_LVT0));
 	update_divide_count(apic);
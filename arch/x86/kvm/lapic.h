@@ -22,6 +22,10 @@ struct kvm_timer {
     // make sure that hardware events arrive at the same rate in the
     // simulation as in the host.
     u64 guest_tscdeadline;
+
+    // Set while the timer is tracked only by guest_tscdeadline and armed
+    // by the vendor module on each VM entry (see zerosim_lapic_guest_timer).
+    bool guest_timer;
 #endif
 };
 
@@ -177,4 +181,11 @@ void wait_lapic_expire(struct kvm_vcpu *vcpu);
 
 bool kvm_intr_is_single_vcpu_fast(struct kvm *kvm, struct kvm_lapic_irq *irq,
 			struct kvm_vcpu **dest_vcpu);
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+u64 kvm_lapic_guest_timer_deadline(struct kvm_vcpu *vcpu);
+void kvm_lapic_guest_timer_expired(struct kvm_vcpu *vcpu);
+void kvm_lapic_switch_to_sw_timer(struct kvm_vcpu *vcpu);
+void kvm_lapic_switch_to_hv_timer(struct kvm_vcpu *vcpu);
+#endif
 #endif
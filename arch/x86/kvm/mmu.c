@@ -4399,6 +4399,13 @@ int kvm_mmu_page_fault(struct kvm_vcpu *vcpu, gva_t cr2, u32 error_code,
 	int r, emulation_type = EMULTYPE_RETRY;
 	enum emulation_result er;
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	/* with a direct map, cr2 is the faulting gpa */
+	if (vcpu->arch.mmu.direct_map)
+		kvm_zerosim_note_fault(vcpu, gpa_to_gfn(cr2),
+				       error_code & PFERR_WRITE_MASK);
+#endif
+
 	r = vcpu->arch.mmu.page_fault(vcpu, cr2, error_code, false);
 	if (r < 0)
 		goto out;
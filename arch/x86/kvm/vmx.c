@@ -53,6 +53,7 @@
 #include "pmu.h"
 
 #include "x86_timing.h"
+#include "x86_timeline.h"
 
 #define __ex(x) __kvm_handle_fault_on_reboot(x)
 #define __ex_clear(x, reg) \
@@ -113,6 +114,18 @@ module_param_named(pml, enable_pml, bool, S_IRUGO);
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
 static bool __read_mostly enable_tsc_offsetting = true;
 module_param(enable_tsc_offsetting, bool, 0644);
+
+/*
+ * Hide time from the guest lazily: as long as the cycles to hide add up to
+ * less than this, carry them over to a later entry instead of rewriting
+ * TSC_OFFSET. The guest's TSC runs ahead by at most this much in between.
+ * 0 applies every adjustment immediately.
+ */
+static unsigned long __read_mostly lazy_tsc_offset;
+module_param(lazy_tsc_offset, ulong, 0644);
+
+/* The preemption timer counts down once every 2^rate TSC cycles. */
+static int __read_mostly cpu_preemption_timer_rate;
 #endif
 
 #define KVM_VMX_TSC_MULTIPLIER_MAX     0xffffffffffffffffULL
@@ -600,6 +613,11 @@ struct vcpu_vmx {
 	int ple_window;
 	bool ple_window_dirty;
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	/* The preemption timer is enabled for the LAPIC guest timer. */
+	bool guest_timer_armed;
+#endif
+
 	/* Support for PML */
 #define PML_ENTITY_NUM		512
 	struct page *pml_pg;
@@ -1159,6 +1177,12 @@ static inline bool cpu_has_virtual_nmis(void)
 	return vmcs_config.pin_based_exec_ctrl & PIN_BASED_VIRTUAL_NMIS;
 }
 
+static inline bool cpu_has_vmx_preemption_timer(void)
+{
+	return vmcs_config.pin_based_exec_ctrl &
+		PIN_BASED_VMX_PREEMPTION_TIMER;
+}
+
 static inline bool cpu_has_vmx_wbinvd_exit(void)
 {
 	return vmcs_config.cpu_based_2nd_exec_ctrl &
@@ -2437,6 +2461,10 @@ static u64 vmx_read_tsc_offset(struct kvm_vcpu *vcpu)
  */
 static void vmx_write_tsc_offset(struct kvm_vcpu *vcpu, u64 offset)
 {
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	/* Whatever was still to be hidden is moot now. */
+	vcpu->arch.tsc_offset_pending = 0;
+#endif
 	if (is_guest_mode(vcpu)) {
 		/*
 		 * We're here if L1 chose not to trap WRMSR to TSC. According
@@ -2516,12 +2544,36 @@ static void vmx_adjust_tsc_offset_guest_actually(struct kvm_vcpu *vcpu, s64 adju
 #endif
 }
 
+/*
+ * Hide @hidden more guest cycles, deferring the VMCS write while the total
+ * still to hide is below lazy_tsc_offset. Nested guests always take the
+ * slow path so that vmcs01_tsc_offset stays exact.
+ */
+static void vmx_lazy_adjust_tsc_offset(struct kvm_vcpu *vcpu, u64 hidden)
+{
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+    hidden += vcpu->arch.tsc_offset_pending;
+
+    if (enable_tsc_offsetting && hidden < lazy_tsc_offset &&
+        !is_guest_mode(vcpu)) {
+        vcpu->arch.tsc_offset_pending = hidden;
+        vcpu->start_missing = 0;
+        ++vcpu->stat.tsc_offset_skipped;
+        return;
+    }
+
+    vcpu->arch.tsc_offset_pending = 0;
+    vmx_adjust_tsc_offset_guest_actually(vcpu, -(s64)hidden);
+#endif
+}
+
 static void vmx_force_tsc_offset_guest(struct kvm_vcpu *vcpu, u64 new_offset)
 {
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
     vmcs_write64(TSC_OFFSET, new_offset);
     vcpu->tsc_offset = new_offset;
     vcpu->start_missing = 0;
+    vcpu->arch.tsc_offset_pending = 0;
 #endif
 }
 
@@ -3274,7 +3326,8 @@ static __init int setup_vmcs_config(struct vmcs_config *vmcs_conf)
 		return -EIO;
 
 	min = PIN_BASED_EXT_INTR_MASK | PIN_BASED_NMI_EXITING;
-	opt = PIN_BASED_VIRTUAL_NMIS | PIN_BASED_POSTED_INTR;
+	opt = PIN_BASED_VIRTUAL_NMIS | PIN_BASED_POSTED_INTR |
+		PIN_BASED_VMX_PREEMPTION_TIMER;
 	if (adjust_vmx_controls(min, opt, MSR_IA32_VMX_PINBASED_CTLS,
 				&_pin_based_exec_control) < 0)
 		return -EIO;
@@ -4748,6 +4801,8 @@ static u32 vmx_pin_based_exec_ctrl(struct vcpu_vmx *vmx)
 
 	if (!vmx_cpu_uses_apicv(&vmx->vcpu))
 		pin_based_exec_ctrl &= ~PIN_BASED_POSTED_INTR;
+	/* Enabled on demand by vmx_arm_guest_timer() */
+	pin_based_exec_ctrl &= ~PIN_BASED_VMX_PREEMPTION_TIMER;
 	return pin_based_exec_ctrl;
 }
 
@@ -6289,6 +6344,17 @@ static __init int hardware_setup(void)
 		kvm_tsc_scaling_ratio_frac_bits = 48;
 	}
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	if (cpu_has_vmx_preemption_timer()) {
+		u64 vmx_misc;
+
+		rdmsrl(MSR_IA32_VMX_MISC, vmx_misc);
+		cpu_preemption_timer_rate =
+			vmx_misc & VMX_MISC_PREEMPTION_TIMER_RATE_MASK;
+	} else
+		kvm_x86_ops->guest_timer_supported = NULL;
+#endif
+
 	if (enable_apicv)
 		kvm_x86_ops->update_cr8_intercept = NULL;
 	else {
@@ -7525,6 +7591,14 @@ static int handle_pcommit(struct kvm_vcpu *vcpu)
 	return 1;
 }
 
+static int handle_preemption_timer(struct kvm_vcpu *vcpu)
+{
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	kvm_lapic_guest_timer_expired(vcpu);
+#endif
+	return 1;
+}
+
 /*
  * The exit handlers return 1 if the exit was handled fully and guest execution
  * may resume.  Otherwise they set the kvm_run parameter to indicate what needs
@@ -7576,6 +7650,7 @@ static int (*const kvm_vmx_exit_handlers[])(struct kvm_vcpu *vcpu) = {
 	[EXIT_REASON_XRSTORS]                 = handle_xrstors,
 	[EXIT_REASON_PML_FULL]		      = handle_pml_full,
 	[EXIT_REASON_PCOMMIT]                 = handle_pcommit,
+	[EXIT_REASON_PREEMPTION_TIMER]	      = handle_preemption_timer,
 };
 
 static const int kvm_vmx_max_exit_handlers =
@@ -8575,6 +8650,53 @@ static void atomic_switch_perf_msrs(struct vcpu_vmx *vmx)
 					msrs[i].host);
 }
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+/*
+ * Arm the preemption timer for the LAPIC guest timer, if any.  This runs
+ * after the TSC offset has been adjusted for the time spent outside the
+ * guest, and the timer only counts in VMX non-root mode, so the exit
+ * happens exactly when the guest TSC reaches the deadline.
+ */
+static void vmx_arm_guest_timer(struct kvm_vcpu *vcpu)
+{
+	struct vcpu_vmx *vmx = to_vmx(vcpu);
+	u64 deadline = kvm_lapic_guest_timer_deadline(vcpu);
+	u64 guest_tsc, delta = 0;
+
+	if (!deadline) {
+		if (vmx->guest_timer_armed) {
+			vmcs_clear_bits(PIN_BASED_VM_EXEC_CONTROL,
+					PIN_BASED_VMX_PREEMPTION_TIMER);
+			vmx->guest_timer_armed = false;
+		}
+		return;
+	}
+
+	guest_tsc = kvm_read_l1_tsc(vcpu, rdtsc());
+	if (deadline > guest_tsc) {
+		/* Anything beyond this is clamped below anyway. */
+		delta = min_t(u64, deadline - guest_tsc,
+			      (u64)U32_MAX << cpu_preemption_timer_rate);
+
+		/* Guest TSC cycles to host TSC cycles */
+		if (vcpu->arch.dilated_tsc_khz &&
+		    vcpu->arch.dilated_tsc_khz != tsc_khz) {
+			delta *= tsc_khz;
+			do_div(delta, vcpu->arch.dilated_tsc_khz);
+		}
+	}
+
+	delta >>= cpu_preemption_timer_rate;
+	vmcs_write32(VMX_PREEMPTION_TIMER_VALUE, min_t(u64, delta, U32_MAX));
+
+	if (!vmx->guest_timer_armed) {
+		vmcs_set_bits(PIN_BASED_VM_EXEC_CONTROL,
+			      PIN_BASED_VMX_PREEMPTION_TIMER);
+		vmx->guest_timer_armed = true;
+	}
+}
+#endif
+
 static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
 {
 	struct vcpu_vmx *vmx = to_vmx(vcpu);
@@ -8583,6 +8705,7 @@ static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
     unsigned long long page_fault_time = 0;
     unsigned long long entry_exit_time;
     unsigned long long elapsed;
+    unsigned long long hidden;
 
 	/* Record the guest's net vcpu time for enforced NMI injections. */
 	if (unlikely(!cpu_has_virtual_nmis() && vmx->soft_vnmi_blocked))
@@ -8632,11 +8755,33 @@ static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
         }
         entry_exit_time = kvm_x86_get_entry_exit_time();
         elapsed = rdtsc() - vcpu->start_missing;
-        vmx_adjust_tsc_offset_guest_actually(vcpu, 
-                -elapsed-entry_exit_time-page_fault_time);
+        kvm_exit_hist_add(vcpu, (u16)vmx->exit_reason, elapsed);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+        elapsed = kvm_zerosim_missing_end(vcpu, elapsed);
+#endif
+        hidden = elapsed + entry_exit_time + page_fault_time;
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+        // When replaying, hide what the recorded run hid instead, and
+        // account for it as if it had been measured.
+        hidden = kvm_zerosim_timeline_adjust(vcpu, hidden);
+        elapsed = hidden - min(hidden, entry_exit_time + page_fault_time);
+
+        // The offset is added to the scaled TSC, so a time-dilated guest
+        // must be hidden guest cycles rather than host cycles.
+        hidden = kvm_scale_tsc(vcpu, hidden);
+        elapsed = kvm_scale_tsc(vcpu, elapsed);
+#endif
+        vmx_lazy_adjust_tsc_offset(vcpu, hidden);
         kvm_x86_elapse_time(elapsed, vcpu->vcpu_id);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+        kvm_zerosim_time_update(vcpu, elapsed, hidden - elapsed);
+#endif
     }
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+    vmx_arm_guest_timer(vcpu);
+#endif
+
 	atomic_switch_perf_msrs(vmx);
 	debugctlmsr = get_debugctlmsr();
 
@@ -8764,6 +8909,9 @@ static void __noclone vmx_vcpu_run(struct kvm_vcpu *vcpu)
 #endif
 
     vcpu->start_missing = rdtsc();
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+    kvm_zerosim_missing_begin(vcpu);
+#endif
 
 	vcpu->arch.regs_avail = ~((1 << VCPU_REGS_RIP) | (1 << VCPU_REGS_RSP)
 				  | (1 << VCPU_EXREG_RFLAGS)
@@ -10863,6 +11011,15 @@ out:
 static bool vmx_tsc_offsetting_enabled(void) {
     return enable_tsc_offsetting;
 }
+
+static bool vmx_guest_timer_supported(struct kvm_vcpu *vcpu)
+{
+	/*
+	 * vmcs02 has its own pin-based controls and L1 may use the timer
+	 * itself; keep it simple and only do this without nested VMX.
+	 */
+	return !nested;
+}
 #endif
 
 static struct kvm_x86_ops vmx_x86_ops = {
@@ -10989,6 +11146,7 @@ static struct kvm_x86_ops vmx_x86_ops = {
 
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
     .tsc_offsetting_enabled = vmx_tsc_offsetting_enabled,
+    .guest_timer_supported = vmx_guest_timer_supported,
 #endif
 };
 
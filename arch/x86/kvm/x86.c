@@ -31,12 +31,15 @@
 #include "pmu.h"
 #include "hyperv.h"
 #include "x86_timing.h"
+#include "x86_timeline.h"
+#include "x86_skew.h"
 
 #include <linux/clocksource.h>
 #include <linux/interrupt.h>
 #include <linux/kvm.h>
 #include <linux/fs.h>
 #include <linux/vmalloc.h>
+#include <linux/seq_file.h>
 #include <linux/module.h>
 #include <linux/mman.h>
 #include <linux/highmem.h>
@@ -84,8 +87,30 @@
 ZEROSIM_PROC_CREATE(unsigned long, zerosim_d, ZEROSIM_THRESHOLD_DEFAULT, "%lu");
 ZEROSIM_PROC_CREATE(unsigned long, zerosim_delta, ZEROSIM_DELAY_DEFAULT, "%lu");
 ZEROSIM_PROC_CREATE(int, zerosim_skip_halt, false, "%d");
-ZEROSIM_PROC_CREATE(unsigned long, zerosim_multicore_sync, false, "%lu");
+ZEROSIM_PROC_CREATE_HOOK(unsigned long, zerosim_multicore_sync, false, "%lu",
+        zerosim_skew_set_sync(zerosim_multicore_sync));
 ZEROSIM_PROC_CREATE(unsigned long, zerosim_sync_guest_tsc, false, "%lu");
+ZEROSIM_PROC_CREATE(int, zerosim_adaptive_sync, false, "%d");
+ZEROSIM_PROC_CREATE(unsigned long, zerosim_adaptive_window,
+        ZEROSIM_THRESHOLD_DEFAULT * 10, "%lu");
+ZEROSIM_PROC_CREATE(unsigned long, zerosim_adaptive_max_d,
+        ZEROSIM_THRESHOLD_DEFAULT * 100, "%lu");
+
+static void zerosim_missing_acct_sync(void);
+
+// Bitmask of the `enum zerosim_missing` categories hidden from the guest.
+#define ZEROSIM_MISSING_ALL ((1UL << ZEROSIM_MISSING_NR) - 1)
+ZEROSIM_PROC_CREATE_HOOK(unsigned long, zerosim_hidden_missing,
+        ZEROSIM_MISSING_ALL, "%lx", zerosim_missing_acct_sync());
+// Whether to account interrupt time in the /proc/zerosim_missing totals.
+ZEROSIM_PROC_CREATE_HOOK(int, zerosim_missing_breakdown, false, "%d",
+        zerosim_missing_acct_sync());
+
+static const struct file_operations zerosim_drift_bounds_ops;
+static const struct file_operations zerosim_missing_ops;
+
+static void zerosim_missing_load(struct kvm_vcpu *vcpu);
+static void zerosim_missing_put(struct kvm_vcpu *vcpu);
 
 static int zerosim_instrumentation_init(void)
 {
@@ -99,8 +124,21 @@ static int zerosim_instrumentation_init(void)
         proc_create("zerosim_multicore_sync", 0444, NULL, &zerosim_multicore_sync_ops);
 	zerosim_sync_guest_tsc_ent =
         proc_create("zerosim_sync_guest_tsc", 0444, NULL, &zerosim_sync_guest_tsc_ops);
+	zerosim_adaptive_sync_ent =
+        proc_create("zerosim_adaptive_sync", 0444, NULL, &zerosim_adaptive_sync_ops);
+	zerosim_adaptive_window_ent =
+        proc_create("zerosim_adaptive_window", 0444, NULL, &zerosim_adaptive_window_ops);
+	zerosim_adaptive_max_d_ent =
+        proc_create("zerosim_adaptive_max_drift", 0444, NULL, &zerosim_adaptive_max_d_ops);
+    proc_create("zerosim_drift_bounds", 0444, NULL, &zerosim_drift_bounds_ops);
+	zerosim_hidden_missing_ent =
+        proc_create("zerosim_hidden_missing", 0444, NULL, &zerosim_hidden_missing_ops);
+	zerosim_missing_breakdown_ent =
+        proc_create("zerosim_missing_breakdown", 0444, NULL, &zerosim_missing_breakdown_ops);
+    proc_create("zerosim_missing", 0444, NULL, &zerosim_missing_ops);
 
     zerosim_elapsed_init();
+    zerosim_skew_init();
 
     printk(KERN_WARNING "inited zerosim\n");
 
@@ -214,6 +252,7 @@ struct kvm_stats_debugfs_item debugfs_entries[] = {
 	{ "insn_emulation_fail", VCPU_STAT(insn_emulation_fail) },
 	{ "irq_injections", VCPU_STAT(irq_injections) },
 	{ "nmi_injections", VCPU_STAT(nmi_injections) },
+	{ "tsc_offset_skipped", VCPU_STAT(tsc_offset_skipped) },
 	{ "mmu_shadow_zapped", VM_STAT(mmu_shadow_zapped) },
 	{ "mmu_pte_write", VM_STAT(mmu_pte_write) },
 	{ "mmu_pte_updated", VM_STAT(mmu_pte_updated) },
@@ -1013,6 +1052,9 @@ static u32 emulated_msrs[] = {
 	HV_X64_MSR_VP_RUNTIME,
 	HV_X64_MSR_APIC_ASSIST_PAGE, MSR_KVM_ASYNC_PF_EN, MSR_KVM_STEAL_TIME,
 	MSR_KVM_PV_EOI_EN,
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	MSR_KVM_ZEROSIM_TIME,
+#endif
 
 	MSR_IA32_TSC_ADJUST,
 	MSR_IA32_TSCDEADLINE,
@@ -1344,6 +1386,7 @@ static int kvm_set_tsc_khz(struct kvm_vcpu *vcpu, u32 this_tsc_khz)
 	if (this_tsc_khz == 0) {
 		/* set tsc_scaling_ratio to a safe value */
 		vcpu->arch.tsc_scaling_ratio = kvm_default_tsc_scaling_ratio;
+		vcpu->arch.dilated_tsc_khz = 0;
 		return -1;
 	}
 
@@ -1352,6 +1395,21 @@ static int kvm_set_tsc_khz(struct kvm_vcpu *vcpu, u32 this_tsc_khz)
 			   &vcpu->arch.virtual_tsc_shift,
 			   &vcpu->arch.virtual_tsc_mult);
 	vcpu->arch.virtual_tsc_khz = this_tsc_khz;
+	vcpu->arch.dilated_tsc_khz = this_tsc_khz;
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	/*
+	 * A dilated guest keeps seeing its nominal rate everywhere (kvmclock,
+	 * guest timer conversions), but the hardware advances its TSC slower
+	 * or faster than that in host time.
+	 */
+	if (vcpu->kvm->arch.zerosim_dilation != KVM_ZEROSIM_DILATION_ONE) {
+		vcpu->arch.dilated_tsc_khz =
+			div_u64((u64)this_tsc_khz * KVM_ZEROSIM_DILATION_ONE,
+				vcpu->kvm->arch.zerosim_dilation);
+		return set_tsc_khz(vcpu, vcpu->arch.dilated_tsc_khz, 1);
+	}
+#endif
 
 	/*
 	 * Compute the variation in TSC rate which is acceptable
@@ -2072,6 +2130,81 @@ static void record_steal_time(struct kvm_vcpu *vcpu)
 		&vcpu->arch.st.steal, sizeof(struct kvm_steal_time));
 }
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+/*
+ * The figures are accounted right before VM entry with interrupts disabled,
+ * where the guest cannot be written to, so they only reach the guest page
+ * from vcpu_enter_guest() before the next entry, like steal time.
+ */
+static int kvm_zerosim_time_set_msr(struct kvm_vcpu *vcpu, u64 data)
+{
+	gpa_t gpa = data & KVM_ZEROSIM_TIME_VALID_BITS;
+
+	if (data & KVM_ZEROSIM_TIME_RESERVED_MASK)
+		return 1;
+
+	vcpu->arch.zt.msr_val = data;
+	vcpu->arch.zt.dirty = false;
+
+	if (!(data & KVM_MSR_ENABLED))
+		return 0;
+
+	if (kvm_gfn_to_hva_cache_init(vcpu->kvm, &vcpu->arch.zt.cache, gpa,
+				      sizeof(struct kvm_zerosim_time))) {
+		vcpu->arch.zt.msr_val = 0;
+		return 1;
+	}
+
+	vcpu->arch.zt.version = 0;
+	vcpu->arch.zt.elapsed = 0;
+	vcpu->arch.zt.compensated = 0;
+	vcpu->arch.zt.exits = 0;
+	return 0;
+}
+
+static void kvm_zerosim_time_publish(struct kvm_vcpu *vcpu)
+{
+	struct gfn_to_hva_cache *ghc = &vcpu->arch.zt.cache;
+	struct kvm_zerosim_time zt = {
+		.elapsed = vcpu->arch.zt.elapsed,
+		.compensated = vcpu->arch.zt.compensated,
+		.exits = vcpu->arch.zt.exits,
+		.guest_tsc = vcpu->arch.zt.guest_tsc,
+	};
+
+	vcpu->arch.zt.dirty = false;
+
+	/* Same protocol as kvmclock: odd version, data, even version */
+	zt.version = ++vcpu->arch.zt.version;
+	if (kvm_write_guest_cached(vcpu->kvm, ghc, &zt, sizeof(zt.version)))
+		return;
+	smp_wmb();
+	kvm_write_guest_cached(vcpu->kvm, ghc, &zt, sizeof(zt));
+	smp_wmb();
+	zt.version = ++vcpu->arch.zt.version;
+	kvm_write_guest_cached(vcpu->kvm, ghc, &zt, sizeof(zt.version));
+}
+
+/*
+ * Called by the vendor module on every entry after an exit, once the TSC
+ * offset has been adjusted by @elapsed + @compensated cycles.
+ */
+void kvm_zerosim_time_update(struct kvm_vcpu *vcpu, u64 elapsed,
+			     u64 compensated)
+{
+	vcpu->arch.zt.elapsed += elapsed;
+	vcpu->arch.zt.compensated += compensated;
+	vcpu->arch.zt.exits++;
+
+	if (!(vcpu->arch.zt.msr_val & KVM_MSR_ENABLED))
+		return;
+
+	vcpu->arch.zt.guest_tsc = kvm_read_l1_tsc(vcpu, rdtsc());
+	vcpu->arch.zt.dirty = true;
+}
+EXPORT_SYMBOL_GPL(kvm_zerosim_time_update);
+#endif
+
 int kvm_set_msr_common(struct kvm_vcpu *vcpu, struct msr_data *msr_info)
 {
 	bool pr = false;
@@ -2210,6 +2343,12 @@ int kvm_set_msr_common(struct kvm_vcpu *vcpu, struct msr_data *msr_info)
 		kvm_make_request(KVM_REQ_STEAL_UPDATE, vcpu);
 
 		break;
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	case MSR_KVM_ZEROSIM_TIME:
+		if (kvm_zerosim_time_set_msr(vcpu, data))
+			return 1;
+		break;
+#endif
 	case MSR_KVM_PV_EOI_EN:
 		if (kvm_lapic_enable_pv_eoi(vcpu, data))
 			return 1;
@@ -2424,6 +2563,11 @@ int kvm_get_msr_common(struct kvm_vcpu *vcpu, struct msr_data *msr_info)
 	case MSR_KVM_STEAL_TIME:
 		msr_info->data = vcpu->arch.st.msr_val;
 		break;
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	case MSR_KVM_ZEROSIM_TIME:
+		msr_info->data = vcpu->arch.zt.msr_val;
+		break;
+#endif
 	case MSR_KVM_PV_EOI_EN:
 		msr_info->data = vcpu->arch.pv_eoi.msr_val;
 		break;
@@ -2623,6 +2767,14 @@ int kvm_vm_ioctl_check_extension(struct kvm *kvm, long ext)
 	case KVM_CAP_COALESCED_MMIO:
 		r = KVM_COALESCED_MMIO_PAGE_OFFSET;
 		break;
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	case KVM_CAP_ZEROSIM_TIMELINE:
+		r = 1;
+		break;
+	case KVM_CAP_ZEROSIM_DILATION:
+		r = kvm_has_tsc_control;
+		break;
+#endif
 	case KVM_CAP_VAPIC:
 		r = !kvm_x86_ops->cpu_has_accelerated_tpr();
 		break;
@@ -2783,10 +2935,16 @@ void kvm_arch_vcpu_load(struct kvm_vcpu *vcpu, int cpu)
 	}
 
 	kvm_make_request(KVM_REQ_STEAL_UPDATE, vcpu);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	zerosim_missing_load(vcpu);
+#endif
 }
 
 void kvm_arch_vcpu_put(struct kvm_vcpu *vcpu)
 {
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	zerosim_missing_put(vcpu);
+#endif
 	kvm_x86_ops->vcpu_put(vcpu);
 	kvm_put_guest_fpu(vcpu);
 	vcpu->arch.last_host_tsc = rdtsc();
@@ -3763,6 +3921,23 @@ split_irqchip_unlock:
 		mutex_unlock(&kvm->lock);
 		break;
 	}
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	case KVM_CAP_ZEROSIM_DILATION:
+		r = -EINVAL;
+		if (!kvm_has_tsc_control ||
+		    cap->args[0] < KVM_ZEROSIM_DILATION_MIN ||
+		    cap->args[0] > KVM_ZEROSIM_DILATION_MAX)
+			break;
+		/* the vcpus pick it up when their TSC rate is set */
+		mutex_lock(&kvm->lock);
+		r = -EBUSY;
+		if (!atomic_read(&kvm->online_vcpus)) {
+			kvm->arch.zerosim_dilation = cap->args[0];
+			r = 0;
+		}
+		mutex_unlock(&kvm->lock);
+		break;
+#endif
 	default:
 		r = -EINVAL;
 		break;
@@ -4035,6 +4210,23 @@ long kvm_arch_vm_ioctl(struct file *filp,
 		r = kvm_vm_ioctl_enable_cap(kvm, &cap);
 		break;
 	}
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	case KVM_ZEROSIM_TIMELINE: {
+		struct kvm_zerosim_timeline tl;
+
+		r = -EFAULT;
+		if (copy_from_user(&tl, argp, sizeof(tl)))
+			goto out;
+		r = kvm_zerosim_timeline_ioctl(kvm, &tl);
+		if (r)
+			goto out;
+		r = -EFAULT;
+		if (copy_to_user(argp, &tl, sizeof(tl)))
+			goto out;
+		r = 0;
+		break;
+	}
+#endif
 	default:
 		r = kvm_vm_ioctl_assigned_device(kvm, ioctl, arg);
 	}
@@ -5869,6 +6061,7 @@ out:
 
 void kvm_arch_exit(void)
 {
+	zerosim_skew_exit();
 	perf_unregister_guest_info_callbacks(&kvm_guest_cbs);
 
 	if (!boot_cpu_has(X86_FEATURE_CONSTANT_TSC))
@@ -6148,6 +6341,8 @@ static int inject_pending_event(struct kvm_vcpu *vcpu, bool req_int_win)
 			kvm_queue_interrupt(vcpu, kvm_cpu_get_interrupt(vcpu),
 					    false);
 			kvm_x86_ops->set_irq(vcpu);
+			kvm_zerosim_timeline_irq(vcpu,
+						 vcpu->arch.interrupt.nr);
 		}
 	}
 	return 0;
@@ -6551,6 +6746,11 @@ static int vcpu_enter_guest(struct kvm_vcpu *vcpu)
 		}
 	}
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	if (vcpu->arch.zt.dirty)
+		kvm_zerosim_time_publish(vcpu);
+#endif
+
 	/*
 	 * KVM_REQ_EVENT is not set when posted interrupts are set by
 	 * VT-d hardware, so we have to update RVI unconditionally.
@@ -6718,7 +6918,13 @@ static inline int vcpu_block(struct kvm *kvm, struct kvm_vcpu *vcpu)
 	if (!kvm_arch_vcpu_runnable(vcpu) &&
 	    (!kvm_x86_ops->pre_block || kvm_x86_ops->pre_block(vcpu) == 0)) {
 		srcu_read_unlock(&kvm->srcu, vcpu->srcu_idx);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+		kvm_lapic_switch_to_sw_timer(vcpu);
+		kvm_vcpu_block(vcpu);
+		kvm_lapic_switch_to_hv_timer(vcpu);
+#else
 		kvm_vcpu_block(vcpu);
+#endif
 		vcpu->srcu_idx = srcu_read_lock(&kvm->srcu);
 
 		if (kvm_x86_ops->post_block)
@@ -6754,6 +6960,324 @@ static inline bool kvm_vcpu_running(struct kvm_vcpu *vcpu)
 
 #ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
 
+/*
+ * Adaptive multicore sync. Instead of a single drift threshold for every pair
+ * of vcpus, each pair gets zerosim_d doubled for every zerosim_adaptive_window
+ * guest cycles since the two last communicated, up to zerosim_adaptive_max_d.
+ * Pairs that never communicated get zerosim_adaptive_max_d right away.
+ *
+ * Communication is an IPI from one to the other, or EPT faults by both on the
+ * same guest page with at least one of them a write. The latter is tracked in
+ * a small per-VM table of the last vcpu to fault on each (hashed) gfn.
+ */
+#define ZEROSIM_GFN_OWNER_BITS 12
+
+// Packing of the gfn owner table entries.
+#define ZEROSIM_OWNER_VCPU_MASK 0x7fffULL
+#define ZEROSIM_OWNER_WRITE     0x8000ULL
+#define ZEROSIM_OWNER_GFN_SHIFT 16
+
+static void kvm_zerosim_note_comm(struct kvm_vcpu *vcpu, struct kvm_vcpu *peer)
+{
+    u64 now;
+
+    if (vcpu == peer)
+        return;
+
+    now = kvm_read_l1_tsc(vcpu, rdtsc());
+    WRITE_ONCE(vcpu->arch.zerosim_peer_comm[peer->vcpu_id], now);
+    WRITE_ONCE(peer->arch.zerosim_peer_comm[vcpu->vcpu_id], now);
+}
+
+void kvm_zerosim_note_ipi(struct kvm_lapic *src, struct kvm_lapic_irq *irq)
+{
+    struct kvm_vcpu *vcpu;
+    int i;
+
+    if (!zerosim_adaptive_sync)
+        return;
+
+    kvm_for_each_vcpu(i, vcpu, src->vcpu->kvm)
+        if (kvm_apic_match_dest(vcpu, src, irq->shorthand, irq->dest_id,
+                                irq->dest_mode))
+            kvm_zerosim_note_comm(src->vcpu, vcpu);
+}
+
+void kvm_zerosim_note_fault(struct kvm_vcpu *vcpu, gfn_t gfn, bool write)
+{
+    u64 *owners = lockless_dereference(vcpu->kvm->arch.zerosim_gfn_owner);
+    u64 old, new;
+    struct kvm_vcpu *peer;
+    int i;
+
+    if (!zerosim_adaptive_sync || !owners)
+        return;
+
+    i = hash_64(gfn, ZEROSIM_GFN_OWNER_BITS);
+    new = (gfn << ZEROSIM_OWNER_GFN_SHIFT) | vcpu->vcpu_id |
+          (write ? ZEROSIM_OWNER_WRITE : 0);
+    old = xchg(&owners[i], new);
+
+    if ((old >> ZEROSIM_OWNER_GFN_SHIFT) != gfn ||
+        (old & ZEROSIM_OWNER_VCPU_MASK) == vcpu->vcpu_id)
+        return;
+    if (!write && !(old & ZEROSIM_OWNER_WRITE))
+        return;
+
+    peer = kvm_get_vcpu_by_id(vcpu->kvm, old & ZEROSIM_OWNER_VCPU_MASK);
+    if (peer)
+        kvm_zerosim_note_comm(vcpu, peer);
+}
+
+/*
+ * The drift allowed between @vcpu and @peer when @vcpu's guest TSC is
+ * @local_tsc.
+ */
+static unsigned long long zerosim_pair_drift(struct kvm_vcpu *vcpu,
+        struct kvm_vcpu *peer, unsigned long long local_tsc)
+{
+    u64 last = READ_ONCE(vcpu->arch.zerosim_peer_comm[peer->vcpu_id]);
+    unsigned long long bound = zerosim_d;
+    u64 windows;
+
+    if (!last)
+        return zerosim_adaptive_max_d;
+    if (local_tsc <= last || !zerosim_adaptive_window)
+        return zerosim_d;
+
+    windows = div64_u64(local_tsc - last, zerosim_adaptive_window);
+    while (windows-- && bound && bound < zerosim_adaptive_max_d)
+        bound <<= 1;
+
+    return min(bound, (unsigned long long)zerosim_adaptive_max_d);
+}
+
+/* The pid of the VMM process running @kvm, as seen through its first vcpu. */
+static pid_t zerosim_vm_pid(struct kvm *kvm)
+{
+    struct kvm_vcpu *vcpu = kvm_get_vcpu(kvm, 0);
+    struct task_struct *task;
+    pid_t pid = 0;
+
+    if (!vcpu)
+        return 0;
+
+    rcu_read_lock();
+    task = pid_task(vcpu->pid, PIDTYPE_PID);
+    if (task)
+        pid = task_tgid_nr(task);
+    rcu_read_unlock();
+
+    return pid;
+}
+
+/* Lists "pid vcpu peer bound" for every pair of vcpus of every VM. */
+static int zerosim_drift_bounds_show(struct seq_file *m, void *v)
+{
+    struct kvm_vcpu *vcpu, *peer;
+    unsigned long long local_tsc;
+    struct kvm *kvm;
+    pid_t pid;
+    int i, j;
+
+    spin_lock(&kvm_lock);
+    list_for_each_entry(kvm, &vm_list, vm_list) {
+        pid = zerosim_vm_pid(kvm);
+
+        kvm_for_each_vcpu(i, vcpu, kvm) {
+            local_tsc = kvm_scale_tsc(vcpu, rdtsc()) +
+                        READ_ONCE(vcpu->tsc_offset);
+            kvm_for_each_vcpu(j, peer, kvm)
+                if (j > i)
+                    seq_printf(m, "%d %d %d %llu\n", pid, vcpu->vcpu_id,
+                               peer->vcpu_id,
+                               zerosim_pair_drift(vcpu, peer, local_tsc));
+        }
+    }
+    spin_unlock(&kvm_lock);
+
+    return 0;
+}
+
+static int zerosim_drift_bounds_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, zerosim_drift_bounds_show, NULL);
+}
+
+static const struct file_operations zerosim_drift_bounds_ops = {
+    .open       = zerosim_drift_bounds_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/*
+ * Missing time accounting. Between an exit and the next entry, the host time
+ * spent in interrupt handlers and softirqs on the vcpu's cpu, and the time the
+ * vcpu thread was scheduled out, are accounted separately from the rest (KVM
+ * itself). Only the categories in zerosim_hidden_missing are hidden from the
+ * guest; the others show up as guest time.
+ *
+ * Interrupt time is only counted while the interrupt hooks are patched in,
+ * which costs every interrupt on the host. We hold a reference on them only
+ * while something consumes it: some category is shown to the guest (so the
+ * categories must be told apart), zerosim_missing_breakdown is set, or
+ * /proc/zerosim_missing is open. Otherwise it all counts as KVM time.
+ */
+static DEFINE_MUTEX(zerosim_missing_acct_mutex);
+static int zerosim_missing_readers;
+
+static void zerosim_missing_acct_sync(void)
+{
+    static bool acct_on;
+    bool on;
+
+    mutex_lock(&zerosim_missing_acct_mutex);
+    on = (zerosim_hidden_missing & ZEROSIM_MISSING_ALL) != ZEROSIM_MISSING_ALL
+        || zerosim_missing_breakdown || zerosim_missing_readers;
+    if (on != acct_on) {
+        acct_on = on;
+        if (on)
+            zerosim_irq_acct_get();
+        else
+            zerosim_irq_acct_put();
+    }
+    mutex_unlock(&zerosim_missing_acct_mutex);
+}
+
+static void zerosim_missing_fold_irq(struct kvm_vcpu *vcpu)
+{
+    u64 hardirq, softirq;
+
+    zerosim_irq_time(&hardirq, &softirq);
+    vcpu->arch.missing.gap[ZEROSIM_MISSING_HARDIRQ] +=
+        hardirq - vcpu->arch.missing.hardirq_snap;
+    vcpu->arch.missing.gap[ZEROSIM_MISSING_SOFTIRQ] +=
+        softirq - vcpu->arch.missing.softirq_snap;
+    vcpu->arch.missing.hardirq_snap = hardirq;
+    vcpu->arch.missing.softirq_snap = softirq;
+}
+
+/* Called by the vendor module right after stamping start_missing. */
+void kvm_zerosim_missing_begin(struct kvm_vcpu *vcpu)
+{
+    memset(vcpu->arch.missing.gap, 0, sizeof(vcpu->arch.missing.gap));
+    zerosim_irq_time(&vcpu->arch.missing.hardirq_snap,
+                     &vcpu->arch.missing.softirq_snap);
+}
+EXPORT_SYMBOL_GPL(kvm_zerosim_missing_begin);
+
+static void zerosim_missing_put(struct kvm_vcpu *vcpu)
+{
+    if (!vcpu->start_missing)
+        return;
+
+    zerosim_missing_fold_irq(vcpu);
+    vcpu->arch.missing.sched_out = rdtsc();
+    vcpu->arch.missing.sched_out_kind = vcpu->preempted ?
+        ZEROSIM_MISSING_PREEMPT : ZEROSIM_MISSING_SLEEP;
+}
+
+static void zerosim_missing_load(struct kvm_vcpu *vcpu)
+{
+    if (!vcpu->start_missing || !vcpu->arch.missing.sched_out)
+        return;
+
+    vcpu->arch.missing.gap[vcpu->arch.missing.sched_out_kind] +=
+        rdtsc() - vcpu->arch.missing.sched_out;
+    vcpu->arch.missing.sched_out = 0;
+
+    // Possibly on another cpu now.
+    zerosim_irq_time(&vcpu->arch.missing.hardirq_snap,
+                     &vcpu->arch.missing.softirq_snap);
+}
+
+/*
+ * Called at entry with the host cycles elapsed since start_missing. Returns
+ * how many of them to hide from the guest.
+ */
+u64 kvm_zerosim_missing_end(struct kvm_vcpu *vcpu, u64 elapsed)
+{
+    u64 *gap = vcpu->arch.missing.gap;
+    u64 accounted = 0, hidden = 0;
+    int i;
+
+    zerosim_missing_fold_irq(vcpu);
+
+    for (i = ZEROSIM_MISSING_KVM + 1; i < ZEROSIM_MISSING_NR; i++)
+        accounted += gap[i];
+    gap[ZEROSIM_MISSING_KVM] = elapsed - min(elapsed, accounted);
+
+    for (i = 0; i < ZEROSIM_MISSING_NR; i++) {
+        vcpu->arch.missing.total[i] += gap[i];
+        if (zerosim_hidden_missing & (1UL << i))
+            hidden += gap[i];
+    }
+
+    if ((zerosim_hidden_missing & ZEROSIM_MISSING_ALL) == ZEROSIM_MISSING_ALL)
+        return elapsed;
+    return min(hidden, elapsed);
+}
+EXPORT_SYMBOL_GPL(kvm_zerosim_missing_end);
+
+/* Lists the per-category missing time totals of every vcpu of every VM. */
+static int zerosim_missing_show(struct seq_file *m, void *v)
+{
+    struct kvm_vcpu *vcpu;
+    struct kvm *kvm;
+    pid_t pid;
+    int i, j;
+
+    seq_puts(m, "# pid vcpu kvm hardirq softirq preempt sleep (cycles)\n");
+
+    spin_lock(&kvm_lock);
+    list_for_each_entry(kvm, &vm_list, vm_list) {
+        pid = zerosim_vm_pid(kvm);
+        kvm_for_each_vcpu(i, vcpu, kvm) {
+            seq_printf(m, "%d %d", pid, vcpu->vcpu_id);
+            for (j = 0; j < ZEROSIM_MISSING_NR; j++)
+                seq_printf(m, " %llu",
+                           READ_ONCE(vcpu->arch.missing.total[j]));
+            seq_putc(m, '\n');
+        }
+    }
+    spin_unlock(&kvm_lock);
+
+    return 0;
+}
+
+static int zerosim_missing_open(struct inode *inode, struct file *file)
+{
+    int ret = single_open(file, zerosim_missing_show, NULL);
+
+    if (ret)
+        return ret;
+
+    mutex_lock(&zerosim_missing_acct_mutex);
+    zerosim_missing_readers++;
+    mutex_unlock(&zerosim_missing_acct_mutex);
+    zerosim_missing_acct_sync();
+
+    return 0;
+}
+
+static int zerosim_missing_release(struct inode *inode, struct file *file)
+{
+    mutex_lock(&zerosim_missing_acct_mutex);
+    zerosim_missing_readers--;
+    mutex_unlock(&zerosim_missing_acct_mutex);
+    zerosim_missing_acct_sync();
+
+    return single_release(inode, file);
+}
+
+static const struct file_operations zerosim_missing_ops = {
+    .open       = zerosim_missing_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = zerosim_missing_release,
+};
+
 /*
  * If the vcpu's virtual time is ahead of other vcpu's virtual time (i.e. it's
  * clock is running to fast), returns the difference in clocks. Otherwise,
@@ -6768,15 +7292,20 @@ static inline unsigned long long vcpu_is_ahead(struct kvm_vcpu *vcpu)
     // compare them. This allows us to avoid complicated shenanigans to account
     // for the time spent in _this function_.
     //
-    // This depends on the assumption that the host TSC's of all cpus are roughly
-    // synchronized, which may or may not be true.
+    // The host TSCs of different cpus are not necessarily synchronized, so
+    // we correct for the skew between them measured by x86_skew.c. That
+    // gives the host TSC of the other vcpu's cpu at this instant, to within
+    // the round trip of the calibration.
 
     unsigned long long host_local_tsc;
+    unsigned long long host_other_tsc;
     unsigned long long local_tsc;
+    s64 local_skew;
     int i, nvcpus;
     struct kvm_vcpu *other_vcpu;
     unsigned long long min_tsc;
     unsigned long long other_tsc;
+    unsigned long long ahead = 0;
     int slowest_core;
 
     // If offsetting is not enabled
@@ -6791,10 +7320,12 @@ static inline unsigned long long vcpu_is_ahead(struct kvm_vcpu *vcpu)
         return 0;
     }
 
-    // TSC on this core and vcpu
+    // TSC on this core and vcpu. As for the other vcpus below, the stall
+    // is in host cycles and must be scaled to guest cycles.
     host_local_tsc = rdtsc();
+    local_skew = kvm_x86_tsc_skew(vcpu->cpu);
     local_tsc = kvm_scale_tsc(vcpu, host_local_tsc) + vcpu->tsc_offset
-        - (host_local_tsc - vcpu->start_missing);
+        - kvm_scale_tsc(vcpu, host_local_tsc - vcpu->start_missing);
 
     // The lowest tsc of any vcpu
     min_tsc = local_tsc;
@@ -6806,21 +7337,39 @@ static inline unsigned long long vcpu_is_ahead(struct kvm_vcpu *vcpu)
 	for (i = 0; i < nvcpus; i++) {
         // NOTE: don't use kvm_read_l1_tsc because it reads from the current core's VMCS.
         other_vcpu = vcpu->kvm->vcpus[i];
-        other_tsc = kvm_scale_tsc(other_vcpu, host_local_tsc) + other_vcpu->tsc_offset;
+        host_other_tsc = host_local_tsc - local_skew +
+            kvm_x86_tsc_skew(other_vcpu->cpu);
+        other_tsc = kvm_scale_tsc(other_vcpu, host_other_tsc) + other_vcpu->tsc_offset;
 
         // Need to account for the possiblity that the other vcpu is stalled.
+        // The stall is in host cycles, the TSC in (possibly dilated) guest
+        // cycles.
         if (other_vcpu->start_missing) { // start_missing == 0 when running.
-            if (host_local_tsc > other_vcpu->start_missing) {
-                other_tsc -= (host_local_tsc - other_vcpu->start_missing);
+            if (host_other_tsc > other_vcpu->start_missing) {
+                other_tsc -= kvm_scale_tsc(other_vcpu,
+                        host_other_tsc - other_vcpu->start_missing);
             }
         }
 
+        // In adaptive mode, wait for the vcpu we are furthest ahead of
+        // among those we are too far ahead of.
+        if (zerosim_adaptive_sync) {
+            if (other_vcpu != vcpu && other_tsc < local_tsc &&
+                local_tsc - other_tsc >
+                zerosim_pair_drift(vcpu, other_vcpu, local_tsc))
+                ahead = max(ahead, local_tsc - other_tsc);
+            continue;
+        }
+
         if (other_tsc < min_tsc) {
             min_tsc = other_tsc;
             slowest_core = i;
         }
     }
 
+    if (zerosim_adaptive_sync)
+        return ahead;
+
     // If the most "behind" vcpu is not that far behind, we don't care too much.
     if (min_tsc < (local_tsc - zerosim_d)) {
         //printk(KERN_WARNING
@@ -6862,6 +7411,55 @@ void kvm_sync_guest_tsc(struct kvm_vcpu *vcpu)
             vcpu->vcpu_id, new_offset);
 }
 
+/*
+ * The simulated clock of the VM, in guest nanoseconds, as seen from @vcpu
+ * while it is out of the guest (e.g. halted).  That is the clock of the
+ * most advanced vcpu that is running, whose TSC already has every stall
+ * hidden from the guest taken out; if none is, it is the vcpu's own TSC
+ * through its current offset, which is what its LAPIC timer is measured
+ * against.
+ *
+ * Finding that vcpu means walking all of them, so it is only done when
+ * @rescan is set, once per halt; otherwise the clock of the vcpu found
+ * last time is extrapolated from the local TSC, which keeps the halt-poll
+ * loop's cost independent of the size of the VM.
+ */
+u64 kvm_arch_vcpu_guest_ns(struct kvm_vcpu *vcpu, bool rescan)
+{
+    struct kvm_vcpu *leader = vcpu->arch.halt_clock_leader;
+    u64 host_tsc = rdtsc();
+    u64 guest_tsc = 0, tsc;
+    struct kvm_vcpu *other;
+    u32 mult;
+    s8 shift;
+    int i;
+
+    if (rescan || !leader) {
+        leader = vcpu;
+        kvm_for_each_vcpu(i, other, vcpu->kvm) {
+            if (other == vcpu || READ_ONCE(other->start_missing))
+                continue;
+            tsc = kvm_scale_tsc(other, host_tsc) +
+                  READ_ONCE(other->tsc_offset);
+            if (tsc > guest_tsc) {
+                guest_tsc = tsc;
+                leader = other;
+            }
+        }
+        vcpu->arch.halt_clock_leader = leader;
+    }
+
+    guest_tsc = kvm_scale_tsc(leader, host_tsc) +
+                READ_ONCE(leader->tsc_offset);
+
+    if (unlikely(!vcpu->arch.virtual_tsc_khz))
+        return ktime_get_ns();
+
+    kvm_get_time_scale(NSEC_PER_SEC / 1000, vcpu->arch.virtual_tsc_khz,
+                       &shift, &mult);
+    return pvclock_scale_delta(guest_tsc, mult, shift);
+}
+
 #endif
 
 static int vcpu_run(struct kvm_vcpu *vcpu)
@@ -7534,11 +8132,39 @@ int kvm_arch_vcpu_setup(struct kvm_vcpu *vcpu)
 	return r;
 }
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+/*
+ * Set up the VM's 0sim state along with its first vcpu rather than in
+ * kvm_arch_init_vm(), which kvm_create_vm() does not undo when it fails
+ * later on: once a vcpu exists, kvm_arch_destroy_vm() is sure to run.
+ */
+static void kvm_zerosim_vm_start(struct kvm *kvm)
+{
+	u64 *owners;
+
+	mutex_lock(&kvm->lock);
+	if (!kvm->arch.zerosim_started) {
+		kvm->arch.zerosim_started = true;
+		/* only a heuristic, so carry on without it */
+		owners = vzalloc(sizeof(u64) << ZEROSIM_GFN_OWNER_BITS);
+		smp_store_release(&kvm->arch.zerosim_gfn_owner, owners);
+		zerosim_skew_vm_get();
+	}
+	mutex_unlock(&kvm->lock);
+}
+#else
+static inline void kvm_zerosim_vm_start(struct kvm *kvm)
+{
+}
+#endif
+
 void kvm_arch_vcpu_postcreate(struct kvm_vcpu *vcpu)
 {
 	struct msr_data msr;
 	struct kvm *kvm = vcpu->kvm;
 
+	kvm_zerosim_vm_start(kvm);
+
 	if (vcpu_load(vcpu))
 		return;
 	msr.data = 0x0;
@@ -7589,6 +8215,10 @@ void kvm_vcpu_reset(struct kvm_vcpu *vcpu, bool init_event)
 	kvm_make_request(KVM_REQ_EVENT, vcpu);
 	vcpu->arch.apf.msr_val = 0;
 	vcpu->arch.st.msr_val = 0;
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	vcpu->arch.zt.msr_val = 0;
+	vcpu->arch.zt.dirty = false;
+#endif
 
 	kvmclock_reset(vcpu);
 
@@ -7814,10 +8444,19 @@ int kvm_arch_vcpu_init(struct kvm_vcpu *vcpu)
 	}
 	vcpu->arch.mcg_cap = KVM_MAX_MCE_BANKS;
 
-	if (!zalloc_cpumask_var(&vcpu->arch.wbinvd_dirty_mask, GFP_KERNEL)) {
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	vcpu->arch.zerosim_peer_comm = kcalloc(KVM_MAX_VCPUS, sizeof(u64),
+					       GFP_KERNEL);
+	if (!vcpu->arch.zerosim_peer_comm) {
 		r = -ENOMEM;
 		goto fail_free_mce_banks;
 	}
+#endif
+
+	if (!zalloc_cpumask_var(&vcpu->arch.wbinvd_dirty_mask, GFP_KERNEL)) {
+		r = -ENOMEM;
+		goto fail_free_peer_comm;
+	}
 
 	fx_init(vcpu);
 
@@ -7838,6 +8477,10 @@ int kvm_arch_vcpu_init(struct kvm_vcpu *vcpu)
 
 	return 0;
 
+fail_free_peer_comm:
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	kfree(vcpu->arch.zerosim_peer_comm);
+#endif
 fail_free_mce_banks:
 	kfree(vcpu->arch.mce_banks);
 fail_free_lapic:
@@ -7856,6 +8499,9 @@ void kvm_arch_vcpu_uninit(struct kvm_vcpu *vcpu)
 
 	kvm_pmu_destroy(vcpu);
 	kfree(vcpu->arch.mce_banks);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	kfree(vcpu->arch.zerosim_peer_comm);
+#endif
 	kvm_free_lapic(vcpu);
 	idx = srcu_read_lock(&vcpu->kvm->srcu);
 	kvm_mmu_destroy(vcpu);
@@ -7896,6 +8542,10 @@ int kvm_arch_init_vm(struct kvm *kvm, unsigned long type)
 	INIT_DELAYED_WORK(&kvm->arch.kvmclock_update_work, kvmclock_update_fn);
 	INIT_DELAYED_WORK(&kvm->arch.kvmclock_sync_work, kvmclock_sync_fn);
 
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	kvm->arch.zerosim_dilation = KVM_ZEROSIM_DILATION_ONE;
+#endif
+
 	return 0;
 }
 
@@ -8022,6 +8672,13 @@ void kvm_arch_destroy_vm(struct kvm *kvm)
 	kfree(kvm->arch.vioapic);
 	kvm_free_vcpus(kvm);
 	kfree(rcu_dereference_check(kvm->arch.apic_map, 1));
+	kvm_zerosim_timeline_destroy(kvm);
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+	if (kvm->arch.zerosim_started) {
+		vfree(kvm->arch.zerosim_gfn_owner);
+		zerosim_skew_vm_put();
+	}
+#endif
 }
 
 void kvm_arch_free_memslot(struct kvm *kvm, struct kvm_memory_slot *free,
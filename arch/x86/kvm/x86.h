@@ -192,4 +192,17 @@ extern unsigned int min_timer_period_us;
 extern unsigned int lapic_timer_advance_ns;
 
 extern struct static_key kvm_no_apic_vcpu;
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+void kvm_zerosim_time_update(struct kvm_vcpu *vcpu, u64 elapsed,
+			     u64 compensated);
+
+struct kvm_lapic;
+struct kvm_lapic_irq;
+void kvm_zerosim_note_ipi(struct kvm_lapic *src, struct kvm_lapic_irq *irq);
+void kvm_zerosim_note_fault(struct kvm_vcpu *vcpu, gfn_t gfn, bool write);
+
+void kvm_zerosim_missing_begin(struct kvm_vcpu *vcpu);
+u64 kvm_zerosim_missing_end(struct kvm_vcpu *vcpu, u64 elapsed);
+#endif
 #endif
@@ -0,0 +1,331 @@
+/*
+ * Host TSC skew calibration for multicore sync.
+ *
+ * vcpu_is_ahead compares the guest TSCs of vcpus running on different host
+ * cpus by reading the local TSC and assuming every other cpu's TSC reads the
+ * same at that instant. That is not true on all hosts (multi-socket ones in
+ * particular), so we periodically measure how far each online cpu's TSC is
+ * from a reference cpu's and correct for it. Only cpus that vcpus run on are
+ * measured, and only while multicore sync is on and some VM exists.
+ *
+ * The measurement is a ping-pong over shared cache lines: the reference cpu
+ * stamps its TSC, pings the target, and stamps again when the pong comes
+ * back; the target stamps its TSC when it sees the ping. Assuming the two
+ * legs take the same time, the target's stamp corresponds to the middle of
+ * the round trip. The sample with the shortest round trip wins, and its
+ * round trip bounds the error of the estimate.
+ */
+
+#include "x86_skew.h"
+
+#include <linux/cpumask.h>
+#include <linux/kvm_host.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/smp.h>
+#include <linux/workqueue.h>
+#include <linux/zerosim-params.h>
+
+#include <asm/msr.h>
+#include <asm/tsc.h>
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+
+// Round trips measured per cpu.
+#define SKEW_SAMPLES 64
+
+// Give up on a cpu after spinning this long on one step, in microseconds.
+// Both sides spin with interrupts disabled.
+#define SKEW_SPIN_LIMIT_US 1000
+
+// Seconds between checks of zerosim_tsc_skew_period while it is 0.
+#define SKEW_POLL_PERIOD 10
+
+// Seconds between recalibrations; 0 to only calibrate at load time.
+ZEROSIM_PROC_CREATE(unsigned long, zerosim_tsc_skew_period, 60, "%lu");
+
+// At any instant, rdtsc() on a cpu reads tsc_skew more than on skew_ref_cpu.
+static DEFINE_PER_CPU(s64, tsc_skew);
+// Round trip of the sample tsc_skew comes from, or 0 if never measured.
+static DEFINE_PER_CPU(u64, tsc_skew_rtt);
+
+static int skew_ref_cpu;
+
+// Protects the fields below and the arming of skew_work.
+static DEFINE_MUTEX(skew_lock);
+static int skew_nr_vms;
+static bool skew_sync;
+static bool skew_armed;
+
+// The cpus to measure, only used by the calibration work.
+static struct cpumask skew_cpus;
+
+/*
+ * The lines bounced between the two cpus. There is only ever one
+ * calibration running, serialized by the workqueue.
+ */
+static struct {
+    // Written by the reference cpu: number of the current ping.
+    u64 ping ____cacheline_aligned_in_smp;
+    // Set by the reference cpu when it gives up, so the target stops too.
+    int abort;
+    // Written by the target cpu: number of the last pong and its TSC.
+    u64 pong ____cacheline_aligned_in_smp;
+    u64 pong_tsc;
+    // Set by the target when it is done with this structure.
+    int done;
+} skew_pp;
+
+static u64 skew_limit_cycles(unsigned int us)
+{
+    return max_t(u64, (u64)us * tsc_khz / 1000, 1);
+}
+
+// Spins until *word is val. Fails on timeout or when the reference aborts.
+static bool skew_spin_until(u64 *word, u64 val)
+{
+    u64 start = rdtsc(), limit = skew_limit_cycles(SKEW_SPIN_LIMIT_US);
+
+    while (READ_ONCE(*word) != val) {
+        if (READ_ONCE(skew_pp.abort) || rdtsc() - start > limit)
+            return false;
+        cpu_relax();
+    }
+
+    return true;
+}
+
+/* Runs on the target cpu, in IPI context. */
+static void skew_respond(void *unused)
+{
+    u64 i, tsc;
+
+    for (i = 1; i <= SKEW_SAMPLES; i++) {
+        if (!skew_spin_until(&skew_pp.ping, i))
+            break;
+        tsc = rdtsc_ordered();
+        skew_pp.pong_tsc = tsc;
+        smp_wmb();
+        WRITE_ONCE(skew_pp.pong, i);
+    }
+
+    smp_wmb();
+    WRITE_ONCE(skew_pp.done, 1);
+}
+
+/* Runs on the reference cpu. Returns false if @cpu did not answer. */
+static bool skew_measure(int cpu)
+{
+    u64 i, t0, t1, rtt, best_rtt = ~0ULL;
+    u64 start, limit;
+    s64 skew = 0;
+    unsigned long flags;
+
+    skew_pp.ping = 0;
+    skew_pp.pong = 0;
+    skew_pp.abort = 0;
+    skew_pp.done = 0;
+    smp_wmb();
+
+    if (smp_call_function_single(cpu, skew_respond, NULL, 0))
+        return false;
+
+    local_irq_save(flags);
+    for (i = 1; i <= SKEW_SAMPLES; i++) {
+        t0 = rdtsc_ordered();
+        WRITE_ONCE(skew_pp.ping, i);
+        if (!skew_spin_until(&skew_pp.pong, i))
+            break;
+        t1 = rdtsc_ordered();
+        smp_rmb();
+
+        rtt = t1 - t0;
+        if (rtt < best_rtt) {
+            best_rtt = rtt;
+            skew = (s64)(skew_pp.pong_tsc - (t0 + rtt / 2));
+        }
+    }
+    local_irq_restore(flags);
+
+    // Tell the responder to stop waiting for pings that won't come.
+    if (i <= SKEW_SAMPLES)
+        WRITE_ONCE(skew_pp.abort, 1);
+
+    // Don't touch skew_pp again until the responder has let go of it. It
+    // may not have entered the IPI yet, so allow for more than one step.
+    start = rdtsc();
+    limit = skew_limit_cycles(10 * SKEW_SPIN_LIMIT_US);
+    while (!READ_ONCE(skew_pp.done)) {
+        if (rdtsc() - start > limit) {
+            WARN_ONCE(1, "zerosim: cpu %d stuck in TSC skew calibration\n",
+                      cpu);
+            return false;
+        }
+        cpu_relax();
+    }
+
+    if (i <= SKEW_SAMPLES)
+        return false;
+
+    per_cpu(tsc_skew, cpu) = skew;
+    per_cpu(tsc_skew_rtt, cpu) = best_rtt;
+    return true;
+}
+
+static void skew_calibrate(struct work_struct *work);
+static DECLARE_DELAYED_WORK(skew_work, skew_calibrate);
+
+/* The cpus the vcpus of all VMs last ran on. */
+static void skew_vcpu_cpus(struct cpumask *mask)
+{
+    struct kvm_vcpu *vcpu;
+    struct kvm *kvm;
+    int i, cpu;
+
+    cpumask_clear(mask);
+
+    spin_lock(&kvm_lock);
+    list_for_each_entry(kvm, &vm_list, vm_list) {
+        kvm_for_each_vcpu(i, vcpu, kvm) {
+            cpu = READ_ONCE(vcpu->cpu);
+            if (cpu >= 0 && cpu < nr_cpu_ids)
+                cpumask_set_cpu(cpu, mask);
+        }
+    }
+    spin_unlock(&kvm_lock);
+}
+
+static void skew_calibrate(struct work_struct *work)
+{
+    unsigned long period = READ_ONCE(zerosim_tsc_skew_period);
+    int cpu;
+
+    skew_vcpu_cpus(&skew_cpus);
+
+    // The work is queued on the reference cpu, which is also where the
+    // measurements must run from.
+    get_online_cpus();
+    preempt_disable();
+    for_each_cpu_and(cpu, &skew_cpus, cpu_online_mask) {
+        if (cpu == skew_ref_cpu)
+            continue;
+        if (!skew_measure(cpu)) {
+            printk(KERN_WARNING "zerosim: TSC skew calibration of cpu %d failed\n",
+                   cpu);
+            break;
+        }
+    }
+    preempt_enable();
+    put_online_cpus();
+
+    // A racing skew_update() that disarms cancels us synchronously, which
+    // also takes care of this requeue.
+    if (READ_ONCE(skew_armed))
+        schedule_delayed_work_on(skew_ref_cpu, &skew_work,
+                                 (period ? period : SKEW_POLL_PERIOD) * HZ);
+}
+
+/*
+ * Arm the calibration while it is of any use, i.e. while multicore sync is
+ * on and there is a VM. Called with skew_lock held.
+ */
+static void skew_update(void)
+{
+    bool want = skew_sync && skew_nr_vms;
+
+    if (want == skew_armed)
+        return;
+
+    WRITE_ONCE(skew_armed, want);
+    if (want)
+        schedule_delayed_work_on(skew_ref_cpu, &skew_work, 0);
+    else
+        cancel_delayed_work_sync(&skew_work);
+}
+
+void zerosim_skew_vm_get(void)
+{
+    mutex_lock(&skew_lock);
+    skew_nr_vms++;
+    skew_update();
+    mutex_unlock(&skew_lock);
+}
+
+void zerosim_skew_vm_put(void)
+{
+    mutex_lock(&skew_lock);
+    skew_nr_vms--;
+    skew_update();
+    mutex_unlock(&skew_lock);
+}
+
+void zerosim_skew_set_sync(bool enabled)
+{
+    mutex_lock(&skew_lock);
+    skew_sync = enabled;
+    skew_update();
+    mutex_unlock(&skew_lock);
+}
+
+s64 kvm_x86_tsc_skew(int cpu)
+{
+    if (cpu < 0 || cpu >= nr_cpu_ids)
+        return 0;
+    return READ_ONCE(per_cpu(tsc_skew, cpu));
+}
+
+static int zerosim_tsc_skew_show(struct seq_file *m, void *v)
+{
+    int cpu;
+
+    seq_printf(m, "# cpu skew rtt (cycles, relative to cpu %d)\n",
+               skew_ref_cpu);
+    for_each_online_cpu(cpu)
+        seq_printf(m, "%d %lld %llu\n", cpu, per_cpu(tsc_skew, cpu),
+                   per_cpu(tsc_skew_rtt, cpu));
+
+    return 0;
+}
+
+static int zerosim_tsc_skew_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, zerosim_tsc_skew_show, NULL);
+}
+
+static const struct file_operations zerosim_tsc_skew_ops = {
+    .open       = zerosim_tsc_skew_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+static struct proc_dir_entry *zerosim_tsc_skew_ent;
+
+int zerosim_skew_init(void)
+{
+    zerosim_tsc_skew_period_ent =
+        proc_create("zerosim_tsc_skew_period", 0444, NULL,
+                    &zerosim_tsc_skew_period_ops);
+    zerosim_tsc_skew_ent =
+        proc_create("zerosim_tsc_skew", 0444, NULL, &zerosim_tsc_skew_ops);
+
+    // The boot cpu can't go offline on x86, so it makes a good reference.
+    // The calibration is armed by zerosim_skew_vm_get/set_sync.
+    skew_ref_cpu = cpumask_first(cpu_online_mask);
+
+    return 0;
+}
+
+void zerosim_skew_exit(void)
+{
+    mutex_lock(&skew_lock);
+    skew_armed = false;
+    mutex_unlock(&skew_lock);
+    cancel_delayed_work_sync(&skew_work);
+    proc_remove(zerosim_tsc_skew_ent);
+    proc_remove(zerosim_tsc_skew_period_ent);
+}
+
+#endif
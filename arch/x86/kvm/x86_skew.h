@@ -0,0 +1,36 @@
+#ifndef __X86_SKEW_H__
+#define __X86_SKEW_H__
+
+#include <linux/types.h>
+
+/*
+ * Calibration of the skew between the TSCs of the host cpus, so that TSC
+ * values read on different cpus can be compared. See x86_skew.c.
+ */
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+
+int zerosim_skew_init(void);
+void zerosim_skew_exit(void);
+
+/*
+ * The calibration only runs while multicore sync is enabled and at least
+ * one VM exists, on the cpus the vcpus run on.
+ */
+void zerosim_skew_vm_get(void);
+void zerosim_skew_vm_put(void);
+void zerosim_skew_set_sync(bool enabled);
+
+/*
+ * How far ahead @cpu's TSC is of the reference cpu's, in cycles, as of the
+ * last calibration. 0 before the first calibration or for a bogus @cpu.
+ */
+s64 kvm_x86_tsc_skew(int cpu);
+
+#else
+
+static inline void zerosim_skew_exit(void) {}
+
+#endif
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ * Record/replay of the guest-visible timeline of a 0sim VM.
+ *
+ * How much time is hidden from a vcpu at each entry depends on real host
+ * timing, so two runs of the same workload see different guest timelines.
+ * While recording, every adjustment of the TSC offset and every injected
+ * interrupt is appended to a per-VM log. While replaying, the logged
+ * adjustments are applied in order instead of the measured ones, so the
+ * guest sees the recorded timeline again; injections are compared against
+ * the log and any mismatch is counted as a divergence.
+ *
+ * The log is a flat array of 16-byte records shared by all vcpus. When a
+ * log is loaded for replay, the records of each vcpu and type are chained
+ * together, so that replay finds a vcpu's next record in constant time on
+ * the entry path however sparse that vcpu's records are. Replay keeps a
+ * cursor per vcpu and per record type that only ever moves forward along
+ * its chain.
+ */
+
+#include "x86_timeline.h"
+
+#include <linux/kvm_host.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+
+// Upper bound on the log length, in records (256MB).
+#define ZEROSIM_TIMELINE_MAX_RECS (1ULL << 24)
+
+struct zerosim_timeline {
+    // KVM_ZEROSIM_TIMELINE_{STOP,RECORD,REPLAY}
+    int mode;
+
+    struct kvm_zerosim_timeline_rec *log;
+    // RECORD: capacity of the log; REPLAY: number of valid records.
+    u64 nr;
+    // REPLAY: index of the next record of the same vcpu and type, or nr.
+    u32 *chain;
+
+    // RECORD: next free slot. May run past nr, in which case the records
+    // are dropped.
+    atomic64_t next;
+    // REPLAY: injections that did not match the log.
+    atomic64_t diverged;
+
+    struct {
+        // Number of entries of this vcpu so far.
+        u32 seq;
+        // REPLAY: position of the next record of each type, or nr.
+        u64 adjust_pos;
+        u64 irq_pos;
+    } cursor[KVM_MAX_VCPUS];
+};
+
+static struct zerosim_timeline *timeline_alloc(int mode, u64 nr)
+{
+    struct zerosim_timeline *tl;
+
+    tl = vzalloc(sizeof(*tl));
+    if (!tl)
+        return NULL;
+
+    tl->log = vmalloc(nr * sizeof(*tl->log));
+    if (!tl->log) {
+        vfree(tl);
+        return NULL;
+    }
+
+    tl->mode = mode;
+    tl->nr = nr;
+    return tl;
+}
+
+static void timeline_free(struct zerosim_timeline *tl)
+{
+    if (tl) {
+        vfree(tl->chain);
+        vfree(tl->log);
+        vfree(tl);
+    }
+}
+
+static u64 timeline_logged(struct zerosim_timeline *tl)
+{
+    if (tl->mode == KVM_ZEROSIM_TIMELINE_REPLAY)
+        return tl->nr;
+    return min_t(u64, atomic64_read(&tl->next), tl->nr);
+}
+
+/*
+ * Make the hooks stop using the current log. They only look at it with
+ * preemption disabled, so once synchronize_sched() returns nobody is
+ * looking at it anymore.
+ */
+static void timeline_stop(struct kvm *kvm)
+{
+    struct zerosim_timeline *tl =
+        rcu_dereference_protected(kvm->arch.zerosim_timeline,
+                                  lockdep_is_held(&kvm->lock));
+
+    if (!tl || tl->mode == KVM_ZEROSIM_TIMELINE_STOP)
+        return;
+
+    // Keep the log around so that it can still be read out.
+    RCU_INIT_POINTER(kvm->arch.zerosim_timeline, NULL);
+    synchronize_sched();
+    tl->mode = KVM_ZEROSIM_TIMELINE_STOP;
+    rcu_assign_pointer(kvm->arch.zerosim_timeline, tl);
+}
+
+static void timeline_replace(struct kvm *kvm, struct zerosim_timeline *new)
+{
+    struct zerosim_timeline *old =
+        rcu_dereference_protected(kvm->arch.zerosim_timeline,
+                                  lockdep_is_held(&kvm->lock));
+
+    rcu_assign_pointer(kvm->arch.zerosim_timeline, new);
+    synchronize_sched();
+    timeline_free(old);
+}
+
+static int timeline_load(struct zerosim_timeline *tl, void __user *addr)
+{
+    struct kvm_zerosim_timeline_rec *rec;
+    u64 *head;
+    u64 i;
+    int v;
+
+    BUILD_BUG_ON(ZEROSIM_TIMELINE_MAX_RECS > U32_MAX);
+
+    if (copy_from_user(tl->log, addr, tl->nr * sizeof(*tl->log)))
+        return -EFAULT;
+
+    for (i = 0; i < tl->nr; i++) {
+        rec = &tl->log[i];
+        if (rec->vcpu_id >= KVM_MAX_VCPUS)
+            return -EINVAL;
+        if (rec->type != KVM_ZEROSIM_TL_ADJUST &&
+            rec->type != KVM_ZEROSIM_TL_IRQ)
+            return -EINVAL;
+    }
+
+    tl->chain = vmalloc(tl->nr * sizeof(*tl->chain));
+    if (!tl->chain)
+        return -ENOMEM;
+
+    // Chain the records back to front; the cursors end up at the heads.
+    for (v = 0; v < KVM_MAX_VCPUS; v++) {
+        tl->cursor[v].adjust_pos = tl->nr;
+        tl->cursor[v].irq_pos = tl->nr;
+    }
+    for (i = tl->nr; i-- > 0; ) {
+        rec = &tl->log[i];
+        head = rec->type == KVM_ZEROSIM_TL_ADJUST ?
+               &tl->cursor[rec->vcpu_id].adjust_pos :
+               &tl->cursor[rec->vcpu_id].irq_pos;
+        tl->chain[i] = *head;
+        *head = i;
+    }
+
+    return 0;
+}
+
+int kvm_zerosim_timeline_ioctl(struct kvm *kvm,
+        struct kvm_zerosim_timeline *arg)
+{
+    struct zerosim_timeline *tl;
+    u64 n;
+    int r = 0;
+
+    if (arg->flags)
+        return -EINVAL;
+
+    mutex_lock(&kvm->lock);
+
+    switch (arg->op) {
+    case KVM_ZEROSIM_TIMELINE_RECORD:
+    case KVM_ZEROSIM_TIMELINE_REPLAY:
+        r = -EINVAL;
+        if (!arg->nr || arg->nr > ZEROSIM_TIMELINE_MAX_RECS)
+            break;
+
+        r = -ENOMEM;
+        tl = timeline_alloc(arg->op, arg->nr);
+        if (!tl)
+            break;
+
+        if (arg->op == KVM_ZEROSIM_TIMELINE_REPLAY) {
+            r = timeline_load(tl, (void __user *)(unsigned long)arg->addr);
+            if (r) {
+                timeline_free(tl);
+                break;
+            }
+        }
+
+        timeline_replace(kvm, tl);
+        r = 0;
+        break;
+
+    case KVM_ZEROSIM_TIMELINE_STOP:
+    case KVM_ZEROSIM_TIMELINE_GET:
+        timeline_stop(kvm);
+
+        tl = rcu_dereference_protected(kvm->arch.zerosim_timeline,
+                                       lockdep_is_held(&kvm->lock));
+        r = -ENOENT;
+        if (!tl)
+            break;
+
+        r = 0;
+        n = timeline_logged(tl);
+        if (arg->op == KVM_ZEROSIM_TIMELINE_GET &&
+            copy_to_user((void __user *)(unsigned long)arg->addr, tl->log,
+                         min(n, arg->nr) * sizeof(*tl->log))) {
+            r = -EFAULT;
+            break;
+        }
+
+        arg->nr = n;
+        arg->lost = atomic64_read(&tl->next) > tl->nr ?
+                    atomic64_read(&tl->next) - tl->nr : 0;
+        arg->diverged = atomic64_read(&tl->diverged);
+        break;
+
+    default:
+        r = -EINVAL;
+    }
+
+    mutex_unlock(&kvm->lock);
+    return r;
+}
+
+void kvm_zerosim_timeline_destroy(struct kvm *kvm)
+{
+    timeline_free(rcu_dereference_protected(kvm->arch.zerosim_timeline, 1));
+}
+
+static void timeline_append(struct zerosim_timeline *tl, struct kvm_vcpu *vcpu,
+        u8 type, u8 vector, u64 value)
+{
+    struct kvm_zerosim_timeline_rec *rec;
+    u64 slot = atomic64_inc_return(&tl->next) - 1;
+
+    if (slot >= tl->nr)
+        return;
+
+    rec = &tl->log[slot];
+    rec->value = value;
+    rec->seq = tl->cursor[vcpu->vcpu_id].seq;
+    rec->vcpu_id = vcpu->vcpu_id;
+    rec->type = type;
+    rec->vector = vector;
+}
+
+/* Take the record at *pos, a cursor of one vcpu and type, and advance it. */
+static struct kvm_zerosim_timeline_rec *
+timeline_next(struct zerosim_timeline *tl, u64 *pos)
+{
+    struct kvm_zerosim_timeline_rec *rec;
+
+    if (*pos >= tl->nr)
+        return NULL;
+
+    rec = &tl->log[*pos];
+    *pos = tl->chain[*pos];
+    return rec;
+}
+
+u64 __kvm_zerosim_timeline_adjust(struct kvm_vcpu *vcpu, u64 hidden)
+{
+    struct zerosim_timeline *tl;
+    struct kvm_zerosim_timeline_rec *rec;
+
+    tl = rcu_dereference_sched(vcpu->kvm->arch.zerosim_timeline);
+    if (!tl)
+        return hidden;
+
+    switch (tl->mode) {
+    case KVM_ZEROSIM_TIMELINE_RECORD:
+        tl->cursor[vcpu->vcpu_id].seq++;
+        timeline_append(tl, vcpu, KVM_ZEROSIM_TL_ADJUST, 0, hidden);
+        break;
+
+    case KVM_ZEROSIM_TIMELINE_REPLAY:
+        tl->cursor[vcpu->vcpu_id].seq++;
+        rec = timeline_next(tl, &tl->cursor[vcpu->vcpu_id].adjust_pos);
+        // Past the end of the log the run continues on real timing.
+        if (rec)
+            hidden = rec->value;
+        break;
+    }
+
+    return hidden;
+}
+EXPORT_SYMBOL_GPL(__kvm_zerosim_timeline_adjust);
+
+void __kvm_zerosim_timeline_irq(struct kvm_vcpu *vcpu, int vector)
+{
+    struct zerosim_timeline *tl;
+    struct kvm_zerosim_timeline_rec *rec;
+
+    // Unlike entries, injections run with interrupts enabled.
+    preempt_disable();
+    tl = rcu_dereference_sched(vcpu->kvm->arch.zerosim_timeline);
+    if (!tl)
+        goto out;
+
+    switch (tl->mode) {
+    case KVM_ZEROSIM_TIMELINE_RECORD:
+        timeline_append(tl, vcpu, KVM_ZEROSIM_TL_IRQ, vector,
+                        kvm_read_l1_tsc(vcpu, rdtsc()));
+        break;
+
+    case KVM_ZEROSIM_TIMELINE_REPLAY:
+        rec = timeline_next(tl, &tl->cursor[vcpu->vcpu_id].irq_pos);
+        if (!rec || rec->vector != vector ||
+            rec->seq != tl->cursor[vcpu->vcpu_id].seq)
+            atomic64_inc(&tl->diverged);
+        break;
+    }
+out:
+    preempt_enable();
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __X86_TIMELINE_H__
+#define __X86_TIMELINE_H__
+
+#include <linux/kvm_host.h>
+
+/*
+ * Record/replay of the guest-visible timeline of a VM: the number of cycles
+ * hidden from each vcpu at each entry, and the interrupts injected along the
+ * way. See KVM_ZEROSIM_TIMELINE.
+ */
+
+#ifdef CONFIG_X86_TSC_OFFSET_HOST_ELAPSED
+
+int kvm_zerosim_timeline_ioctl(struct kvm *kvm,
+        struct kvm_zerosim_timeline *arg);
+void kvm_zerosim_timeline_destroy(struct kvm *kvm);
+
+u64 __kvm_zerosim_timeline_adjust(struct kvm_vcpu *vcpu, u64 hidden);
+void __kvm_zerosim_timeline_irq(struct kvm_vcpu *vcpu, int vector);
+
+/*
+ * Called at VM entry with the number of cycles about to be hidden from the
+ * guest. Returns the number to actually hide: the same when recording, the
+ * logged one when replaying.
+ */
+static inline u64 kvm_zerosim_timeline_adjust(struct kvm_vcpu *vcpu, u64 hidden)
+{
+    if (likely(!rcu_access_pointer(vcpu->kvm->arch.zerosim_timeline)))
+        return hidden;
+    return __kvm_zerosim_timeline_adjust(vcpu, hidden);
+}
+
+/* Called when a new external interrupt is injected into the guest. */
+static inline void kvm_zerosim_timeline_irq(struct kvm_vcpu *vcpu, int vector)
+{
+    if (unlikely(rcu_access_pointer(vcpu->kvm->arch.zerosim_timeline)))
+        __kvm_zerosim_timeline_irq(vcpu, vector);
+}
+
+#else
+
+static inline void kvm_zerosim_timeline_destroy(struct kvm *kvm) {}
+static inline void kvm_zerosim_timeline_irq(struct kvm_vcpu *vcpu, int vector) {}
+
+#endif
+
+#endif
@@ -30,6 +30,10 @@
 #include <linux/balloon_compaction.h>
 #include <linux/oom.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/scatterlist.h>
+#include <linux/page_reporting.h>
+#include <linux/vmstat.h>
 
 /*
  * Balloon device works in 4K page units.  So each page is pointed to by
@@ -38,6 +42,16 @@
  */
 #define VIRTIO_BALLOON_PAGES_PER_PAGE (unsigned)(PAGE_SIZE >> VIRTIO_BALLOON_PFN_SHIFT)
 #define VIRTIO_BALLOON_ARRAY_PFNS_MAX 256
+#define VIRTIO_BALLOON_ARRAY_RANGES_MAX 256
+
+/*
+ * With VIRTIO_BALLOON_F_HUGE_PAGES the balloon is filled 2MB at a time
+ * where it can be, and requests describe pfn ranges: so one round trip
+ * moves up to VIRTIO_BALLOON_ARRAY_RANGES_MAX huge pages.
+ */
+#define VIRTIO_BALLOON_HUGE_ORDER (21 - PAGE_SHIFT)
+#define VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE \
+	(VIRTIO_BALLOON_PAGES_PER_PAGE << VIRTIO_BALLOON_HUGE_ORDER)
 #define OOM_VBALLOON_DEFAULT_PAGES 256
 #define VIRTBALLOON_OOM_NOTIFY_PRIORITY 80
 
@@ -45,9 +59,23 @@ static int oom_pages = OOM_VBALLOON_DEFAULT_PAGES;
 module_param(oom_pages, int, S_IRUSR | S_IWUSR);
 MODULE_PARM_DESC(oom_pages, "pages to free on OOM");
 
+/*
+ * Free page reporting hands the host up to VIRTIO_BALLOON_REPORT_CAPACITY
+ * free blocks at a time, taken straight off the buddy free lists and given
+ * back once the host has discarded their backing.  Blocks stay marked as
+ * reported until they are allocated, and a new report is only made once
+ * a buffer's worth of pageblocks has been freed since the last one.
+ */
+#define VIRTIO_BALLOON_REPORT_CAPACITY 32
+
+static unsigned int report_interval_ms = 2000;
+module_param(report_interval_ms, uint, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(report_interval_ms,
+		 "milliseconds to wait before reporting newly freed pages");
+
 struct virtio_balloon {
 	struct virtio_device *vdev;
-	struct virtqueue *inflate_vq, *deflate_vq, *stats_vq;
+	struct virtqueue *inflate_vq, *deflate_vq, *stats_vq, *reporting_vq;
 
 	/* Where the ballooning thread waits for config to change. */
 	wait_queue_head_t config_change;
@@ -75,12 +103,27 @@ struct virtio_balloon {
 	unsigned int num_pfns;
 	u32 pfns[VIRTIO_BALLOON_ARRAY_PFNS_MAX];
 
+	/* Or the array of pfn ranges, with VIRTIO_BALLOON_F_HUGE_PAGES. */
+	unsigned int num_ranges;
+	struct virtio_balloon_range ranges[VIRTIO_BALLOON_ARRAY_RANGES_MAX];
+
+	/*
+	 * Huge pages in the balloon, linked through page->lru: unlike those
+	 * on vb_dev_info->pages, these are not offered for migration.
+	 */
+	struct list_head huge_pages;
+
 	/* Memory statistics */
 	int need_stats_update;
 	struct virtio_balloon_stat stats[VIRTIO_BALLOON_S_NR];
 
 	/* To register callback in oom notifier call chain */
 	struct notifier_block nb;
+
+	/* Free page reporting, when VIRTIO_BALLOON_F_REPORTING */
+	struct page_reporting_dev_info pr_dev_info;
+	struct delayed_work report_work;
+	struct scatterlist report_sg[VIRTIO_BALLOON_REPORT_CAPACITY];
 };
 
 static struct virtio_device_id id_table[] = {
@@ -125,6 +168,46 @@ static void tell_host(struct virtio_balloon *vb, struct virtqueue *vq)
 	wait_event(vb->acked, virtqueue_get_buf(vq, &len));
 }
 
+static void tell_host_ranges(struct virtio_balloon *vb, struct virtqueue *vq)
+{
+	struct scatterlist sg;
+	unsigned int len;
+
+	sg_init_one(&sg, vb->ranges, sizeof(vb->ranges[0]) * vb->num_ranges);
+
+	/* We should always be able to add one buffer to an empty queue. */
+	virtqueue_add_outbuf(vq, &sg, 1, vb, GFP_KERNEL);
+	virtqueue_kick(vq);
+
+	/* When host has read buffer, this completes via balloon_ack */
+	wait_event(vb->acked, virtqueue_get_buf(vq, &len));
+}
+
+/* Append to the range array, extending the last range when contiguous. */
+static void add_page_range(struct virtio_balloon *vb, struct page *page,
+			   unsigned int nr)
+{
+	u64 pfn = page_to_balloon_pfn(page);
+
+	if (vb->num_ranges) {
+		struct virtio_balloon_range *last;
+		u64 end;
+
+		last = &vb->ranges[vb->num_ranges - 1];
+		end = virtio64_to_cpu(vb->vdev, last->pfn) +
+		      virtio64_to_cpu(vb->vdev, last->nr);
+
+		if (end == pfn) {
+			last->nr = cpu_to_virtio64(vb->vdev,
+				virtio64_to_cpu(vb->vdev, last->nr) + nr);
+			return;
+		}
+	}
+	vb->ranges[vb->num_ranges].pfn = cpu_to_virtio64(vb->vdev, pfn);
+	vb->ranges[vb->num_ranges].nr = cpu_to_virtio64(vb->vdev, nr);
+	vb->num_ranges++;
+}
+
 static void set_page_pfns(u32 pfns[], struct page *page)
 {
 	unsigned int i;
@@ -135,10 +218,76 @@ static void set_page_pfns(u32 pfns[], struct page *page)
 		pfns[i] = page_to_balloon_pfn(page) + i;
 }
 
+/*
+ * Inflate by huge pages while at least one more is wanted, then make up the
+ * rest (or whatever huge allocations failed to find) with ordinary balloon
+ * pages.  num is in balloon pages, as for fill_balloon(); we do no more than
+ * one array worth of pages at a time, even when ranges merge.
+ */
+static void fill_balloon_huge(struct virtio_balloon *vb, size_t num)
+{
+	struct balloon_dev_info *vb_dev_info = &vb->vb_dev_info;
+	/*
+	 * Not __GFP_MOVABLE: nothing migrates these pages, so they must not
+	 * pin movable pageblocks (or ZONE_MOVABLE) for as long as they stay
+	 * in the balloon.
+	 */
+	gfp_t gfp = GFP_HIGHUSER | __GFP_NOMEMALLOC |
+		    __GFP_NORETRY | __GFP_NOWARN;
+	bool deflate_on_oom = virtio_has_feature(vb->vdev,
+					VIRTIO_BALLOON_F_DEFLATE_ON_OOM);
+	unsigned int nr = 0;
+	struct page *page;
+
+	mutex_lock(&vb->balloon_lock);
+	vb->num_ranges = 0;
+	while (num >= VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE &&
+	       nr++ < ARRAY_SIZE(vb->ranges)) {
+		page = alloc_pages(gfp, VIRTIO_BALLOON_HUGE_ORDER);
+		if (!page)
+			break;
+		list_add(&page->lru, &vb->huge_pages);
+		add_page_range(vb, page, VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE);
+		vb->num_pages += VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE;
+		num -= VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE;
+		if (!deflate_on_oom)
+			adjust_managed_page_count(page,
+					-(1L << VIRTIO_BALLOON_HUGE_ORDER));
+	}
+
+	while (num >= VIRTIO_BALLOON_PAGES_PER_PAGE &&
+	       nr++ < ARRAY_SIZE(vb->ranges)) {
+		page = balloon_page_enqueue(vb_dev_info);
+		if (!page) {
+			dev_info_ratelimited(&vb->vdev->dev,
+					     "Out of puff! Can't get %u pages\n",
+					     VIRTIO_BALLOON_PAGES_PER_PAGE);
+			/* Sleep for at least 1/5 of a second before retry. */
+			msleep(200);
+			break;
+		}
+		add_page_range(vb, page, VIRTIO_BALLOON_PAGES_PER_PAGE);
+		vb->num_pages += VIRTIO_BALLOON_PAGES_PER_PAGE;
+		num -= VIRTIO_BALLOON_PAGES_PER_PAGE;
+		if (!deflate_on_oom)
+			adjust_managed_page_count(page, -1);
+	}
+
+	/* Did we get any? */
+	if (vb->num_ranges != 0)
+		tell_host_ranges(vb, vb->inflate_vq);
+	mutex_unlock(&vb->balloon_lock);
+}
+
 static void fill_balloon(struct virtio_balloon *vb, size_t num)
 {
 	struct balloon_dev_info *vb_dev_info = &vb->vb_dev_info;
 
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_HUGE_PAGES)) {
+		fill_balloon_huge(vb, num);
+		return;
+	}
+
 	/* We can only do one array worth at a time. */
 	num = min(num, ARRAY_SIZE(vb->pfns));
 
@@ -182,12 +331,76 @@ static void release_pages_balloon(struct virtio_balloon *vb)
 	}
 }
 
+/*
+ * Deflate huge pages first, even if that gives back a little more than
+ * asked (the next towards_target() round refills the difference with
+ * ordinary pages), then ordinary balloon pages.
+ */
+static unsigned leak_balloon_huge(struct virtio_balloon *vb, size_t num)
+{
+	struct balloon_dev_info *vb_dev_info = &vb->vb_dev_info;
+	bool deflate_on_oom = virtio_has_feature(vb->vdev,
+					VIRTIO_BALLOON_F_DEFLATE_ON_OOM);
+	unsigned num_freed_pages = 0;
+	unsigned int nr = 0;
+	LIST_HEAD(huge);
+	LIST_HEAD(small);
+	struct page *page, *next;
+
+	mutex_lock(&vb->balloon_lock);
+	vb->num_ranges = 0;
+	while (num_freed_pages < num && !list_empty(&vb->huge_pages) &&
+	       nr++ < ARRAY_SIZE(vb->ranges)) {
+		page = list_first_entry(&vb->huge_pages, struct page, lru);
+		list_move(&page->lru, &huge);
+		add_page_range(vb, page, VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE);
+		num_freed_pages += VIRTIO_BALLOON_PAGES_PER_HUGE_PAGE;
+	}
+	while (num_freed_pages < num &&
+	       nr++ < ARRAY_SIZE(vb->ranges)) {
+		page = balloon_page_dequeue(vb_dev_info);
+		if (!page)
+			break;
+		list_add(&page->lru, &small);
+		add_page_range(vb, page, VIRTIO_BALLOON_PAGES_PER_PAGE);
+		num_freed_pages += VIRTIO_BALLOON_PAGES_PER_PAGE;
+	}
+	vb->num_pages -= num_freed_pages;
+
+	/*
+	 * Note that if
+	 * virtio_has_feature(vdev, VIRTIO_BALLOON_F_MUST_TELL_HOST);
+	 * is true, we *have* to do it in this order
+	 */
+	if (vb->num_ranges != 0)
+		tell_host_ranges(vb, vb->deflate_vq);
+	mutex_unlock(&vb->balloon_lock);
+
+	list_for_each_entry_safe(page, next, &huge, lru) {
+		list_del(&page->lru);
+		if (!deflate_on_oom)
+			adjust_managed_page_count(page,
+					1L << VIRTIO_BALLOON_HUGE_ORDER);
+		__free_pages(page, VIRTIO_BALLOON_HUGE_ORDER);
+	}
+	list_for_each_entry_safe(page, next, &small, lru) {
+		list_del(&page->lru);
+		if (!deflate_on_oom)
+			adjust_managed_page_count(page, 1);
+		put_page(page); /* balloon reference */
+	}
+	return num_freed_pages;
+}
+
 static unsigned leak_balloon(struct virtio_balloon *vb, size_t num)
 {
 	unsigned num_freed_pages;
 	struct page *page;
 	struct balloon_dev_info *vb_dev_info = &vb->vb_dev_info;
 
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_HUGE_PAGES))
+		return leak_balloon_huge(vb, num);
+
 	/* We can only do one array worth at a time. */
 	num = min(num, ARRAY_SIZE(vb->pfns));
 
@@ -345,6 +558,65 @@ static int virtballoon_oom_notify(struct notifier_block *self,
 	return NOTIFY_OK;
 }
 
+static void report_free_pages(struct work_struct *work)
+{
+	struct virtio_balloon *vb = container_of(to_delayed_work(work),
+					struct virtio_balloon, report_work);
+	struct virtqueue *vq = vb->reporting_vq;
+	bool reported;
+	unsigned int nr, len;
+
+	/* Whatever is freed from here on counts towards the next report */
+	atomic_long_set(&vb->pr_dev_info.pending, 0);
+
+	do {
+		nr = page_reporting_isolate(vb->report_sg,
+					    VIRTIO_BALLOON_REPORT_CAPACITY);
+		if (!nr)
+			break;
+
+		/*
+		 * The host discards the backing of every range in the buffer;
+		 * the blocks stay off the free lists until it has said so.
+		 */
+		reported = virtqueue_add_inbuf(vq, vb->report_sg, nr, vb,
+					       GFP_KERNEL) == 0;
+		if (reported) {
+			virtqueue_kick(vq);
+			wait_event(vb->acked, virtqueue_get_buf(vq, &len));
+		}
+		page_reporting_putback(vb->report_sg, nr, reported);
+		cond_resched();
+	} while (reported && nr == VIRTIO_BALLOON_REPORT_CAPACITY);
+}
+
+/* Called from the page freeing path, with interrupts off */
+static void report_free_pages_notify(struct page_reporting_dev_info *prdev)
+{
+	struct virtio_balloon *vb = container_of(prdev, struct virtio_balloon,
+						 pr_dev_info);
+
+	queue_delayed_work(system_freezable_wq, &vb->report_work,
+			   msecs_to_jiffies(report_interval_ms));
+}
+
+/* Report what is free now, and from then on what gets freed */
+static void start_reporting(struct virtio_balloon *vb)
+{
+	int err;
+
+	if (!vb->reporting_vq)
+		return;
+
+	err = page_reporting_register(&vb->pr_dev_info);
+	if (err) {
+		dev_warn(&vb->vdev->dev, "free page reporting unavailable: %d\n",
+			 err);
+		return;
+	}
+	queue_delayed_work(system_freezable_wq, &vb->report_work, 0);
+}
+
 static int balloon(void *_vballoon)
 {
 	struct virtio_balloon *vb = _vballoon;
@@ -386,25 +658,36 @@ static int balloon(void *_vballoon)
 
 static int init_vqs(struct virtio_balloon *vb)
 {
-	struct virtqueue *vqs[3];
-	vq_callback_t *callbacks[] = { balloon_ack, balloon_ack, stats_request };
-	const char *names[] = { "inflate", "deflate", "stats" };
-	int err, nvqs;
+	struct virtqueue *vqs[4];
+	vq_callback_t *callbacks[4] = { balloon_ack, balloon_ack };
+	const char *names[4] = { "inflate", "deflate" };
+	int err, nvqs = 2, stats = -1, reporting = -1;
 
 	/*
 	 * We expect two virtqueues: inflate and deflate, and
-	 * optionally stat.
+	 * optionally stat and reporting, in that order.
 	 */
-	nvqs = virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ) ? 3 : 2;
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ)) {
+		stats = nvqs++;
+		callbacks[stats] = stats_request;
+		names[stats] = "stats";
+	}
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_REPORTING)) {
+		reporting = nvqs++;
+		callbacks[reporting] = balloon_ack;
+		names[reporting] = "reporting";
+	}
 	err = vb->vdev->config->find_vqs(vb->vdev, nvqs, vqs, callbacks, names);
 	if (err)
 		return err;
 
 	vb->inflate_vq = vqs[0];
 	vb->deflate_vq = vqs[1];
-	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_STATS_VQ)) {
+	if (reporting >= 0)
+		vb->reporting_vq = vqs[reporting];
+	if (stats >= 0) {
 		struct scatterlist sg;
-		vb->stats_vq = vqs[2];
+		vb->stats_vq = vqs[stats];
 
 		/*
 		 * Prime this virtqueue with one buffer so the hypervisor can
@@ -464,15 +747,27 @@ static int virtballoon_migratepage(struct balloon_dev_info *vb_dev_info,
 	vb_dev_info->isolated_pages--;
 	__count_vm_event(BALLOON_MIGRATE);
 	spin_unlock_irqrestore(&vb_dev_info->pages_lock, flags);
-	vb->num_pfns = VIRTIO_BALLOON_PAGES_PER_PAGE;
-	set_page_pfns(vb->pfns, newpage);
-	tell_host(vb, vb->inflate_vq);
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_HUGE_PAGES)) {
+		vb->num_ranges = 0;
+		add_page_range(vb, newpage, VIRTIO_BALLOON_PAGES_PER_PAGE);
+		tell_host_ranges(vb, vb->inflate_vq);
+	} else {
+		vb->num_pfns = VIRTIO_BALLOON_PAGES_PER_PAGE;
+		set_page_pfns(vb->pfns, newpage);
+		tell_host(vb, vb->inflate_vq);
+	}
 
 	/* balloon's page migration 2nd step -- deflate "page" */
 	balloon_page_delete(page);
-	vb->num_pfns = VIRTIO_BALLOON_PAGES_PER_PAGE;
-	set_page_pfns(vb->pfns, page);
-	tell_host(vb, vb->deflate_vq);
+	if (virtio_has_feature(vb->vdev, VIRTIO_BALLOON_F_HUGE_PAGES)) {
+		vb->num_ranges = 0;
+		add_page_range(vb, page, VIRTIO_BALLOON_PAGES_PER_PAGE);
+		tell_host_ranges(vb, vb->deflate_vq);
+	} else {
+		vb->num_pfns = VIRTIO_BALLOON_PAGES_PER_PAGE;
+		set_page_pfns(vb->pfns, page);
+		tell_host(vb, vb->deflate_vq);
+	}
 
 	mutex_unlock(&vb->balloon_lock);
 
@@ -505,6 +800,13 @@ static int virtballoon_probe(struct virtio_device *vdev)
 	init_waitqueue_head(&vb->acked);
 	vb->vdev = vdev;
 	vb->need_stats_update = 0;
+	vb->reporting_vq = NULL;
+	INIT_LIST_HEAD(&vb->huge_pages);
+	INIT_DELAYED_WORK(&vb->report_work, report_free_pages);
+	vb->pr_dev_info.notify = report_free_pages_notify;
+	atomic_long_set(&vb->pr_dev_info.pending, 0);
+	vb->pr_dev_info.threshold =
+		VIRTIO_BALLOON_REPORT_CAPACITY << PAGE_REPORTING_MIN_ORDER;
 
 	balloon_devinfo_init(&vb->vb_dev_info);
 #ifdef CONFIG_BALLOON_COMPACTION
@@ -529,6 +831,8 @@ static int virtballoon_probe(struct virtio_device *vdev)
 		goto out_del_vqs;
 	}
 
+	start_reporting(vb);
+
 	return 0;
 
 out_del_vqs:
@@ -543,6 +847,12 @@ out:
 
 static void remove_common(struct virtio_balloon *vb)
 {
+	/* Reporting must stop before the queues go away. */
+	if (vb->reporting_vq) {
+		page_reporting_unregister(&vb->pr_dev_info);
+		cancel_delayed_work_sync(&vb->report_work);
+	}
+
 	/* There might be pages left in the balloon: free them. */
 	while (vb->num_pages)
 		leak_balloon(vb, vb->num_pages);
@@ -591,6 +901,7 @@ static int virtballoon_restore(struct virtio_device *vdev)
 
 	fill_balloon(vb, towards_target(vb));
 	update_balloon_size(vb);
+	start_reporting(vb);
 	return 0;
 }
 #endif
@@ -599,6 +910,8 @@ static unsigned int features[] = {
 	VIRTIO_BALLOON_F_MUST_TELL_HOST,
 	VIRTIO_BALLOON_F_STATS_VQ,
 	VIRTIO_BALLOON_F_DEFLATE_ON_OOM,
+	VIRTIO_BALLOON_F_REPORTING,
+	VIRTIO_BALLOON_F_HUGE_PAGES,
 };
 
 static struct virtio_driver virtio_balloon_driver = {
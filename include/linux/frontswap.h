@@ -11,6 +11,9 @@ struct frontswap_ops {
 	int (*load)(unsigned, pgoff_t, struct page *); /* load a page */
 	void (*invalidate_page)(unsigned, pgoff_t); /* page no longer needed */
 	void (*invalidate_area)(unsigned); /* swap type just swapoff'ed */
+	/* optional: store/load nr pages at consecutive offsets at once */
+	int (*store_batch)(unsigned, pgoff_t, struct page *, unsigned int);
+	int (*load_batch)(unsigned, pgoff_t, struct page *, unsigned int);
 	struct frontswap_ops *next; /* private pointer to next ops */
 };
 
@@ -26,6 +29,9 @@ extern bool __frontswap_test(struct swap_info_struct *, pgoff_t);
 extern void __frontswap_init(unsigned type, unsigned long *map);
 extern int __frontswap_store(struct page *page);
 extern int __frontswap_load(struct page *page);
+extern int __frontswap_store_batch(struct page *page, unsigned int nr);
+extern int __frontswap_load_batch(swp_entry_t entry, struct page *page,
+				  unsigned int nr);
 extern void __frontswap_invalidate_page(unsigned, pgoff_t);
 extern void __frontswap_invalidate_area(unsigned);
 
@@ -86,6 +92,25 @@ static inline int frontswap_load(struct page *page)
 	return ret;
 }
 
+static inline int frontswap_store_batch(struct page *page, unsigned int nr)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_store_batch(page, nr);
+	return ret;
+}
+
+static inline int frontswap_load_batch(swp_entry_t entry, struct page *page,
+				       unsigned int nr)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_load_batch(entry, page, nr);
+	return ret;
+}
+
 static inline void frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
 	if (frontswap_enabled)
@@ -222,6 +222,31 @@ struct kvm_mmio_fragment {
 	unsigned len;
 };
 
+/*
+ * Log2 histograms of halt polling, bucket i counting polls that took
+ * [2^(i+9), 2^(i+10)) ns; the first and last buckets are open-ended.
+ */
+#define KVM_HALT_POLL_HIST_BUCKETS	16
+
+struct kvm_halt_poll_hist {
+	/* time to wakeup of polls that caught the wakeup */
+	u32 success[KVM_HALT_POLL_HIST_BUCKETS];
+	/* time spent in polls that gave up and blocked */
+	u32 wasted[KVM_HALT_POLL_HIST_BUCKETS];
+};
+
+/*
+ * Exit latency histogram, indexed by arch exit reason: bucket i counts exits
+ * whose exit-to-next-entry time was in [2^(i-1), 2^i) TSC cycles, the last
+ * bucket being open-ended.  Reasons past the end share the last row.
+ */
+#define KVM_EXIT_HIST_REASONS	80
+#define KVM_EXIT_HIST_BUCKETS	32
+
+struct kvm_exit_hist {
+	u32 count[KVM_EXIT_HIST_REASONS][KVM_EXIT_HIST_BUCKETS];
+};
+
 struct kvm_vcpu {
 	struct kvm *kvm;
 #ifdef CONFIG_PREEMPT_NOTIFIERS
@@ -249,6 +274,8 @@ struct kvm_vcpu {
 	sigset_t sigset;
 	struct kvm_vcpu_stat stat;
 	unsigned int halt_poll_ns;
+	struct kvm_halt_poll_hist halt_poll_hist;
+	struct kvm_exit_hist *exit_hist;
 
 #ifdef CONFIG_HAS_IOMEM
 	int mmio_needed;
@@ -509,6 +536,16 @@ static inline struct kvm_vcpu *kvm_get_vcpu_by_id(struct kvm *kvm, int id)
 int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id);
 void kvm_vcpu_uninit(struct kvm_vcpu *vcpu);
 
+/* Cheap enough for every exit: one fls and one increment, no atomics. */
+static inline void kvm_exit_hist_add(struct kvm_vcpu *vcpu, u32 reason,
+				     u64 cycles)
+{
+	unsigned int bucket = min(fls64(cycles), KVM_EXIT_HIST_BUCKETS - 1);
+
+	reason = min_t(u32, reason, KVM_EXIT_HIST_REASONS - 1);
+	vcpu->exit_hist->count[reason][bucket]++;
+}
+
 int __must_check vcpu_load(struct kvm_vcpu *vcpu);
 void vcpu_put(struct kvm_vcpu *vcpu);
 
@@ -833,6 +870,21 @@ static inline wait_queue_head_t *kvm_arch_vcpu_wq(struct kvm_vcpu *vcpu)
 #endif
 }
 
+#ifdef __KVM_HAVE_ARCH_GUEST_CLOCK
+/*
+ * The vcpu's idea of the current time, in nanoseconds, for architectures
+ * that hide part of the host's time from their guests.  @rescan asks for
+ * an exact reading; without it, a cheaper extrapolation from the last
+ * exact one will do.
+ */
+u64 kvm_arch_vcpu_guest_ns(struct kvm_vcpu *vcpu, bool rescan);
+#else
+static inline u64 kvm_arch_vcpu_guest_ns(struct kvm_vcpu *vcpu, bool rescan)
+{
+	return ktime_get_ns();
+}
+#endif
+
 #ifdef __KVM_HAVE_ARCH_INTC_INITIALIZED
 /*
  * returns true if the virtual interrupt controller is initialized and
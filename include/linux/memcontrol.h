@@ -32,6 +32,7 @@
 struct mem_cgroup;
 struct page;
 struct mm_struct;
+struct memcg_zswap_owner;
 struct kmem_cache;
 
 /*
@@ -192,6 +193,21 @@ struct mem_cgroup {
 	unsigned long low;
 	unsigned long high;
 
+	/*
+	 * Throttle mode: count zswap usage against high, and above it
+	 * delay the charging tasks and reclaim from high_work instead.
+	 */
+	bool high_throttle;
+	struct work_struct high_work;
+
+	/* Compressed bytes stored in zswap for this subtree */
+	atomic_long_t zswap_bytes;
+	/* What zswap entries charged here point to, see memcontrol.c */
+	struct memcg_zswap_owner *zswap_owner;
+	/* Owners whose charges go here, protected by memcg_zswap_lock */
+	struct list_head zswap_owners;
+	bool zswap_offline;
+
 	unsigned long soft_limit;
 
 	/* vmpressure notifications */
@@ -404,6 +420,10 @@ static inline bool mem_cgroup_inactive_anon_is_low(struct lruvec *lruvec)
 
 void mem_cgroup_handle_over_high(void);
 
+struct memcg_zswap_owner *mem_cgroup_zswap_charge(struct page *page,
+						  size_t size);
+void mem_cgroup_zswap_uncharge(struct memcg_zswap_owner *owner, size_t size);
+
 void mem_cgroup_print_oom_info(struct mem_cgroup *memcg,
 				struct task_struct *p);
 
@@ -625,6 +645,17 @@ static inline void mem_cgroup_handle_over_high(void)
 {
 }
 
+static inline struct memcg_zswap_owner *
+mem_cgroup_zswap_charge(struct page *page, size_t size)
+{
+	return NULL;
+}
+
+static inline void mem_cgroup_zswap_uncharge(struct memcg_zswap_owner *owner,
+					     size_t size)
+{
+}
+
 static inline void mem_cgroup_oom_enable(void)
 {
 }
@@ -633,6 +633,28 @@ extern struct page *mem_map;
  * Memory statistics and page replacement data structures are maintained on a
  * per-zone basis.
  */
+/*
+ * Upper bound on the number of reclaim threads per node: the primary kswapd
+ * plus the helpers that balance_pgdat() wakes when the backlog is large.
+ */
+#define KSWAPD_MAX_THREADS	16
+
+/*
+ * Per-thread kswapd bookkeeping. Slot 0 of pgdat->kswapd_threads describes
+ * the primary kswapd, the other slots its helpers.
+ */
+struct kswapd_thread {
+	struct pglist_data *pgdat;
+	struct task_struct *task;	/* NULL for idle helper slots */
+	int id;
+	unsigned int wake_seq;		/* pgdat->kswapd_helper_seq served last */
+	/* Reclaim throughput, reported in /proc/kswapdinfo */
+	unsigned long nr_runs;
+	unsigned long nr_scanned;
+	unsigned long nr_reclaimed;
+	u64 run_ns;
+};
+
 struct bootmem_data;
 typedef struct pglist_data {
 	struct zone node_zones[MAX_NR_ZONES];
@@ -671,6 +693,13 @@ typedef struct pglist_data {
 					   mem_hotplug_begin/end() */
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+	wait_queue_head_t kswapd_helper_wait;
+	int kswapd_helpers_wanted;	/* helpers with id <= this run */
+	unsigned int kswapd_helper_seq;	/* bumped by each helper wakeup */
+	struct kswapd_thread kswapd_threads[KSWAPD_MAX_THREADS];
+	struct task_struct *proactive_reclaimd;	/* Protected by
+						   mem_hotplug_begin/end() */
+	wait_queue_head_t proactive_reclaim_wait;
 #ifdef CONFIG_NUMA_BALANCING
 	/* Lock serializing the migrate rate limiting window */
 	spinlock_t numabalancing_migrate_lock;
@@ -0,0 +1,43 @@
+/*
+ * include/linux/page_reporting.h
+ *
+ * Free page reporting lets a paravirtual device tell its host which free
+ * blocks of guest memory it may discard.  Blocks that have been reported
+ * are marked PageReported on the buddy free lists until they are allocated
+ * or merged, so each one is only reported once, and the device is only
+ * notified once enough newly freed memory has built up to make another
+ * report worth it.
+ */
+#ifndef _LINUX_PAGE_REPORTING_H
+#define _LINUX_PAGE_REPORTING_H
+
+#include <linux/mmzone.h>
+#include <linux/scatterlist.h>
+#include <linux/atomic.h>
+
+/* Free blocks of this order and up are reported */
+#define PAGE_REPORTING_MIN_ORDER	pageblock_order
+
+struct page_reporting_dev_info {
+	/*
+	 * Called, from the page freeing path with the zone lock held and
+	 * interrupts off, whenever the pending count is at or above the
+	 * threshold.  Must not sleep; typically it queues a work item.
+	 */
+	void (*notify)(struct page_reporting_dev_info *prdev);
+
+	/* Pages freed in blocks of PAGE_REPORTING_MIN_ORDER and up */
+	atomic_long_t pending;
+	unsigned long threshold;
+};
+
+#ifdef CONFIG_PAGE_REPORTING
+extern int page_reporting_register(struct page_reporting_dev_info *prdev);
+extern void page_reporting_unregister(struct page_reporting_dev_info *prdev);
+extern unsigned int page_reporting_isolate(struct scatterlist *sgl,
+					   unsigned int nents);
+extern void page_reporting_putback(struct scatterlist *sgl,
+				   unsigned int nents, bool reported);
+#endif
+
+#endif /* _LINUX_PAGE_REPORTING_H */
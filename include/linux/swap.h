@@ -350,6 +350,14 @@ extern void check_move_unevictable_pages(struct page **, int nr_pages);
 
 extern int kswapd_run(int nid);
 extern void kswapd_stop(int nid);
+struct ctl_table;
+extern int kswapd_threads;
+extern int kswapd_threads_sysctl_handler(struct ctl_table *, int,
+					 void __user *, size_t *, loff_t *);
+extern int sysctl_proactive_reclaim_free_kbytes;
+extern int sysctl_proactive_reclaim_rate_kbytes;
+extern int proactive_reclaim_sysctl_handler(struct ctl_table *, int,
+					    void __user *, size_t *, loff_t *);
 #ifdef CONFIG_MEMCG
 static inline int mem_cgroup_swappiness(struct mem_cgroup *memcg)
 {
@@ -430,6 +438,14 @@ static inline long get_nr_swap_pages(void)
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
 extern swp_entry_t get_swap_page_of_type(int);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+extern swp_entry_t get_huge_swap_page(void);
+#else
+static inline swp_entry_t get_huge_swap_page(void)
+{
+	return (swp_entry_t) {0};
+}
+#endif
 extern int add_swap_count_continuation(swp_entry_t, gfp_t);
 extern void swap_shmem_alloc(swp_entry_t);
 extern int swap_duplicate(swp_entry_t);
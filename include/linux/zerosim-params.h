@@ -6,6 +6,13 @@
 #define ZEROSIM_INSTR_BUFSIZE 256
 
 #define ZEROSIM_PROC_CREATE(type, name, default_val, fmt) \
+    ZEROSIM_PROC_CREATE_HOOK(type, name, default_val, fmt, do {} while (0))
+
+/*
+ * Like ZEROSIM_PROC_CREATE, but runs the statement @on_write after every
+ * successful write, once the new value is in place.
+ */
+#define ZEROSIM_PROC_CREATE_HOOK(type, name, default_val, fmt, on_write) \
     static type name = default_val; \
     static struct proc_dir_entry *name##_ent; \
     \
@@ -51,6 +58,7 @@
         } \
  \
         name = val; \
+        on_write; \
  \
         printk(KERN_WARNING "zerosim: %s = " fmt "\n", #name, name); \
  \
@@ -3,9 +3,22 @@
 
 #include <linux/types.h>
 #include <linux/sched.h>
+#include <linux/jump_label.h>
 
 #include <asm/traps.h>
 
+/*
+ * The hooks are only called while these are enabled, which keeps their cost
+ * down to a NOP the rest of the time (see STATIC_JUMP_IF_TRUE in entry_64.S).
+ *
+ * zerosim_trace_key covers syscalls, exceptions and task switches and is on
+ * while tracing. zerosim_irq_key covers interrupts and softirqs, which also
+ * feed `zerosim_irq_time`, and is on while tracing or while anybody holds a
+ * reference from `zerosim_irq_acct_get`.
+ */
+DECLARE_STATIC_KEY_FALSE(zerosim_trace_key);
+DECLARE_STATIC_KEY_FALSE(zerosim_irq_key);
+
 /*
  * Init the zerosim tracer. This will allocate tracing buffer space for
  * everything. This happens during boot before the init process is created.
@@ -78,4 +91,20 @@ void zerosim_trace_vm_delay_begin(int vcpu_id, unsigned long behind);
  */
 void zerosim_trace_vm_delay_end(int vcpu_id);
 
+/*
+ * Exclusive time (in TSC cycles) this cpu has spent in hard interrupt and in
+ * softirq context. Nested contexts are charged to the innermost one only, so
+ * the two never overlap. Only time spent while the interrupt hooks are
+ * enabled is counted, so callers should hold a `zerosim_irq_acct_get`
+ * reference for as long as they compare readings.
+ */
+void zerosim_irq_time(u64 *hardirq, u64 *softirq);
+
+/*
+ * Take or drop a reference on the interrupt hooks, keeping `zerosim_irq_time`
+ * up to date while held. These may sleep.
+ */
+void zerosim_irq_acct_get(void);
+void zerosim_irq_acct_put(void);
+
 #endif
@@ -0,0 +1,109 @@
+#ifndef _LINUX_ZLOCK_STAT_H
+#define _LINUX_ZLOCK_STAT_H
+
+/*
+ * Contention statistics for the zswap and ztier locks.
+ *
+ * A zlock is a spinlock that, while statistics are on, counts its plain and
+ * contended acquisitions and keeps histograms of the time spent waiting for
+ * and holding it, separately for each call site. All the zlocks of a class
+ * (e.g. the trees of all swap types) share one set of statistics. While
+ * statistics are off, the only cost is a patched-out branch.
+ *
+ * The statistics are read, enabled and reset through
+ * /sys/kernel/debug/zswap/lock_stats.
+ */
+
+#include <linux/jump_label.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+enum zlock_site {
+    ZLOCK_STORE,
+    ZLOCK_LOAD,
+    ZLOCK_INVALIDATE,
+    ZLOCK_WRITEBACK,
+    ZLOCK_RECLAIM,
+    ZLOCK_NR_SITES,
+};
+
+/* Bucket i counts times in [2^i, 2^(i+1)) ns; the last one is open-ended. */
+#define ZLOCK_HIST_BUCKETS 24
+
+struct zlock_site_stats {
+    u64 acquired;
+    u64 contended;
+    u64 wait_ns;
+    u64 hold_ns;
+    u64 wait_hist[ZLOCK_HIST_BUCKETS];
+    u64 hold_hist[ZLOCK_HIST_BUCKETS];
+};
+
+struct zlock_cpu_stats {
+    struct zlock_site_stats site[ZLOCK_NR_SITES];
+};
+
+struct zlock_class {
+    const char *name;
+    // Only written with a lock of the class held, hence with preemption
+    // disabled.
+    struct zlock_cpu_stats __percpu *stats;
+    struct list_head list;
+};
+
+struct zlock {
+    spinlock_t lock;
+    struct zlock_class *class;
+
+    // Protected by lock: when it was taken, or 0 if the acquisition was not
+    // timed, and from where.
+    u64 held_since;
+    enum zlock_site site;
+};
+
+DECLARE_STATIC_KEY_FALSE(zlock_stats_key);
+
+int zlock_class_register(struct zlock_class *class, const char *name);
+void zlock_class_unregister(struct zlock_class *class);
+
+/* Sum of a class's statistics for one site over all cpus. */
+void zlock_class_read(struct zlock_class *class, enum zlock_site site,
+        struct zlock_site_stats *sum);
+
+/* Keep statistics on while there are references. */
+void zlock_stats_get(void);
+void zlock_stats_put(void);
+
+extern const struct file_operations zlock_stats_fops;
+
+void __zlock_lock_timed(struct zlock *zl, enum zlock_site site);
+void __zlock_unlock_timed(struct zlock *zl);
+
+static inline void zlock_init(struct zlock *zl, struct zlock_class *class)
+{
+    spin_lock_init(&zl->lock);
+    zl->class = class;
+    zl->held_since = 0;
+}
+
+static inline void zlock_lock(struct zlock *zl, enum zlock_site site)
+{
+    if (static_branch_unlikely(&zlock_stats_key)) {
+        __zlock_lock_timed(zl, site);
+    } else {
+        spin_lock(&zl->lock);
+        zl->held_since = 0;
+    }
+}
+
+static inline void zlock_unlock(struct zlock *zl)
+{
+    // held_since is 0 if statistics were turned on while we held the lock.
+    if (static_branch_unlikely(&zlock_stats_key) && zl->held_since)
+        __zlock_unlock_timed(zl);
+    else
+        spin_unlock(&zl->lock);
+}
+
+#endif /* _LINUX_ZLOCK_STAT_H */
@@ -0,0 +1,44 @@
+#ifndef _LINUX_ZSWAP_H
+#define _LINUX_ZSWAP_H
+
+#include <linux/types.h>
+
+struct page;
+
+#ifdef CONFIG_ZSWAP
+
+/*
+ * Direct access to the zswap store for the benchmark module
+ * (mm/zswap_bench.c). The benchmark gets a swap type of its own, which no
+ * swap area may be using, so its entries never mix with real ones. They
+ * are never written back either, as there is no swap slot behind them.
+ */
+int zswap_bench_open(void);
+void zswap_bench_close(int type);
+
+int zswap_bench_store(int type, pgoff_t offset, struct page *page);
+int zswap_bench_load(int type, pgoff_t offset, struct page *page);
+void zswap_bench_invalidate(int type, pgoff_t offset);
+
+/*
+ * The batched store and load used for THP swap runs, on @nr pages starting
+ * at @page and @offset.
+ */
+int zswap_bench_store_batch(int type, pgoff_t offset, struct page *page,
+			    unsigned int nr);
+int zswap_bench_load_batch(int type, pgoff_t offset, struct page *page,
+			   unsigned int nr);
+
+/* Bytes used by the compressed pool, including the zero-page bitmaps. */
+u64 zswap_bench_pool_size(void);
+
+/*
+ * Acquisitions of and total time spent holding the tree locks, over all
+ * swap types. Lock statistics are on at least from zswap_bench_open() to
+ * zswap_bench_close().
+ */
+void zswap_bench_lock_stats(u64 *acquired, u64 *hold_ns);
+
+#endif
+
+#endif /* _LINUX_ZSWAP_H */
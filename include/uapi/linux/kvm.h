@@ -831,6 +831,8 @@ struct kvm_ppc_smmu_info {
 #define KVM_CAP_GUEST_DEBUG_HW_WPS 120
 #define KVM_CAP_SPLIT_IRQCHIP 121
 #define KVM_CAP_IOEVENTFD_ANY_LENGTH 122
+#define KVM_CAP_ZEROSIM_TIMELINE 123
+#define KVM_CAP_ZEROSIM_DILATION 124
 
 #ifdef KVM_CAP_IRQ_ROUTING
 
@@ -1218,6 +1220,8 @@ struct kvm_s390_ucas_mapping {
 #define KVM_S390_GET_IRQ_STATE	  _IOW(KVMIO, 0xb6, struct kvm_s390_irq_state)
 /* Available with KVM_CAP_X86_SMM */
 #define KVM_SMI                   _IO(KVMIO,   0xb7)
+/* Available with KVM_CAP_ZEROSIM_TIMELINE */
+#define KVM_ZEROSIM_TIMELINE      _IOWR(KVMIO, 0xb8, struct kvm_zerosim_timeline)
 
 #define KVM_DEV_ASSIGN_ENABLE_IOMMU	(1 << 0)
 #define KVM_DEV_ASSIGN_PCI_2_3		(1 << 1)
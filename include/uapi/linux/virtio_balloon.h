@@ -34,10 +34,22 @@
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST	0 /* Tell before reclaiming pages */
 #define VIRTIO_BALLOON_F_STATS_VQ	1 /* Memory Stats virtqueue */
 #define VIRTIO_BALLOON_F_DEFLATE_ON_OOM	2 /* Deflate balloon on OOM */
+#define VIRTIO_BALLOON_F_REPORTING	5 /* Free page reporting virtqueue */
+#define VIRTIO_BALLOON_F_HUGE_PAGES	6 /* Inflate/deflate by pfn ranges */
 
 /* Size of a PFN in the balloon interface. */
 #define VIRTIO_BALLOON_PFN_SHIFT 12
 
+/*
+ * With VIRTIO_BALLOON_F_HUGE_PAGES, inflate and deflate buffers carry an
+ * array of these in place of 32-bit pfns: nr balloon pages starting at pfn,
+ * both in units of 1 << VIRTIO_BALLOON_PFN_SHIFT bytes.
+ */
+struct virtio_balloon_range {
+	__virtio64 pfn;
+	__virtio64 nr;
+};
+
 struct virtio_balloon_config {
 	/* Number of pages host wants Guest to give up. */
 	__u32 num_pages;
@@ -2595,7 +2595,8 @@ static struct rq *finish_task_switch(struct task_struct *prev)
 
 	tick_nohz_task_switch();
 
-    zerosim_trace_task_switch(prev, current);
+    if (static_branch_unlikely(&zerosim_trace_key))
+        zerosim_trace_task_switch(prev, current);
 
 	return rq;
 }
@@ -238,7 +238,8 @@ asmlinkage __visible void __do_softirq(void)
 	__u32 pending;
 	int softirq_bit;
 
-    zerosim_trace_softirq_start();
+    if (static_branch_unlikely(&zerosim_irq_key))
+        zerosim_trace_softirq_start();
 
 	/*
 	 * Mask out PF_MEMALLOC s current task context is borrowed for the
@@ -303,7 +304,8 @@ restart:
 	WARN_ON_ONCE(in_interrupt());
 	tsk_restore_flags(current, old_flags, PF_MEMALLOC);
 
-    zerosim_trace_softirq_end();
+    if (static_branch_unlikely(&zerosim_irq_key))
+        zerosim_trace_softirq_end();
 }
 
 asmlinkage __visible void do_softirq(void)
@@ -126,6 +126,7 @@ static int __maybe_unused two = 2;
 static int __maybe_unused four = 4;
 static unsigned long one_ul = 1;
 static int one_hundred = 100;
+static int kswapd_threads_max = KSWAPD_MAX_THREADS;
 #ifdef CONFIG_PRINTK
 static int ten_thousand = 10000;
 #endif
@@ -1301,6 +1302,31 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one_hundred,
 	},
+	{
+		.procname	= "kswapd_threads",
+		.data		= &kswapd_threads,
+		.maxlen		= sizeof(kswapd_threads),
+		.mode		= 0644,
+		.proc_handler	= kswapd_threads_sysctl_handler,
+		.extra1		= &one,
+		.extra2		= &kswapd_threads_max,
+	},
+	{
+		.procname	= "proactive_reclaim_free_kbytes",
+		.data		= &sysctl_proactive_reclaim_free_kbytes,
+		.maxlen		= sizeof(sysctl_proactive_reclaim_free_kbytes),
+		.mode		= 0644,
+		.proc_handler	= proactive_reclaim_sysctl_handler,
+		.extra1		= &zero,
+	},
+	{
+		.procname	= "proactive_reclaim_rate_kbytes",
+		.data		= &sysctl_proactive_reclaim_rate_kbytes,
+		.maxlen		= sizeof(sysctl_proactive_reclaim_rate_kbytes),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+	},
 #ifdef CONFIG_HUGETLB_PAGE
 	{
 		.procname	= "nr_hugepages",
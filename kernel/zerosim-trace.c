@@ -13,6 +13,8 @@
 #include <linux/slab.h>
 #include <linux/percpu.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/smp.h>
 
 #include <asm/ptrace.h>
 #include <asm/topology.h>
@@ -96,9 +98,139 @@ static atomic_t hold_buffers = ATOMIC_INIT(0);
 
 static u64 trace_buf_size = 1 << 12;
 
+DEFINE_STATIC_KEY_FALSE(zerosim_trace_key);
+DEFINE_STATIC_KEY_FALSE(zerosim_irq_key);
+
+/* Users of the interrupt hooks, including tracing itself. */
+static DEFINE_MUTEX(irq_hooks_mutex);
+static int irq_hooks_users;
+
 /* Each CPU has a buffer */
 DEFINE_PER_CPU_SHARED_ALIGNED(struct trace_buffer, zerosim_trace_buffers);
 
+/* Contexts whose exclusive time is accounted by `zerosim_irq_time` */
+#define ZEROSIM_CTX_HARDIRQ 0
+#define ZEROSIM_CTX_SOFTIRQ 1
+#define ZEROSIM_CTX_NR      2
+
+#define ZEROSIM_CTX_MAX_DEPTH 8
+
+/*
+ * A per-cpu stack of the interrupt contexts we are in. Time between two
+ * transitions is charged to the context on top of the stack. Only touched
+ * with interrupts disabled.
+ */
+struct irq_acct {
+    // Timestamp of the last transition.
+    u64 last;
+    // Exclusive cycles spent in each context.
+    u64 cycles[ZEROSIM_CTX_NR];
+    int depth;
+    u8 stack[ZEROSIM_CTX_MAX_DEPTH];
+};
+
+static DEFINE_PER_CPU(struct irq_acct, zerosim_irq_acct);
+
+/* Charge the time since the last transition to the current context. */
+static inline void irq_acct_charge(struct irq_acct *acct, u64 now)
+{
+    int top = min(acct->depth, ZEROSIM_CTX_MAX_DEPTH);
+
+    if (top > 0)
+        acct->cycles[acct->stack[top - 1]] += now - acct->last;
+    acct->last = now;
+}
+
+static inline void irq_acct_enter(int ctx, u64 now)
+{
+    struct irq_acct *acct = this_cpu_ptr(&zerosim_irq_acct);
+
+    irq_acct_charge(acct, now);
+    // Deeper nesting keeps being charged to the deepest recorded context.
+    if (acct->depth < ZEROSIM_CTX_MAX_DEPTH)
+        acct->stack[acct->depth] = ctx;
+    acct->depth++;
+}
+
+static inline void irq_acct_exit(u64 now)
+{
+    struct irq_acct *acct = this_cpu_ptr(&zerosim_irq_acct);
+
+    irq_acct_charge(acct, now);
+    if (acct->depth > 0)
+        acct->depth--;
+}
+
+void zerosim_irq_time(u64 *hardirq, u64 *softirq)
+{
+    struct irq_acct *acct;
+    unsigned long flags;
+
+    local_irq_save(flags);
+    acct = this_cpu_ptr(&zerosim_irq_acct);
+    irq_acct_charge(acct, rdtsc());
+    *hardirq = acct->cycles[ZEROSIM_CTX_HARDIRQ];
+    *softirq = acct->cycles[ZEROSIM_CTX_SOFTIRQ];
+    local_irq_restore(flags);
+}
+EXPORT_SYMBOL(zerosim_irq_time);
+
+static void irq_acct_reset(void *unused)
+{
+    struct irq_acct *acct = this_cpu_ptr(&zerosim_irq_acct);
+
+    acct->depth = 0;
+    acct->last = rdtsc();
+}
+
+void zerosim_irq_acct_get(void)
+{
+    mutex_lock(&irq_hooks_mutex);
+    if (!irq_hooks_users++) {
+        static_branch_enable(&zerosim_irq_key);
+        // Contexts entered before the hooks were last patched out were
+        // never exited, so start from a clean stack. Contexts in flight
+        // now will exit without having entered, which depth 0 tolerates.
+        on_each_cpu(irq_acct_reset, NULL, 1);
+    }
+    mutex_unlock(&irq_hooks_mutex);
+}
+EXPORT_SYMBOL(zerosim_irq_acct_get);
+
+void zerosim_irq_acct_put(void)
+{
+    mutex_lock(&irq_hooks_mutex);
+    if (!WARN_ON(irq_hooks_users <= 0) && !--irq_hooks_users)
+        static_branch_disable(&zerosim_irq_key);
+    mutex_unlock(&irq_hooks_mutex);
+}
+EXPORT_SYMBOL(zerosim_irq_acct_put);
+
+/*
+ * Patch the syscall and exception hooks in or out to match tracing_enabled.
+ * Called with no buffer locks held, since patching may sleep.
+ */
+static void trace_hooks_sync(void)
+{
+    static DEFINE_MUTEX(trace_hooks_mutex);
+    static bool hooks_on;
+    bool on;
+
+    mutex_lock(&trace_hooks_mutex);
+    on = atomic_read(&tracing_enabled);
+    if (on != hooks_on) {
+        hooks_on = on;
+        if (on) {
+            static_branch_enable(&zerosim_trace_key);
+            zerosim_irq_acct_get();
+        } else {
+            static_branch_disable(&zerosim_trace_key);
+            zerosim_irq_acct_put();
+        }
+    }
+    mutex_unlock(&trace_hooks_mutex);
+}
+
 __init int zerosim_trace_init(void)
 {
     struct trace_buffer * tb;
@@ -176,6 +308,7 @@ SYSCALL_DEFINE1(zerosim_trace_size,
     atomic_set(&tracing_enabled, 0);
     atomic_set(&ready, 0);
     release_all_locks(flags);
+    trace_hooks_sync();
 
     // If we get here, we know that nobody is using the buffers or copying them.
 
@@ -227,6 +360,7 @@ SYSCALL_DEFINE0(zerosim_trace_begin)
 
     if (atomic_add_unless(&tracing_enabled, 1, 1)) {
         release_all_locks(flags);
+        trace_hooks_sync();
         printk(KERN_WARNING "zerosim_trace begin\n");
         return 0; // OK
     } else {
@@ -259,12 +393,14 @@ SYSCALL_DEFINE2(zerosim_trace_snapshot,
     }
     if (!atomic_add_unless(&ready, -1, 0)) {
         release_all_locks(flags);
+        trace_hooks_sync();
         return -ENOMEM; // wasn't ready
     }
 
     // Check that the user buffer is large enough
     if (len < (trace_buf_size * num_possible_cpus() * sizeof(struct trace))) {
         release_all_locks(flags);
+        trace_hooks_sync();
         printk(KERN_WARNING "user buffer of size %lu is too small. need %lu * %u * %lu = %llu.\n",
                 len, (unsigned long)trace_buf_size, num_possible_cpus(), sizeof(struct trace),
                 trace_buf_size * num_possible_cpus() * sizeof(struct trace));
@@ -275,6 +411,7 @@ SYSCALL_DEFINE2(zerosim_trace_snapshot,
     atomic_set(&hold_buffers, 1);
 
     release_all_locks(flags);
+    trace_hooks_sync();
 
     // If we get here, it means that nobody is using or freeing buffers.
 
@@ -402,6 +539,7 @@ void zerosim_trace_interrupt_start(struct pt_regs *regs)
         .extra = 0,
     };
 
+    irq_acct_enter(ZEROSIM_CTX_HARDIRQ, tr.timestamp);
     zerosim_trace_event(&tr);
 }
 
@@ -415,6 +553,7 @@ void zerosim_trace_interrupt_end(struct pt_regs *regs)
         .extra = 0,
     };
 
+    irq_acct_exit(tr.timestamp);
     zerosim_trace_event(&tr);
 }
 
@@ -454,6 +593,8 @@ void zerosim_trace_softirq_start(void)
         .extra = 0,
     };
 
+    // __do_softirq calls us with interrupts still disabled.
+    irq_acct_enter(ZEROSIM_CTX_SOFTIRQ, tr.timestamp);
     zerosim_trace_event(&tr);
 }
 
@@ -467,6 +608,7 @@ void zerosim_trace_softirq_end(void)
         .extra = 0,
     };
 
+    irq_acct_exit(tr.timestamp);
     zerosim_trace_event(&tr);
 }
 
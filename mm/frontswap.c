@@ -328,6 +328,108 @@ int __frontswap_load(struct page *page)
 }
 EXPORT_SYMBOL(__frontswap_load);
 
+/*
+ * Store @nr pages, @page up to @page + nr - 1, as one unit.  The pages must
+ * be locked and in the swap cache at consecutive offsets, starting with
+ * @page's.  Either all of them are stored or none is, and only backends
+ * that implement ->store_batch are asked; a caller getting failure can
+ * still store the pages one at a time.
+ */
+int __frontswap_store_batch(struct page *page, unsigned int nr)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = swap_info[type];
+	pgoff_t offset = swp_offset(entry);
+	struct frontswap_ops *ops;
+	unsigned int i;
+
+	if (!frontswap_ops)
+		return -1;
+
+	BUG_ON(sis == NULL);
+	for (i = 0; i < nr; i++) {
+		VM_BUG_ON_PAGE(!PageLocked(page + i), page + i);
+		VM_BUG_ON_PAGE(page_private(page + i) !=
+			       swp_entry(type, offset + i).val, page + i);
+	}
+
+	/* As in __frontswap_store(), old copies must go either way */
+	for (i = 0; i < nr; i++) {
+		if (__frontswap_test(sis, offset + i)) {
+			__frontswap_clear(sis, offset + i);
+			for_each_frontswap_ops(ops)
+				ops->invalidate_page(type, offset + i);
+		}
+	}
+
+	for_each_frontswap_ops(ops) {
+		if (!ops->store_batch)
+			continue;
+		ret = ops->store_batch(type, offset, page, nr);
+		if (!ret)
+			break;
+	}
+	if (ret == 0) {
+		for (i = 0; i < nr; i++) {
+			__frontswap_set(sis, offset + i);
+			inc_frontswap_succ_stores();
+		}
+	} else {
+		inc_frontswap_failed_stores();
+	}
+	if (frontswap_writethrough_enabled)
+		ret = -1;
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_store_batch);
+
+/*
+ * Fill the @nr pages from @page on with the data stored at @entry and the
+ * offsets following it.  Fails without side effects unless every one of
+ * them is in frontswap and a backend implementing ->load_batch has them
+ * all.  Unlike __frontswap_load(), the pages need not be in the swap
+ * cache: the caller keeps the entries alive, e.g. by holding the page
+ * tables that refer to them.
+ */
+int __frontswap_load_batch(swp_entry_t entry, struct page *page,
+			   unsigned int nr)
+{
+	int ret = -1;
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = swap_info[type];
+	pgoff_t offset = swp_offset(entry);
+	struct frontswap_ops *ops;
+	unsigned int i;
+
+	if (!frontswap_ops)
+		return -1;
+
+	BUG_ON(sis == NULL);
+	for (i = 0; i < nr; i++)
+		if (!__frontswap_test(sis, offset + i))
+			return -1;
+
+	for_each_frontswap_ops(ops) {
+		if (!ops->load_batch)
+			continue;
+		ret = ops->load_batch(type, offset, page, nr);
+		if (!ret)
+			break;
+	}
+	if (ret == 0) {
+		for (i = 0; i < nr; i++)
+			inc_frontswap_loads();
+		if (frontswap_tmem_exclusive_gets_enabled) {
+			for (i = 0; i < nr; i++)
+				__frontswap_clear(sis, offset + i);
+		}
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_load_batch);
+
 /*
  * Invalidate any data from frontswap associated with the specified swaptype
  * and offset so that a subsequent "get" will fail.
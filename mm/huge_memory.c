@@ -26,6 +26,9 @@
 #include <linux/hashtable.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/page_idle.h>
+#include <linux/swapops.h>
+#include <linux/swapfile.h>
+#include <linux/frontswap.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -2638,6 +2641,177 @@ out:
 	goto out_up_write;
 }
 
+/*
+ * Whether the HPAGE_PMD_NR ptes from @pte on refer to the swap entries
+ * from @start on, all of which are held in frontswap and none of which
+ * are in the swap cache.
+ */
+static bool huge_swap_run_ready(pte_t *pte, int type, pgoff_t start)
+{
+	struct swap_info_struct *si = swap_info[type];
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		swp_entry_t entry = swp_entry(type, start + i);
+		pte_t pteval = pte[i];
+		struct page *page;
+
+		if (pte_none(pteval) || pte_present(pteval) ||
+		    pte_to_swp_entry(pteval).val != entry.val ||
+		    !frontswap_test(si, start + i))
+			return false;
+		page = find_get_page(swap_address_space(entry), entry.val);
+		if (page) {
+			/* being read back already, leave it to do_swap_page() */
+			put_page(page);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Swap the aligned run of swap entries around @address back in as a THP,
+ * when reclaim stored it in frontswap as one run (see pageout_huge_run()).
+ * Like collapse_huge_page(), the page table is detached under the mmap_sem
+ * held for write, so nothing can fault or unmap through it while the run
+ * is loaded into the new huge page.
+ *
+ * Returns VM_FAULT_FALLBACK with the mmap_sem still held if the run can't
+ * be swapped in this way. Otherwise the mmap_sem has been dropped and
+ * VM_FAULT_RETRY is returned, with VM_FAULT_MAJOR if the THP got mapped;
+ * the retried fault has FAULT_FLAG_ALLOW_RETRY cleared and won't come back
+ * here.
+ */
+int do_huge_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		      unsigned long address, pmd_t *pmd, swp_entry_t entry,
+		      unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgoff_t idx = (address - haddr) >> PAGE_SHIFT;
+	pgoff_t start = swp_offset(entry) - idx;
+	int type = swp_type(entry);
+	struct mem_cgroup *memcg;
+	struct page *new_page;
+	spinlock_t *pmd_ptl, *pte_ptl;
+	pgtable_t pgtable;
+	pte_t *pte;
+	pmd_t _pmd;
+	gfp_t gfp;
+	bool ready;
+	int i;
+
+	if (!(flags & FAULT_FLAG_ALLOW_RETRY) ||
+	    (flags & FAULT_FLAG_RETRY_NOWAIT))
+		return VM_FAULT_FALLBACK;
+	if (swp_offset(entry) < idx || start % HPAGE_PMD_NR)
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end ||
+	    !hugepage_vma_check(vma))
+		return VM_FAULT_FALLBACK;
+
+	/* racy, but keeps runs that were not stored whole off the slow path */
+	pte = pte_offset_map(pmd, haddr);
+	ready = huge_swap_run_ready(pte, type, start);
+	pte_unmap(pte);
+	if (!ready)
+		return VM_FAULT_FALLBACK;
+
+	gfp = alloc_hugepage_gfpmask(transparent_hugepage_defrag(vma), 0);
+	new_page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
+	if (unlikely(!new_page))
+		return VM_FAULT_FALLBACK;
+	if (unlikely(mem_cgroup_try_charge(new_page, mm, gfp, &memcg))) {
+		put_page(new_page);
+		return VM_FAULT_FALLBACK;
+	}
+
+	up_read(&mm->mmap_sem);
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, haddr);
+	if (!vma || haddr < vma->vm_start ||
+	    haddr + HPAGE_PMD_SIZE > vma->vm_end || !hugepage_vma_check(vma))
+		goto out;
+	pmd = mm_find_pmd(mm, haddr);
+	if (!pmd)
+		goto out;
+
+	anon_vma_lock_write(vma->anon_vma);
+
+	pte = pte_offset_map(pmd, haddr);
+	pte_ptl = pte_lockptr(mm, pmd);
+
+	mmu_notifier_invalidate_range_start(mm, haddr, haddr + HPAGE_PMD_SIZE);
+	pmd_ptl = pmd_lock(mm, pmd);
+	_pmd = pmdp_collapse_flush(vma, haddr, pmd);
+	spin_unlock(pmd_ptl);
+	mmu_notifier_invalidate_range_end(mm, haddr, haddr + HPAGE_PMD_SIZE);
+
+	anon_vma_unlock_write(vma->anon_vma);
+
+	/*
+	 * With the ptes detached, reclaim can't turn a present pte into one
+	 * of these entries behind our back, so the frontswap copies stay the
+	 * latest ones for as long as no swap cache page exists for them.
+	 */
+	spin_lock(pte_ptl);
+	ready = huge_swap_run_ready(pte, type, start);
+	spin_unlock(pte_ptl);
+	if (!ready || frontswap_load_batch(swp_entry(type, start), new_page,
+					   HPAGE_PMD_NR)) {
+		pte_unmap(pte);
+		spin_lock(pmd_ptl);
+		BUG_ON(!pmd_none(*pmd));
+		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
+		spin_unlock(pmd_ptl);
+		goto out;
+	}
+
+	spin_lock(pte_ptl);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pte_clear(mm, haddr + i * PAGE_SIZE, pte + i);
+		swap_free(swp_entry(type, start + i));
+	}
+	spin_unlock(pte_ptl);
+	pte_unmap(pte);
+	add_mm_counter(mm, MM_SWAPENTS, -HPAGE_PMD_NR);
+	add_mm_counter(mm, MM_ANONPAGES, HPAGE_PMD_NR);
+
+	__SetPageUptodate(new_page);
+	pgtable = pmd_pgtable(_pmd);
+
+	_pmd = mk_huge_pmd(new_page, vma->vm_page_prot);
+	_pmd = maybe_pmd_mkwrite(pmd_mkdirty(_pmd), vma);
+
+	/* as in collapse_huge_page(), order the loaded data before the pmd */
+	smp_wmb();
+
+	spin_lock(pmd_ptl);
+	BUG_ON(!pmd_none(*pmd));
+	page_add_new_anon_rmap(new_page, vma, haddr);
+	mem_cgroup_commit_charge(new_page, memcg, false);
+	lru_cache_add_active_or_unevictable(new_page, vma);
+	pgtable_trans_huge_deposit(mm, pmd, pgtable);
+	set_pmd_at(mm, haddr, pmd, _pmd);
+	update_mmu_cache_pmd(vma, haddr, pmd);
+	spin_unlock(pmd_ptl);
+
+	count_vm_event(THP_SWPIN);
+	count_vm_event(PGMAJFAULT);
+	mem_cgroup_count_vm_event(mm, PGMAJFAULT);
+	up_write(&mm->mmap_sem);
+	return VM_FAULT_RETRY | VM_FAULT_MAJOR;
+
+out:
+	up_write(&mm->mmap_sem);
+	mem_cgroup_cancel_charge(new_page, memcg);
+	put_page(new_page);
+	return VM_FAULT_RETRY;
+}
+
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
@@ -37,6 +37,9 @@
 #include <linux/freezer.h>
 #include <linux/oom.h>
 #include <linux/numa.h>
+#include <linux/vmalloc.h>
+#include <linux/jump_label.h>
+#include <linux/crc32c.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -90,6 +93,13 @@
  *
  * If the merge_across_nodes tunable is unset, then KSM maintains multiple
  * stable trees and multiple unstable trees: one of each for each NUMA node.
+ *
+ * Each of those trees is further split into KSM_TREE_PARTS partitions, keyed
+ * by the page checksum (identical pages always hash alike), each partition
+ * serialized by its own mutex.  That lets several ksmd workers, each walking
+ * its own share of the mm_slots, search and merge concurrently; at the end
+ * of every full scan they meet so that the unstable trees are flushed while
+ * none of them is looking.
  */
 
 /**
@@ -98,12 +108,14 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @seq: registration number, deciding which ksmd worker scans this mm
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	unsigned int seq;
 };
 
 /**
@@ -111,15 +123,29 @@ struct mm_slot {
  * @mm_slot: the current mm_slot we are scanning
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * Each ksmd worker has its own instance of this cursor structure.
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
+};
+
+/**
+ * struct ksm_worker - one of the ksmd threads
+ * @task: the kthread, once started
+ * @scan: its scanning cursor, only ever stopping on mm_slots it owns
+ * @seqnr: the full scan it last started
+ * @waiting: finished with full scan @seqnr, waiting for the others
+ * @id: index into ksm_workers
+ */
+struct ksm_worker {
+	struct task_struct *task;
+	struct ksm_scan scan;
 	unsigned long seqnr;
+	bool waiting;
+	int id;
 };
 
 /**
@@ -129,6 +155,7 @@ struct ksm_scan {
  * @list: linked into migrate_nodes, pending placement in the proper node tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page (perhaps temporarily on wrong nid)
+ * @part: tree partition in which linked, fixed for the life of the node
  * @nid: NUMA node id of stable tree in which linked (may not match kpfn)
  */
 struct stable_node {
@@ -141,6 +168,7 @@ struct stable_node {
 	};
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	int part;
 #ifdef CONFIG_NUMA
 	int nid;
 #endif
@@ -154,6 +182,7 @@ struct stable_node {
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
  * @oldchecksum: previous checksum of the page at that virtual address
+ * @part: tree partition last linked into, or -1 if never linked
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -169,6 +198,7 @@ struct rmap_item {
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
 	unsigned int oldchecksum;	/* when unstable */
+	int part;			/* stable or unstable */
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -182,14 +212,20 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root one_stable_tree[1] = { RB_ROOT };
-static struct rb_root one_unstable_tree[1] = { RB_ROOT };
+/*
+ * The stable and unstable tree heads: KSM_TREE_PARTS of each per NUMA node,
+ * tree nid * KSM_TREE_PARTS + part being serialized by ksm_tree_locks[part].
+ */
+#define KSM_TREE_PARTS	32
+static struct rb_root one_stable_tree[KSM_TREE_PARTS];
+static struct rb_root one_unstable_tree[KSM_TREE_PARTS];
 static struct rb_root *root_stable_tree = one_stable_tree;
 static struct rb_root *root_unstable_tree = one_unstable_tree;
+static struct mutex ksm_tree_locks[KSM_TREE_PARTS];
 
 /* Recently migrated nodes of stable tree, pending proper placement */
 static LIST_HEAD(migrate_nodes);
+static DEFINE_SPINLOCK(ksm_migrate_lock);
 
 #define MM_SLOTS_HASH_BITS 10
 static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
@@ -197,25 +233,45 @@ static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 static struct mm_slot ksm_mm_head = {
 	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
 };
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+static unsigned int ksm_mm_slot_seq;
+
+#define KSM_MAX_WORKERS	16
+static struct ksm_worker ksm_workers[KSM_MAX_WORKERS];
+
+/* Workers taking part in the current full scan, and from the next one */
+static unsigned int ksm_nr_workers = 1;
+static unsigned int ksm_nr_workers_wanted = 1;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
+
+/* Workers which have finished the current full scan */
+static unsigned int ksm_workers_done;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
 
 /* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
+static atomic_long_t ksm_pages_shared;
 
 /* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
+static atomic_long_t ksm_pages_sharing;
 
 /* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
+static atomic_long_t ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items;
+
+/* The number of zero-filled pages replaced by the zero page so far */
+static atomic_long_t ksm_pages_zero;
+
+/* Map unchanging zero-filled pages to the zero page, not via stable tree */
+static bool ksm_use_zero_pages __read_mostly = true;
+
+/* Checksum of a zero-filled page, with whichever checksum is in use */
+static u32 zero_checksum __read_mostly;
 
 /* Number of pages ksmd should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
@@ -237,11 +293,18 @@ static int ksm_nr_node_ids = 1;
 #define KSM_RUN_UNMERGE	2
 #define KSM_RUN_OFFLINE	4
 static unsigned long ksm_run = KSM_RUN_STOP;
-static void wait_while_offlining(void);
+static void wait_while_offlining(bool write);
 
+/*
+ * ksmd workers scan holding ksm_thread_sem for read, and serialize among
+ * themselves with ksm_tree_locks; the sysfs knobs and memory hotremove take
+ * it for write to get the trees and the cursors to themselves.
+ */
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+static DECLARE_RWSEM(ksm_thread_sem);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
+static DEFINE_SPINLOCK(ksm_pass_lock);
+static DEFINE_MUTEX(ksm_workers_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
 		sizeof(struct __struct), __alignof__(struct __struct),\
@@ -284,14 +347,16 @@ static inline struct rmap_item *alloc_rmap_item(void)
 	struct rmap_item *rmap_item;
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
-	if (rmap_item)
-		ksm_rmap_items++;
+	if (rmap_item) {
+		rmap_item->part = -1;
+		atomic_long_inc(&ksm_rmap_items);
+	}
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -493,25 +558,47 @@ static inline int get_kpfn_nid(unsigned long kpfn)
 	return ksm_merge_across_nodes ? 0 : NUMA(pfn_to_nid(kpfn));
 }
 
+static inline int ksm_tree_part(u32 checksum)
+{
+	return checksum % KSM_TREE_PARTS;
+}
+
+static inline int ksm_nr_trees(void)
+{
+	return ksm_nr_node_ids * KSM_TREE_PARTS;
+}
+
+static inline struct rb_root *stable_root(int nid, int part)
+{
+	return root_stable_tree + nid * KSM_TREE_PARTS + part;
+}
+
+static inline struct rb_root *unstable_root(int nid, int part)
+{
+	return root_unstable_tree + nid * KSM_TREE_PARTS + part;
+}
+
 static void remove_node_from_stable_tree(struct stable_node *stable_node)
 {
 	struct rmap_item *rmap_item;
 
 	hlist_for_each_entry(rmap_item, &stable_node->hlist, hlist) {
 		if (rmap_item->hlist.next)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
 	}
 
-	if (stable_node->head == &migrate_nodes)
+	if (stable_node->head == &migrate_nodes) {
+		spin_lock(&ksm_migrate_lock);
 		list_del(&stable_node->list);
-	else
-		rb_erase(&stable_node->node,
-			 root_stable_tree + NUMA(stable_node->nid));
+		spin_unlock(&ksm_migrate_lock);
+	} else
+		rb_erase(&stable_node->node, stable_root(NUMA(stable_node->nid),
+							 stable_node->part));
 	free_stable_node(stable_node);
 }
 
@@ -610,8 +697,9 @@ stale:
 /*
  * Removing rmap_item from stable or unstable tree.
  * This function will clean the information from the stable/unstable tree.
+ * The caller holds the ksm_tree_locks of the rmap_item's partition.
  */
-static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+static void __remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
 	if (rmap_item->address & STABLE_FLAG) {
 		struct stable_node *stable_node;
@@ -627,9 +715,9 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		put_page(page);
 
 		if (!hlist_empty(&stable_node->hlist))
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
@@ -643,18 +731,37 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
 			rb_erase(&rmap_item->node,
-				 root_unstable_tree + NUMA(rmap_item->nid));
-		ksm_pages_unshared--;
+				 unstable_root(NUMA(rmap_item->nid),
+					       rmap_item->part));
+		atomic_long_dec(&ksm_pages_unshared);
 		rmap_item->address &= PAGE_MASK;
 	}
 out:
 	cond_resched();		/* we're called from many long loops */
 }
 
+/*
+ * Only the worker owning an rmap_item changes its partition, but another
+ * worker may be moving it from unstable to stable tree meanwhile: so its
+ * flags can only be trusted under the lock of the partition it was last in.
+ */
+static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+{
+	int part = rmap_item->part;
+
+	if (part < 0) {
+		cond_resched();
+		return;
+	}
+	mutex_lock(&ksm_tree_locks[part]);
+	__remove_rmap_item_from_tree(rmap_item);
+	mutex_unlock(&ksm_tree_locks[part]);
+}
+
 static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
 				       struct rmap_item **rmap_list)
 {
@@ -742,16 +849,16 @@ static int remove_all_stable_nodes(void)
 {
 	struct stable_node *stable_node;
 	struct list_head *this, *next;
-	int nid;
+	int i;
 	int err = 0;
 
-	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
-		while (root_stable_tree[nid].rb_node) {
-			stable_node = rb_entry(root_stable_tree[nid].rb_node,
+	for (i = 0; i < ksm_nr_trees(); i++) {
+		while (root_stable_tree[i].rb_node) {
+			stable_node = rb_entry(root_stable_tree[i].rb_node,
 						struct stable_node, node);
 			if (remove_stable_node(stable_node)) {
 				err = -EBUSY;
-				break;	/* proceed to next nid */
+				break;	/* proceed to next tree */
 			}
 			cond_resched();
 		}
@@ -765,20 +872,43 @@ static int remove_all_stable_nodes(void)
 	return err;
 }
 
+/*
+ * Called with ksm_thread_sem held for write: send every worker back to the
+ * head of the list, to start the current full scan over again when resumed.
+ */
+static void ksm_reset_workers(void)
+{
+	int i;
+
+	spin_lock(&ksm_mmlist_lock);
+	for (i = 0; i < KSM_MAX_WORKERS; i++) {
+		ksm_workers[i].scan.mm_slot = &ksm_mm_head;
+		ksm_workers[i].waiting = false;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+
+	spin_lock(&ksm_pass_lock);
+	ksm_workers_done = 0;
+	spin_unlock(&ksm_pass_lock);
+}
+
 static int unmerge_and_remove_all_rmap_items(void)
 {
+	struct ksm_scan *scan = &ksm_workers[0].scan;
 	struct mm_slot *mm_slot;
 	struct mm_struct *mm;
 	struct vm_area_struct *vma;
 	int err = 0;
 
+	ksm_reset_workers();
+
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	scan->mm_slot = list_entry(ksm_mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = scan->mm_slot;
+			mm_slot != &ksm_mm_head; mm_slot = scan->mm_slot) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -795,7 +925,7 @@ static int unmerge_and_remove_all_rmap_items(void)
 		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		scan->mm_slot = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hash_del(&mm_slot->link);
@@ -814,27 +944,73 @@ static int unmerge_and_remove_all_rmap_items(void)
 
 	/* Clean up stable nodes, but don't worry if some are still busy */
 	remove_all_stable_nodes();
-	ksm_scan.seqnr = 0;
+	spin_lock(&ksm_pass_lock);
+	ksm_seqnr = 0;
+	spin_unlock(&ksm_pass_lock);
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	scan->mm_slot = &ksm_mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
 #endif /* CONFIG_SYSFS */
 
+/*
+ * The page checksum is jhash2 unless libcrc32c's crc32c() goes through an
+ * accelerated driver (crc32c-intel's SSE4.2 crc32 instruction, or the like).
+ * libcrc32c picks its driver once, when it is initialized, before this
+ * late_initcall; a faster driver registering later does not change what
+ * crc32c() uses, so neither does it change the static key decided here.
+ */
+static DEFINE_STATIC_KEY_FALSE(ksm_use_crc32c);
+
 static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	if (static_branch_unlikely(&ksm_use_crc32c))
+		checksum = crc32c(~0, addr, PAGE_SIZE);
+	else
+		checksum = jhash2(addr, PAGE_SIZE / 4, 17);
 	kunmap_atomic(addr);
 	return checksum;
 }
 
+static int __init ksm_checksum_init(void)
+{
+	const char *driver = crc32c_impl();
+
+	if (!strcmp(driver, "crc32c-generic"))
+		return 0;
+	pr_info("ksm: using %s for page checksums\n", driver);
+
+	static_branch_enable(&ksm_use_crc32c);
+	zero_checksum = calc_checksum(ZERO_PAGE(0));
+	return 0;
+}
+late_initcall(ksm_checksum_init);
+
+/*
+ * Compare a word at a time, four words to a step, and only hand the first
+ * differing step to memcmp(): which keeps memcmp()'s ordering, but avoids
+ * its byte at a time loop over the usually identical leading part of pages.
+ */
+static int memcmp_page(const void *p1, const void *p2)
+{
+	const unsigned long *a = p1, *b = p2;
+	unsigned int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(unsigned long); i += 4) {
+		if ((a[i] ^ b[i]) | (a[i + 1] ^ b[i + 1]) |
+		    (a[i + 2] ^ b[i + 2]) | (a[i + 3] ^ b[i + 3]))
+			return memcmp(a + i, b + i, 4 * sizeof(unsigned long));
+	}
+	return 0;
+}
+
 static int memcmp_pages(struct page *page1, struct page *page2)
 {
 	char *addr1, *addr2;
@@ -842,7 +1018,7 @@ static int memcmp_pages(struct page *page1, struct page *page2)
 
 	addr1 = kmap_atomic(page1);
 	addr2 = kmap_atomic(page2);
-	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	ret = memcmp_page(addr1, addr2);
 	kunmap_atomic(addr2);
 	kunmap_atomic(addr1);
 	return ret;
@@ -933,6 +1109,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 	struct mm_struct *mm = vma->vm_mm;
 	pmd_t *pmd;
 	pte_t *ptep;
+	pte_t newpte;
 	spinlock_t *ptl;
 	unsigned long addr;
 	int err = -EFAULT;
@@ -957,12 +1134,23 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 		goto out_mn;
 	}
 
-	get_page(kpage);
-	page_add_anon_rmap(kpage, vma, addr);
+	if (!is_zero_pfn(page_to_pfn(kpage))) {
+		get_page(kpage);
+		page_add_anon_rmap(kpage, vma, addr);
+		newpte = mk_pte(kpage, vma->vm_page_prot);
+	} else {
+		/*
+		 * Like do_anonymous_page()'s read fault: a special pte,
+		 * counted neither in the zero page nor in MM_ANONPAGES.
+		 */
+		newpte = pte_mkspecial(pfn_pte(page_to_pfn(kpage),
+					       vma->vm_page_prot));
+		dec_mm_counter(mm, MM_ANONPAGES);
+	}
 
 	flush_cache_page(vma, addr, pte_pfn(*ptep));
 	ptep_clear_flush_notify(vma, addr, ptep);
-	set_pte_at_notify(mm, addr, ptep, mk_pte(kpage, vma->vm_page_prot));
+	set_pte_at_notify(mm, addr, ptep, newpte);
 
 	page_remove_rmap(page);
 	if (!page_mapped(page))
@@ -1094,8 +1282,11 @@ static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
 	if (err)
 		goto out;
 
-	/* Unstable nid is in union with stable anon_vma: remove first */
-	remove_rmap_item_from_tree(rmap_item);
+	/*
+	 * Unstable nid is in union with stable anon_vma: remove first.
+	 * Our caller holds the tree lock of the partition being merged.
+	 */
+	__remove_rmap_item_from_tree(rmap_item);
 
 	/* Must get reference to anon_vma while still holding mmap_sem */
 	rmap_item->anon_vma = vma->anon_vma;
@@ -1143,9 +1334,9 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * with identical content to the page that we are scanning right now.
  *
  * This function returns the stable tree node of identical content if found,
- * NULL otherwise.
+ * NULL otherwise.  The caller holds ksm_tree_locks[part].
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page, int part)
 {
 	int nid;
 	struct rb_root *root;
@@ -1154,7 +1345,14 @@ static struct page *stable_tree_search(struct page *page)
 	struct stable_node *stable_node;
 	struct stable_node *page_node;
 
+	lock_page(page);
 	page_node = page_stable_node(page);
+	if (page_node && page_node->part != part) {
+		/* merged by another worker since we chose the partition */
+		unlock_page(page);
+		return NULL;
+	}
+	unlock_page(page);
 	if (page_node && page_node->head != &migrate_nodes) {
 		/* ksm page forked */
 		get_page(page);
@@ -1162,7 +1360,7 @@ static struct page *stable_tree_search(struct page *page)
 	}
 
 	nid = get_kpfn_nid(page_to_pfn(page));
-	root = root_stable_tree + nid;
+	root = stable_root(nid, part);
 again:
 	new = &root->rb_node;
 	parent = NULL;
@@ -1226,7 +1424,9 @@ again:
 	if (!page_node)
 		return NULL;
 
+	spin_lock(&ksm_migrate_lock);
 	list_del(&page_node->list);
+	spin_unlock(&ksm_migrate_lock);
 	DO_NUMA(page_node->nid = nid);
 	rb_link_node(&page_node->node, parent, new);
 	rb_insert_color(&page_node->node, root);
@@ -1234,6 +1434,7 @@ again:
 	return page;
 
 replace:
+	spin_lock(&ksm_migrate_lock);
 	if (page_node) {
 		list_del(&page_node->list);
 		DO_NUMA(page_node->nid = nid);
@@ -1245,6 +1446,7 @@ replace:
 	}
 	stable_node->head = &migrate_nodes;
 	list_add(&stable_node->list, stable_node->head);
+	spin_unlock(&ksm_migrate_lock);
 	return page;
 }
 
@@ -1253,9 +1455,9 @@ replace:
  * into the stable tree.
  *
  * This function returns the stable tree node just allocated on success,
- * NULL otherwise.
+ * NULL otherwise.  The caller holds ksm_tree_locks[part].
  */
-static struct stable_node *stable_tree_insert(struct page *kpage)
+static struct stable_node *stable_tree_insert(struct page *kpage, int part)
 {
 	int nid;
 	unsigned long kpfn;
@@ -1266,7 +1468,7 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 	kpfn = page_to_pfn(kpage);
 	nid = get_kpfn_nid(kpfn);
-	root = root_stable_tree + nid;
+	root = stable_root(nid, part);
 again:
 	parent = NULL;
 	new = &root->rb_node;
@@ -1315,6 +1517,7 @@ again:
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 	stable_node->kpfn = kpfn;
+	stable_node->part = part;
 	set_page_stable_node(kpage, stable_node);
 	DO_NUMA(stable_node->nid = nid);
 	rb_link_node(&stable_node->node, parent, new);
@@ -1335,12 +1538,14 @@ again:
  * to the currently scanned page, NULL otherwise.
  *
  * This function does both searching and inserting, because they share
- * the same walking algorithm in an rbtree.
+ * the same walking algorithm in an rbtree.  The caller holds
+ * ksm_tree_locks[part].
  */
 static
 struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 					      struct page *page,
-					      struct page **tree_pagep)
+					      struct page **tree_pagep,
+					      int part)
 {
 	struct rb_node **new;
 	struct rb_root *root;
@@ -1348,7 +1553,7 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	int nid;
 
 	nid = get_kpfn_nid(page_to_pfn(page));
-	root = root_unstable_tree + nid;
+	root = unstable_root(nid, part);
 	new = &root->rb_node;
 
 	while (*new) {
@@ -1395,12 +1600,13 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
+	rmap_item->part = part;
 	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
 	rb_insert_color(&rmap_item->node, root);
 
-	ksm_pages_unshared++;
+	atomic_long_inc(&ksm_pages_unshared);
 	return NULL;
 }
 
@@ -1414,12 +1620,48 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 {
 	rmap_item->head = stable_node;
 	rmap_item->address |= STABLE_FLAG;
+	rmap_item->part = stable_node->part;
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
-		ksm_pages_sharing++;
+		atomic_long_inc(&ksm_pages_sharing);
 	else
-		ksm_pages_shared++;
+		atomic_long_inc(&ksm_pages_shared);
+}
+
+static bool page_zero_filled(struct page *page)
+{
+	void *addr = kmap_atomic(page);
+	bool zero = !memchr_inv(addr, 0, PAGE_SIZE);
+
+	kunmap_atomic(addr);
+	return zero;
+}
+
+/*
+ * try_to_merge_zero_page - replace a zero-filled page by the zero page,
+ * without involving the stable tree at all.
+ *
+ * This function returns 0 if the page was replaced, -EFAULT otherwise.
+ */
+static int try_to_merge_zero_page(struct rmap_item *rmap_item,
+				  struct page *page)
+{
+	struct mm_struct *mm = rmap_item->mm;
+	struct vm_area_struct *vma;
+	int err = -EFAULT;
+
+	down_read(&mm->mmap_sem);
+	vma = find_mergeable_vma(mm, rmap_item->address);
+	/* mlock would want the page itself kept resident */
+	if (vma && !(vma->vm_flags & VM_LOCKED))
+		err = try_to_merge_one_page(vma, page,
+					    ZERO_PAGE(rmap_item->address));
+	up_read(&mm->mmap_sem);
+
+	if (!err)
+		atomic_long_inc(&ksm_pages_zero);
+	return err;
 }
 
 /*
@@ -1437,31 +1679,78 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
 	struct page *kpage;
-	unsigned int checksum;
+	unsigned int checksum = 0;
+	bool moved;
+	int part;
 	int err;
 
+	/*
+	 * Identical pages must meet in the same partition: a ksm page stays
+	 * in the partition of its stable_node, any other page goes by its
+	 * checksum.  Other workers may free stable_nodes of other partitions
+	 * at any moment, but not while the page is locked and still points
+	 * to its node: read the partition under the page lock, and check
+	 * again under it once the partition is locked.
+	 */
+	lock_page(page);
 	stable_node = page_stable_node(page);
+	if (stable_node)
+		part = stable_node->part;
+	unlock_page(page);
+
+	/*
+	 * Zero-filled pages are so common in guests that they are worth
+	 * a cheap test before the checksum: once one has stayed zero for a
+	 * full scan, just map the zero page in its place.
+	 */
+	if (!stable_node && ksm_use_zero_pages && page_zero_filled(page)) {
+		remove_rmap_item_from_tree(rmap_item);
+		if (rmap_item->oldchecksum != zero_checksum)
+			rmap_item->oldchecksum = zero_checksum;
+		else
+			try_to_merge_zero_page(rmap_item, page);
+		return;
+	}
+
+	if (!stable_node) {
+		checksum = calc_checksum(page);
+		part = ksm_tree_part(checksum);
+	}
+
+	if (rmap_item->part >= 0 && rmap_item->part != part)
+		remove_rmap_item_from_tree(rmap_item);
+
+	mutex_lock(&ksm_tree_locks[part]);
+	lock_page(page);
+	moved = page_stable_node(page) != stable_node ||
+		(stable_node && stable_node->part != part);
+	unlock_page(page);
+	if (moved)
+		goto out;	/* merged or migrated meanwhile: try next scan */
+
 	if (stable_node) {
 		if (stable_node->head != &migrate_nodes &&
 		    get_kpfn_nid(stable_node->kpfn) != NUMA(stable_node->nid)) {
 			rb_erase(&stable_node->node,
-				 root_stable_tree + NUMA(stable_node->nid));
+				 stable_root(NUMA(stable_node->nid), part));
 			stable_node->head = &migrate_nodes;
+			spin_lock(&ksm_migrate_lock);
 			list_add(&stable_node->list, stable_node->head);
+			spin_unlock(&ksm_migrate_lock);
 		}
 		if (stable_node->head != &migrate_nodes &&
 		    rmap_item->head == stable_node)
-			return;
+			goto out;
 	}
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
+	kpage = stable_tree_search(page, part);
 	if (kpage == page && rmap_item->head == stable_node) {
 		put_page(kpage);
-		return;
+		goto out;
 	}
 
-	remove_rmap_item_from_tree(rmap_item);
+	__remove_rmap_item_from_tree(rmap_item);
 
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
@@ -1475,23 +1764,31 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			unlock_page(kpage);
 		}
 		put_page(kpage);
-		return;
+		goto out;
 	}
 
+	/*
+	 * Another worker made this a ksm page of some other partition after
+	 * we chose ours: leave it alone until the next scan comes around.
+	 */
+	if (PageKsm(page) && !stable_node)
+		goto out;
+
 	/*
 	 * If the hash value of the page has changed from the last time
 	 * we calculated it, this page is changing frequently: therefore we
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
+	if (stable_node)
+		checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
-		return;
+		goto out;
 	}
 
 	tree_rmap_item =
-		unstable_tree_search_insert(rmap_item, page, &tree_page);
+		unstable_tree_search_insert(rmap_item, page, &tree_page, part);
 	if (tree_rmap_item) {
 		kpage = try_to_merge_two_pages(rmap_item, page,
 						tree_rmap_item, tree_page);
@@ -1502,7 +1799,7 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			 * node in the stable tree and add both rmap_items.
 			 */
 			lock_page(kpage);
-			stable_node = stable_tree_insert(kpage);
+			stable_node = stable_tree_insert(kpage, part);
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
@@ -1521,6 +1818,8 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			}
 		}
 	}
+out:
+	mutex_unlock(&ksm_tree_locks[part]);
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
@@ -1551,68 +1850,141 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+static inline bool ksm_owns_slot(struct ksm_worker *worker,
+				 struct mm_slot *slot)
 {
+	return slot->seq % ksm_nr_workers == worker->id;
+}
+
+/*
+ * Advance to the next mm_slot on the list belonging to this worker, or to
+ * ksm_mm_head at the end of the list.  Called under ksm_mmlist_lock.
+ */
+static struct mm_slot *ksm_next_slot(struct ksm_worker *worker,
+				     struct mm_slot *slot)
+{
+	do {
+		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
+	} while (slot != &ksm_mm_head && !ksm_owns_slot(worker, slot));
+	return slot;
+}
+
+/*
+ * Start a full scan, unless this worker has already finished the current
+ * one and is waiting for the others to catch up.
+ */
+static bool ksm_begin_scan(struct ksm_worker *worker)
+{
+	bool begin = true;
+
+	spin_lock(&ksm_pass_lock);
+	if (worker->waiting && worker->seqnr == ksm_seqnr)
+		begin = false;
+	else {
+		worker->waiting = false;
+		worker->seqnr = ksm_seqnr;
+	}
+	spin_unlock(&ksm_pass_lock);
+	return begin;
+}
+
+/*
+ * This worker has come to the end of the list.  The last of the workers to
+ * get here does what used to be done at the start of each full scan, while
+ * the rest keep away from the trees; then lets them all go round again.
+ */
+static void ksm_end_scan(struct ksm_worker *worker)
+{
+	struct stable_node *stable_node;
+	struct list_head *this, *next;
+	struct page *page;
+	bool last;
+	int i;
+
+	spin_lock(&ksm_pass_lock);
+	worker->waiting = true;
+	last = ++ksm_workers_done >= ksm_nr_workers;
+	spin_unlock(&ksm_pass_lock);
+	if (!last)
+		return;
+
+	/*
+	 * A number of pages can hang around indefinitely on per-cpu
+	 * pagevecs, raised page count preventing write_protect_page
+	 * from merging them.  Though it doesn't really matter much,
+	 * it is puzzling to see some stuck in pages_volatile until
+	 * other activity jostles them out, and they also prevented
+	 * LTP's KSM test from succeeding deterministically; so drain
+	 * them here (here rather than on entry to ksm_do_scan(),
+	 * so we don't IPI too often when pages_to_scan is set low).
+	 */
+	lru_add_drain_all();
+
+	/*
+	 * Whereas stale stable_nodes on the stable_tree itself
+	 * get pruned in the regular course of stable_tree_search(),
+	 * those moved out to the migrate_nodes list can accumulate:
+	 * so prune them once before each full scan.
+	 */
+	if (!ksm_merge_across_nodes) {
+		list_for_each_safe(this, next, &migrate_nodes) {
+			stable_node = list_entry(this,
+					struct stable_node, list);
+			page = get_ksm_page(stable_node, false);
+			if (page)
+				put_page(page);
+			cond_resched();
+		}
+	}
+
+	for (i = 0; i < ksm_nr_trees(); i++)
+		root_unstable_tree[i] = RB_ROOT;
+
+	spin_lock(&ksm_pass_lock);
+	ksm_seqnr++;
+	ksm_workers_done = 0;
+	ksm_nr_workers = ksm_nr_workers_wanted;
+	spin_unlock(&ksm_pass_lock);
+
+	for (i = 0; i < ksm_nr_workers; i++)
+		if (ksm_workers[i].task && i != worker->id)
+			wake_up_process(ksm_workers[i].task);
+	wake_up_interruptible(&ksm_thread_wait);
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_worker *worker,
+						 struct page **page)
+{
+	struct ksm_scan *scan = &worker->scan;
 	struct mm_struct *mm;
 	struct mm_slot *slot;
 	struct vm_area_struct *vma;
 	struct rmap_item *rmap_item;
-	int nid;
 
 	if (list_empty(&ksm_mm_head.mm_list))
 		return NULL;
 
-	slot = ksm_scan.mm_slot;
+	slot = scan->mm_slot;
 	if (slot == &ksm_mm_head) {
-		/*
-		 * A number of pages can hang around indefinitely on per-cpu
-		 * pagevecs, raised page count preventing write_protect_page
-		 * from merging them.  Though it doesn't really matter much,
-		 * it is puzzling to see some stuck in pages_volatile until
-		 * other activity jostles them out, and they also prevented
-		 * LTP's KSM test from succeeding deterministically; so drain
-		 * them here (here rather than on entry to ksm_do_scan(),
-		 * so we don't IPI too often when pages_to_scan is set low).
-		 */
-		lru_add_drain_all();
-
-		/*
-		 * Whereas stale stable_nodes on the stable_tree itself
-		 * get pruned in the regular course of stable_tree_search(),
-		 * those moved out to the migrate_nodes list can accumulate:
-		 * so prune them once before each full scan.
-		 */
-		if (!ksm_merge_across_nodes) {
-			struct stable_node *stable_node;
-			struct list_head *this, *next;
-			struct page *page;
-
-			list_for_each_safe(this, next, &migrate_nodes) {
-				stable_node = list_entry(this,
-						struct stable_node, list);
-				page = get_ksm_page(stable_node, false);
-				if (page)
-					put_page(page);
-				cond_resched();
-			}
-		}
-
-		for (nid = 0; nid < ksm_nr_node_ids; nid++)
-			root_unstable_tree[nid] = RB_ROOT;
+		if (!ksm_begin_scan(worker))
+			return NULL;
 
 		spin_lock(&ksm_mmlist_lock);
-		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+		slot = ksm_next_slot(worker, slot);
+		scan->mm_slot = slot;
 		spin_unlock(&ksm_mmlist_lock);
 		/*
 		 * Although we tested list_empty() above, a racing __ksm_exit
-		 * of the last mm on the list may have removed it since then.
+		 * of the last mm on the list may have removed it since then;
+		 * or there may be none of its mms for this worker to scan.
 		 */
-		if (slot == &ksm_mm_head)
+		if (slot == &ksm_mm_head) {
+			ksm_end_scan(worker);
 			return NULL;
+		}
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1620,60 +1992,59 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+					scan->rmap_list, scan->address);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	remove_trailing_rmap_items(slot, scan->rmap_list);
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
-						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	scan->mm_slot = ksm_next_slot(worker, slot);
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1697,26 +2068,27 @@ next_mm:
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
+	slot = scan->mm_slot;
 	if (slot != &ksm_mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
+	ksm_end_scan(worker);
 	return NULL;
 }
 
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @worker - the ksmd worker doing the scan.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_worker *worker, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(worker, &page);
 		if (!rmap_item)
 			return;
 		cmp_and_merge_page(page, rmap_item);
@@ -1724,36 +2096,65 @@ static void ksm_do_scan(unsigned int scan_npages)
 	}
 }
 
-static int ksmd_should_run(void)
+static int ksmd_should_run(struct ksm_worker *worker)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) && worker->id < ksm_nr_workers &&
+		!list_empty(&ksm_mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_worker *worker = data;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		down_read(&ksm_thread_sem);
+		wait_while_offlining(false);
+		if (ksmd_should_run(worker))
+			ksm_do_scan(worker, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
-		if (ksmd_should_run()) {
+		if (ksmd_should_run(worker)) {
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
-				ksmd_should_run() || kthread_should_stop());
+				ksmd_should_run(worker) ||
+				kthread_should_stop());
 		}
 	}
 	return 0;
 }
 
+/*
+ * Start the threads for workers up to nr, called under ksm_workers_lock.
+ * The first is plain "ksmd" as it always was.
+ */
+static int ksm_start_workers(unsigned int nr)
+{
+	struct task_struct *task;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		if (ksm_workers[i].task)
+			continue;
+		if (i)
+			task = kthread_run(ksm_scan_thread, &ksm_workers[i],
+					   "ksmd/%u", i);
+		else
+			task = kthread_run(ksm_scan_thread, &ksm_workers[i],
+					   "ksmd");
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+		ksm_workers[i].task = task;
+	}
+	return 0;
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1803,6 +2204,7 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 
 int __ksm_enter(struct mm_struct *mm)
 {
+	struct ksm_worker *worker;
 	struct mm_slot *mm_slot;
 	int needs_wakeup;
 
@@ -1815,10 +2217,12 @@ int __ksm_enter(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
+	mm_slot->seq = ksm_mm_slot_seq++;
+	worker = &ksm_workers[mm_slot->seq % ksm_nr_workers];
 	/*
-	 * When KSM_RUN_MERGE (or KSM_RUN_STOP),
-	 * insert just behind the scanning cursor, to let the area settle
-	 * down a little; when fork is followed by immediate exec, we don't
+	 * When KSM_RUN_MERGE (or KSM_RUN_STOP), insert just behind
+	 * its worker's scanning cursor, to let the area settle down
+	 * a little; when fork is followed by immediate exec, we don't
 	 * want ksmd to waste time setting up and tearing down an rmap_list.
 	 *
 	 * But when KSM_RUN_UNMERGE, it's important to insert ahead of its
@@ -1828,7 +2232,7 @@ int __ksm_enter(struct mm_struct *mm)
 	if (ksm_run & KSM_RUN_UNMERGE)
 		list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
 	else
-		list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+		list_add_tail(&mm_slot->mm_list, &worker->scan.mm_slot->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1840,15 +2244,27 @@ int __ksm_enter(struct mm_struct *mm)
 	return 0;
 }
 
+/* Called under ksm_mmlist_lock */
+static bool ksm_slot_at_cursor(struct mm_slot *mm_slot)
+{
+	int i;
+
+	for (i = 0; i < KSM_MAX_WORKERS; i++)
+		if (ksm_workers[i].scan.mm_slot == mm_slot)
+			return true;
+	return false;
+}
+
 void __ksm_exit(struct mm_struct *mm)
 {
+	struct ksm_worker *worker;
 	struct mm_slot *mm_slot;
 	int easy_to_free = 0;
 
 	/*
 	 * This process is exiting: if it's straightforward (as is the
 	 * case when ksmd was never running), free mm_slot immediately.
-	 * But if it's at the cursor or has rmap_items linked to it, use
+	 * But if it's at a cursor or has rmap_items linked to it, use
 	 * mmap_sem to synchronize with any break_cows before pagetables
 	 * are freed, and leave the mm_slot on the list for ksmd to free.
 	 * Beware: ksm may already have noticed it exiting and freed the slot.
@@ -1856,14 +2272,15 @@ void __ksm_exit(struct mm_struct *mm)
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && !ksm_slot_at_cursor(mm_slot)) {
 		if (!mm_slot->rmap_list) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
 			easy_to_free = 1;
 		} else {
+			worker = &ksm_workers[mm_slot->seq % ksm_nr_workers];
 			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+				  &worker->scan.mm_slot->mm_list);
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -1999,13 +2416,19 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 #endif /* CONFIG_MIGRATION */
 
 #ifdef CONFIG_MEMORY_HOTREMOVE
-static void wait_while_offlining(void)
+static void wait_while_offlining(bool write)
 {
 	while (ksm_run & KSM_RUN_OFFLINE) {
-		mutex_unlock(&ksm_thread_mutex);
+		if (write)
+			up_write(&ksm_thread_sem);
+		else
+			up_read(&ksm_thread_sem);
 		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
 			    TASK_UNINTERRUPTIBLE);
-		mutex_lock(&ksm_thread_mutex);
+		if (write)
+			down_write(&ksm_thread_sem);
+		else
+			down_read(&ksm_thread_sem);
 	}
 }
 
@@ -2015,10 +2438,10 @@ static void ksm_check_stable_tree(unsigned long start_pfn,
 	struct stable_node *stable_node;
 	struct list_head *this, *next;
 	struct rb_node *node;
-	int nid;
+	int i;
 
-	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
-		node = rb_first(root_stable_tree + nid);
+	for (i = 0; i < ksm_nr_trees(); i++) {
+		node = rb_first(root_stable_tree + i);
 		while (node) {
 			stable_node = rb_entry(node, struct stable_node, node);
 			if (stable_node->kpfn >= start_pfn &&
@@ -2028,7 +2451,7 @@ static void ksm_check_stable_tree(unsigned long start_pfn,
 				 * which is why we keep kpfn instead of page*
 				 */
 				remove_node_from_stable_tree(stable_node);
-				node = rb_first(root_stable_tree + nid);
+				node = rb_first(root_stable_tree + i);
 			} else
 				node = rb_next(node);
 			cond_resched();
@@ -2055,11 +2478,11 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * and remove_all_stable_nodes() while memory is going offline:
 		 * it is unsafe for them to touch the stable tree at this time.
 		 * But unmerge_ksm_pages(), rmap lookups and other entry points
-		 * which do not need the ksm_thread_mutex are all safe.
+		 * which do not need the ksm_thread_sem are all safe.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run |= KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
@@ -2075,9 +2498,9 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run &= ~KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 
 		smp_mb();	/* wake_up_bit advises this */
 		wake_up_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE));
@@ -2086,7 +2509,7 @@ static int ksm_memory_callback(struct notifier_block *self,
 	return NOTIFY_OK;
 }
 #else
-static void wait_while_offlining(void)
+static void wait_while_offlining(bool write)
 {
 }
 #endif /* CONFIG_MEMORY_HOTREMOVE */
@@ -2173,8 +2596,8 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
-	wait_while_offlining();
+	down_write(&ksm_thread_sem);
+	wait_while_offlining(true);
 	if (ksm_run != flags) {
 		ksm_run = flags;
 		if (flags & KSM_RUN_UNMERGE) {
@@ -2187,7 +2610,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -2216,10 +2639,11 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 	if (knob > 1)
 		return -EINVAL;
 
-	mutex_lock(&ksm_thread_mutex);
-	wait_while_offlining();
+	down_write(&ksm_thread_sem);
+	wait_while_offlining(true);
 	if (ksm_merge_across_nodes != knob) {
-		if (ksm_pages_shared || remove_all_stable_nodes())
+		if (atomic_long_read(&ksm_pages_shared) ||
+		    remove_all_stable_nodes())
 			err = -EBUSY;
 		else if (root_stable_tree == one_stable_tree) {
 			struct rb_root *buf;
@@ -2228,18 +2652,22 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			 * default of merging across nodes: must now allocate
 			 * a buffer to hold as many roots as may be needed.
 			 * Allocate stable and unstable together:
-			 * MAXSMP NODES_SHIFT 10 will use 16kB.
+			 * MAXSMP NODES_SHIFT 10 will use 512kB.
 			 */
-			buf = kcalloc(nr_node_ids + nr_node_ids, sizeof(*buf),
-				      GFP_KERNEL);
+			int nr = nr_node_ids * KSM_TREE_PARTS;
+			int i;
+
+			buf = vzalloc(2 * nr * sizeof(*buf));
 			/* Let us assume that RB_ROOT is NULL is zero */
 			if (!buf)
 				err = -ENOMEM;
 			else {
 				root_stable_tree = buf;
-				root_unstable_tree = buf + nr_node_ids;
+				root_unstable_tree = buf + nr;
 				/* Stable tree is empty but not the unstable */
-				root_unstable_tree[0] = one_unstable_tree[0];
+				for (i = 0; i < KSM_TREE_PARTS; i++)
+					root_unstable_tree[i] =
+						one_unstable_tree[i];
 			}
 		}
 		if (!err) {
@@ -2247,7 +2675,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -2257,21 +2685,21 @@ KSM_ATTR(merge_across_nodes);
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_shared));
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_sharing));
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_unshared));
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -2280,8 +2708,10 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- atomic_long_read(&ksm_pages_shared)
+				- atomic_long_read(&ksm_pages_sharing)
+				- atomic_long_read(&ksm_pages_unshared);
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -2295,10 +2725,76 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t use_zero_pages_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_use_zero_pages);
+}
+
+static ssize_t use_zero_pages_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	bool value;
+	int err;
+
+	err = strtobool(buf, &value);
+	if (err)
+		return -EINVAL;
+
+	ksm_use_zero_pages = value;
+
+	return count;
+}
+KSM_ATTR(use_zero_pages);
+
+static ssize_t pages_zero_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_zero));
+}
+KSM_ATTR_RO(pages_zero);
+
+static ssize_t nr_workers_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_workers_wanted);
+}
+
+/*
+ * The new number of workers takes over from the start of the next full
+ * scan: the mm_slots are shared out between them by their seq, which must
+ * not change under a worker part way through the list.  Surplus threads
+ * are left idle rather than stopped.
+ */
+static ssize_t nr_workers_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long nr;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr);
+	if (err || nr < 1 || nr > KSM_MAX_WORKERS)
+		return -EINVAL;
+
+	mutex_lock(&ksm_workers_lock);
+	err = ksm_start_workers(nr);
+	if (!err) {
+		spin_lock(&ksm_pass_lock);
+		ksm_nr_workers_wanted = nr;
+		spin_unlock(&ksm_pass_lock);
+	}
+	mutex_unlock(&ksm_workers_lock);
+
+	return err ? err : count;
+}
+KSM_ATTR(nr_workers);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -2308,6 +2804,9 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&use_zero_pages_attr.attr,
+	&pages_zero_attr.attr,
+	&nr_workers_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
 #endif
@@ -2322,17 +2821,24 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
+	int i;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
+	for (i = 0; i < KSM_TREE_PARTS; i++)
+		mutex_init(&ksm_tree_locks[i]);
+	zero_checksum = calc_checksum(ZERO_PAGE(0));
+	for (i = 0; i < KSM_MAX_WORKERS; i++) {
+		ksm_workers[i].id = i;
+		ksm_workers[i].scan.mm_slot = &ksm_mm_head;
+	}
+
+	err = ksm_start_workers(1);
+	if (err) {
 		pr_err("ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
 		goto out_free;
 	}
 
@@ -2340,7 +2846,8 @@ static int __init ksm_init(void)
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		kthread_stop(ksm_workers[0].task);
+		ksm_workers[0].task = NULL;
 		goto out_free;
 	}
 #else
@@ -1997,13 +1997,197 @@ static int memcg_cpu_hotplug_callback(struct notifier_block *nb,
 	return NOTIFY_OK;
 }
 
+/*
+ * In throttle mode the zswap pool usage of a cgroup counts towards its
+ * high limit as well; compressing its pages does not get it out of the
+ * way of the rest of the system.
+ */
+static unsigned long mem_cgroup_high_usage(struct mem_cgroup *memcg)
+{
+	unsigned long usage = page_counter_read(&memcg->memory);
+
+	if (READ_ONCE(memcg->high_throttle))
+		usage += DIV_ROUND_UP(atomic_long_read(&memcg->zswap_bytes),
+				      PAGE_SIZE);
+	return usage;
+}
+
+/*
+ * zswap entries can outlive their memcg by a long time, so they do not pin
+ * it: they point to a small owner object instead, which names the memcg
+ * their charge is now held by. When a memcg goes offline, its own owner and
+ * those it took over from offlined children move to the closest ancestor
+ * still online; that ancestor's counters include the charges already.
+ */
+struct memcg_zswap_owner {
+	struct mem_cgroup __rcu *memcg;	/* NULL once nobody is charged */
+	atomic_long_t refs;		/* entries, + 1 until css_free */
+	struct list_head list;		/* on memcg->zswap_owners */
+};
+
+static DEFINE_SPINLOCK(memcg_zswap_lock);
+
+static int memcg_zswap_owner_init(struct mem_cgroup *memcg)
+{
+	struct memcg_zswap_owner *owner;
+
+	INIT_LIST_HEAD(&memcg->zswap_owners);
+	owner = kmalloc(sizeof(*owner), GFP_KERNEL);
+	if (!owner)
+		return -ENOMEM;
+
+	RCU_INIT_POINTER(owner->memcg, memcg);
+	atomic_long_set(&owner->refs, 1);
+	list_add(&owner->list, &memcg->zswap_owners);
+	memcg->zswap_owner = owner;
+	return 0;
+}
+
+static void memcg_zswap_owner_put(struct memcg_zswap_owner *owner)
+{
+	if (!atomic_long_dec_and_test(&owner->refs))
+		return;
+
+	spin_lock(&memcg_zswap_lock);
+	list_del(&owner->list);
+	spin_unlock(&memcg_zswap_lock);
+	kfree(owner);
+}
+
+static void memcg_zswap_reparent(struct mem_cgroup *memcg)
+{
+	struct memcg_zswap_owner *owner, *tmp;
+	struct mem_cgroup *parent;
+
+	spin_lock(&memcg_zswap_lock);
+	memcg->zswap_offline = true;
+
+	/* Ancestors stay allocated for as long as memcg does */
+	parent = parent_mem_cgroup(memcg);
+	while (parent && parent->zswap_offline)
+		parent = parent_mem_cgroup(parent);
+
+	list_for_each_entry_safe(owner, tmp, &memcg->zswap_owners, list) {
+		rcu_assign_pointer(owner->memcg, parent);
+		if (parent)
+			list_move(&owner->list, &parent->zswap_owners);
+		else
+			list_del_init(&owner->list);
+	}
+	spin_unlock(&memcg_zswap_lock);
+}
+
+/*
+ * Charge @size compressed bytes stored in zswap on behalf of @page to the
+ * page's memcg and all its ancestors.  Returns the owner to be passed to
+ * mem_cgroup_zswap_uncharge() when the data is dropped.
+ */
+struct memcg_zswap_owner *mem_cgroup_zswap_charge(struct page *page,
+						  size_t size)
+{
+	struct memcg_zswap_owner *owner;
+	struct mem_cgroup *pos;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	if (!page->mem_cgroup)
+		return NULL;
+
+	/* The page pins its memcg, and the memcg its owner */
+	owner = page->mem_cgroup->zswap_owner;
+	atomic_long_inc(&owner->refs);
+
+	rcu_read_lock();
+	for (pos = rcu_dereference(owner->memcg); pos;
+	     pos = parent_mem_cgroup(pos))
+		atomic_long_add(size, &pos->zswap_bytes);
+	rcu_read_unlock();
+
+	return owner;
+}
+
+void mem_cgroup_zswap_uncharge(struct memcg_zswap_owner *owner, size_t size)
+{
+	struct mem_cgroup *pos;
+
+	if (!owner)
+		return;
+
+	/* css_free is RCU-delayed, so a memcg just moved away from is fine */
+	rcu_read_lock();
+	for (pos = rcu_dereference(owner->memcg); pos;
+	     pos = parent_mem_cgroup(pos))
+		atomic_long_sub(size, &pos->zswap_bytes);
+	rcu_read_unlock();
+
+	memcg_zswap_owner_put(owner);
+}
+
+/*
+ * Throttle mode delays tasks charging above the high limit for a time
+ * that grows with the square of the relative overage and linearly with
+ * the number of pages they charged, so that a cgroup that keeps
+ * allocating converges on a rate its background reclaim can sustain
+ * instead of stalling in direct reclaim.
+ */
+#define MEMCG_DELAY_PRECISION_SHIFT	20
+#define MEMCG_DELAY_SCALING_SHIFT	14
+#define MEMCG_MAX_HIGH_DELAY_JIFFIES	(2UL * HZ)
+
+static unsigned long mem_cgroup_high_delay(unsigned long usage,
+					   unsigned long high,
+					   unsigned int nr_pages)
+{
+	u64 overage, penalty;
+
+	overage = (u64)(usage - high) << MEMCG_DELAY_PRECISION_SHIFT;
+	overage = div64_u64(overage, max(high, 1UL));
+	/* beyond 16x the delay is capped anyway; keep the square in range */
+	overage = min_t(u64, overage, 16ULL << MEMCG_DELAY_PRECISION_SHIFT);
+
+	penalty = overage * overage * HZ;
+	penalty >>= MEMCG_DELAY_PRECISION_SHIFT;
+	penalty >>= MEMCG_DELAY_SCALING_SHIFT;
+	penalty = div_u64(penalty * nr_pages, CHARGE_BATCH);
+
+	return min_t(u64, penalty, MEMCG_MAX_HIGH_DELAY_JIFFIES);
+}
+
+/*
+ * Background reclaim for throttle mode, scheduled from the userland
+ * return path.  Keeps going as long as it makes progress and the cgroup
+ * is still above its high limit.
+ */
+static void high_work_func(struct work_struct *work)
+{
+	struct mem_cgroup *memcg = container_of(work, struct mem_cgroup,
+						high_work);
+	unsigned long usage = mem_cgroup_high_usage(memcg);
+	unsigned long high = READ_ONCE(memcg->high);
+	unsigned long nr_reclaimed;
+
+	if (usage <= high)
+		return;
+
+	nr_reclaimed = try_to_free_mem_cgroup_pages(memcg,
+			min(usage - high, (unsigned long)SWAP_CLUSTER_MAX * 32),
+			GFP_KERNEL, true);
+
+	if (nr_reclaimed &&
+	    mem_cgroup_high_usage(memcg) > READ_ONCE(memcg->high))
+		schedule_work(&memcg->high_work);
+}
+
 /*
  * Scheduled by try_charge() to be executed from the userland return path
- * and reclaims memory over the high limit.
+ * and reclaims memory over the high limit, or, for cgroups in throttle
+ * mode, kicks off background reclaim and delays the task.
  */
 void mem_cgroup_handle_over_high(void)
 {
 	unsigned int nr_pages = current->memcg_nr_pages_over_high;
+	unsigned long penalty = 0;
 	struct mem_cgroup *memcg, *pos;
 
 	if (likely(!nr_pages))
@@ -2012,14 +2196,28 @@ void mem_cgroup_handle_over_high(void)
 	pos = memcg = get_mem_cgroup_from_mm(current->mm);
 
 	do {
-		if (page_counter_read(&pos->memory) <= pos->high)
+		unsigned long usage = mem_cgroup_high_usage(pos);
+		unsigned long high = READ_ONCE(pos->high);
+
+		if (usage <= high)
 			continue;
 		mem_cgroup_events(pos, MEMCG_HIGH, 1);
-		try_to_free_mem_cgroup_pages(pos, nr_pages, GFP_KERNEL, true);
+		if (!READ_ONCE(pos->high_throttle)) {
+			try_to_free_mem_cgroup_pages(pos, nr_pages, GFP_KERNEL,
+						     true);
+			continue;
+		}
+		schedule_work(&pos->high_work);
+		penalty = max(penalty,
+			      mem_cgroup_high_delay(usage, high, nr_pages));
 	} while ((pos = parent_mem_cgroup(pos)));
 
 	css_put(&memcg->css);
 	current->memcg_nr_pages_over_high = 0;
+
+	/* not worth a trip through the scheduler */
+	if (penalty > HZ / 100)
+		schedule_timeout_killable(penalty);
 }
 
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
@@ -2151,7 +2349,7 @@ done_restock:
 	 * reclaim, the cost of mismatch is negligible.
 	 */
 	do {
-		if (page_counter_read(&memcg->memory) > memcg->high) {
+		if (mem_cgroup_high_usage(memcg) > memcg->high) {
 			current->memcg_nr_pages_over_high += batch;
 			set_notify_resume(current);
 			break;
@@ -4172,8 +4370,13 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	if (memcg_wb_domain_init(memcg, GFP_KERNEL))
 		goto out_free_stat;
 
+	if (memcg_zswap_owner_init(memcg))
+		goto out_free_wb;
+
 	return memcg;
 
+out_free_wb:
+	memcg_wb_domain_exit(memcg);
 out_free_stat:
 	free_percpu(memcg->stat);
 out_free:
@@ -4203,6 +4406,7 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 
 	free_percpu(memcg->stat);
 	memcg_wb_domain_exit(memcg);
+	memcg_zswap_owner_put(memcg->zswap_owner);
 	kfree(memcg);
 }
 
@@ -4251,6 +4455,7 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 	vmpressure_init(&memcg->vmpressure);
 	INIT_LIST_HEAD(&memcg->event_list);
 	spin_lock_init(&memcg->event_list_lock);
+	INIT_WORK(&memcg->high_work, high_work_func);
 #ifdef CONFIG_MEMCG_KMEM
 	memcg->kmemcg_id = -1;
 #endif
@@ -4282,6 +4487,7 @@ mem_cgroup_css_online(struct cgroup_subsys_state *css)
 	memcg->use_hierarchy = parent->use_hierarchy;
 	memcg->oom_kill_disable = parent->oom_kill_disable;
 	memcg->swappiness = mem_cgroup_swappiness(parent);
+	memcg->high_throttle = parent->high_throttle;
 
 	if (parent->use_hierarchy) {
 		page_counter_init(&memcg->memory, &parent->memory);
@@ -4346,6 +4552,8 @@ static void mem_cgroup_css_offline(struct cgroup_subsys_state *css)
 	memcg_deactivate_kmem(memcg);
 
 	wb_memcg_offline(memcg);
+
+	memcg_zswap_reparent(memcg);
 }
 
 static void mem_cgroup_css_released(struct cgroup_subsys_state *css)
@@ -4359,6 +4567,7 @@ static void mem_cgroup_css_free(struct cgroup_subsys_state *css)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
 
+	cancel_work_sync(&memcg->high_work);
 	memcg_destroy_kmem(memcg);
 	__mem_cgroup_free(memcg);
 }
@@ -4385,6 +4594,7 @@ static void mem_cgroup_css_reset(struct cgroup_subsys_state *css)
 	memcg_update_kmem_limit(memcg, PAGE_COUNTER_MAX);
 	memcg->low = 0;
 	memcg->high = PAGE_COUNTER_MAX;
+	memcg->high_throttle = false;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
 	memcg_wb_domain_size_changed(memcg);
 }
@@ -5134,6 +5344,32 @@ static ssize_t memory_high_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+static u64 memory_high_throttle_read(struct cgroup_subsys_state *css,
+				     struct cftype *cft)
+{
+	return mem_cgroup_from_css(css)->high_throttle;
+}
+
+static int memory_high_throttle_write(struct cgroup_subsys_state *css,
+				      struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	if (val > 1)
+		return -EINVAL;
+
+	WRITE_ONCE(memcg->high_throttle, val);
+	return 0;
+}
+
+static u64 memory_zswap_current_read(struct cgroup_subsys_state *css,
+				     struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(css);
+
+	return max(atomic_long_read(&memcg->zswap_bytes), 0L);
+}
+
 static int memory_max_show(struct seq_file *m, void *v)
 {
 	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
@@ -5197,6 +5433,17 @@ static struct cftype memory_files[] = {
 		.seq_show = memory_high_show,
 		.write = memory_high_write,
 	},
+	{
+		.name = "high_throttle",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = memory_high_throttle_read,
+		.write_u64 = memory_high_throttle_write,
+	},
+	{
+		.name = "zswap.current",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.read_u64 = memory_zswap_current_read,
+	},
 	{
 		.name = "max",
 		.flags = CFTYPE_NOT_ON_ROOT,
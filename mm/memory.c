@@ -2471,6 +2471,12 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		}
 		goto out;
 	}
+	if (transparent_hugepage_enabled(vma)) {
+		ret = do_huge_swap_page(mm, vma, address, pmd, entry, flags);
+		if (ret != VM_FAULT_FALLBACK)
+			return ret;
+		ret = 0;
+	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
 	page = lookup_swap_cache(entry);
 	if (!page) {
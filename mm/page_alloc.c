@@ -62,6 +62,7 @@
 #include <linux/sched/rt.h>
 #include <linux/page_owner.h>
 #include <linux/kthread.h>
+#include <linux/page_reporting.h>
 
 #include <asm/sections.h>
 #include <asm/tlbflush.h>
@@ -113,6 +114,7 @@ static DEFINE_SPINLOCK(managed_page_count_lock);
 
 unsigned long totalram_pages __read_mostly;
 unsigned long totalreserve_pages __read_mostly;
+EXPORT_SYMBOL_GPL(totalreserve_pages);
 unsigned long totalcma_pages __read_mostly;
 /*
  * When calculating the number of globally allowed dirty pages, there
@@ -578,6 +580,7 @@ static inline void set_page_order(struct page *page, unsigned int order)
 
 static inline void rmv_page_order(struct page *page)
 {
+	__ClearPageReported(page);
 	__ClearPageBuddy(page);
 	set_page_private(page, 0);
 }
@@ -628,6 +631,37 @@ static inline int page_is_buddy(struct page *page, struct page *buddy,
 	return 0;
 }
 
+#ifdef CONFIG_PAGE_REPORTING
+static struct page_reporting_dev_info __rcu *page_reporting_dev;
+static struct static_key page_reporting_key = STATIC_KEY_INIT_FALSE;
+
+/*
+ * A block of @order just went onto a free list, unreported: count it, and
+ * prod the reporting device once enough has piled up.  Called with the
+ * zone lock held and interrupts off, which keeps the device around.
+ */
+static void __page_reporting_notify_free(unsigned int order)
+{
+	struct page_reporting_dev_info *prdev;
+
+	prdev = rcu_dereference_sched(page_reporting_dev);
+	if (prdev && atomic_long_add_return(1L << order, &prdev->pending) >=
+		     prdev->threshold)
+		prdev->notify(prdev);
+}
+
+static inline void page_reporting_notify_free(unsigned int order)
+{
+	if (static_key_false(&page_reporting_key) &&
+	    order >= PAGE_REPORTING_MIN_ORDER)
+		__page_reporting_notify_free(order);
+}
+#else
+static inline void page_reporting_notify_free(unsigned int order)
+{
+}
+#endif
+
 /*
  * Freeing function for a buddy system allocator.
  *
@@ -656,7 +690,7 @@ static inline int page_is_buddy(struct page *page, struct page *buddy,
 static inline void __free_one_page(struct page *page,
 		unsigned long pfn,
 		struct zone *zone, unsigned int order,
-		int migratetype)
+		int migratetype, bool report)
 {
 	unsigned long page_idx;
 	unsigned long combined_idx;
@@ -732,6 +766,8 @@ static inline void __free_one_page(struct page *page,
 	list_add(&page->lru, &zone->free_area[order].free_list[migratetype]);
 out:
 	zone->free_area[order].nr_free++;
+	if (report && !is_migrate_isolate(migratetype))
+		page_reporting_notify_free(order);
 }
 
 static inline int free_pages_check(struct page *page)
@@ -823,7 +859,8 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			if (unlikely(has_isolate_pageblock(zone)))
 				mt = get_pageblock_migratetype(page);
 
-			__free_one_page(page, page_to_pfn(page), zone, 0, mt);
+			__free_one_page(page, page_to_pfn(page), zone, 0, mt,
+					true);
 			trace_mm_page_pcpu_drain(page, 0, mt);
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
@@ -845,7 +882,7 @@ static void free_one_page(struct zone *zone,
 		is_migrate_isolate(migratetype))) {
 		migratetype = get_pfnblock_migratetype(page, pfn);
 	}
-	__free_one_page(page, pfn, zone, order, migratetype);
+	__free_one_page(page, pfn, zone, order, migratetype, true);
 	spin_unlock(&zone->lock);
 }
 
@@ -2186,6 +2223,118 @@ int split_free_page(struct page *page)
 	return nr_pages;
 }
 
+#ifdef CONFIG_PAGE_REPORTING
+static DEFINE_MUTEX(page_reporting_mutex);
+
+int page_reporting_register(struct page_reporting_dev_info *prdev)
+{
+	int err = 0;
+
+	mutex_lock(&page_reporting_mutex);
+	if (rcu_access_pointer(page_reporting_dev)) {
+		err = -EBUSY;
+		goto out;
+	}
+	rcu_assign_pointer(page_reporting_dev, prdev);
+	static_key_slow_inc(&page_reporting_key);
+out:
+	mutex_unlock(&page_reporting_mutex);
+	return err;
+}
+EXPORT_SYMBOL_GPL(page_reporting_register);
+
+void page_reporting_unregister(struct page_reporting_dev_info *prdev)
+{
+	mutex_lock(&page_reporting_mutex);
+	if (rcu_access_pointer(page_reporting_dev) == prdev) {
+		static_key_slow_dec(&page_reporting_key);
+		RCU_INIT_POINTER(page_reporting_dev, NULL);
+		/* no free path is still looking at it */
+		synchronize_sched();
+	}
+	mutex_unlock(&page_reporting_mutex);
+}
+EXPORT_SYMBOL_GPL(page_reporting_unregister);
+
+/*
+ * Take up to @nents free blocks of PAGE_REPORTING_MIN_ORDER and up that have
+ * not been reported yet off the free lists, without taking any zone below
+ * its low watermark, and describe them in @sgl.  Returns how many were
+ * taken; they must be handed back with page_reporting_putback().
+ */
+unsigned int page_reporting_isolate(struct scatterlist *sgl,
+				    unsigned int nents)
+{
+	struct zone *zone;
+	unsigned int n = 0;
+
+	sg_init_table(sgl, nents);
+	for_each_populated_zone(zone) {
+		unsigned long flags;
+		unsigned int order;
+		int mt;
+
+		spin_lock_irqsave(&zone->lock, flags);
+		for (order = PAGE_REPORTING_MIN_ORDER; order < MAX_ORDER; order++) {
+			for (mt = 0; mt < MIGRATE_TYPES; mt++) {
+				struct list_head *list;
+				struct page *page, *next;
+
+				if (is_migrate_isolate(mt))
+					continue;
+				list = &zone->free_area[order].free_list[mt];
+				list_for_each_entry_safe(page, next, list, lru) {
+					if (PageReported(page))
+						continue;
+					if (!__isolate_free_page(page, order))
+						goto unlock;
+					sg_set_page(&sgl[n], page,
+						    PAGE_SIZE << order, 0);
+					if (++n == nents)
+						goto unlock;
+				}
+			}
+		}
+unlock:
+		spin_unlock_irqrestore(&zone->lock, flags);
+		if (n == nents)
+			break;
+	}
+	if (n)
+		sg_mark_end(&sgl[n - 1]);
+	return n;
+}
+EXPORT_SYMBOL_GPL(page_reporting_isolate);
+
+/*
+ * Give back blocks taken by page_reporting_isolate().  If the host has
+ * @reported them, those that did not merge with an unreported buddy on the
+ * way back are marked so they are skipped until they are allocated.  None
+ * of this counts as newly freed memory.
+ */
+void page_reporting_putback(struct scatterlist *sgl, unsigned int nents,
+			    bool reported)
+{
+	struct scatterlist *sg;
+	unsigned int i;
+
+	for_each_sg(sgl, sg, nents, i) {
+		struct page *page = sg_page(sg);
+		unsigned int order = get_order(sg->length);
+		struct zone *zone = page_zone(page);
+		unsigned long flags;
+
+		spin_lock_irqsave(&zone->lock, flags);
+		__free_one_page(page, page_to_pfn(page), zone, order,
+				get_pageblock_migratetype(page), false);
+		if (reported && PageBuddy(page) && page_order(page) == order)
+			__SetPageReported(page);
+		spin_unlock_irqrestore(&zone->lock, flags);
+	}
+}
+EXPORT_SYMBOL_GPL(page_reporting_putback);
+#endif /* CONFIG_PAGE_REPORTING */
+
 /*
  * Allocate a page from the given zone. Use pcplists for order-0 allocations.
  */
@@ -5189,6 +5338,8 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat)
 	pgdat->numabalancing_migrate_next_window = jiffies;
 #endif
 	init_waitqueue_head(&pgdat->kswapd_wait);
+	init_waitqueue_head(&pgdat->kswapd_helper_wait);
+	init_waitqueue_head(&pgdat->proactive_reclaim_wait);
 	init_waitqueue_head(&pgdat->pfmemalloc_wait);
 	pgdat_page_ext_init(pgdat);
 
@@ -151,31 +151,100 @@ void __delete_from_swap_cache(struct page *page)
 	INC_CACHE_INFO(del_total);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static void swapcache_free_huge(swp_entry_t entry)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		swapcache_free(swp_entry(swp_type(entry),
+					 swp_offset(entry) + i));
+}
+
+/*
+ * Give the subpages of a freshly split THP the rest of its huge swap run.
+ * The tail pages were put on the reclaim list by the split, so nobody but
+ * reclaim should hold their lock; a tail we cannot lock, or whose radix
+ * tree insertion fails, gives its entry back and gets an order-0 entry
+ * when shrink_page_list() reaches it.
+ */
+static void add_tails_to_swap(struct page *head, swp_entry_t entry)
+{
+	int i;
+
+	for (i = 1; i < HPAGE_PMD_NR; i++) {
+		struct page *page = head + i;
+		swp_entry_t tail = swp_entry(swp_type(entry),
+					     swp_offset(entry) + i);
+
+		if (!trylock_page(page)) {
+			swapcache_free(tail);
+			continue;
+		}
+
+		if (PageSwapCache(page) || add_to_swap_cache(page, tail,
+				__GFP_HIGH|__GFP_NOMEMALLOC|__GFP_NOWARN))
+			swapcache_free(tail);
+		else
+			SetPageDirty(page);
+
+		unlock_page(page);
+	}
+}
+#else
+static inline void swapcache_free_huge(swp_entry_t entry)
+{
+}
+
+static inline void add_tails_to_swap(struct page *head, swp_entry_t entry)
+{
+}
+#endif
+
 /**
  * add_to_swap - allocate swap space for a page
  * @page: page we want to move to swap
  *
  * Allocate swap space for the page and add the page to the
  * swap cache.  Caller needs to hold the page lock. 
+ *
+ * A transparent huge page is still split, but first tries to get an
+ * aligned run of HPAGE_PMD_NR swap entries for its subpages. Reclaim then
+ * stores the whole run in frontswap in one go (see pageout_huge_run()),
+ * and do_huge_swap_page() can bring it back as a THP.
  */
 int add_to_swap(struct page *page, struct list_head *list)
 {
 	swp_entry_t entry;
+	bool huge = false;
 	int err;
 
 	VM_BUG_ON_PAGE(!PageLocked(page), page);
 	VM_BUG_ON_PAGE(!PageUptodate(page), page);
 
-	entry = get_swap_page();
-	if (!entry.val)
-		return 0;
+	if (unlikely(PageTransHuge(page))) {
+		entry = get_huge_swap_page();
+		huge = entry.val != 0;
+	}
+
+	if (!huge) {
+		entry = get_swap_page();
+		if (!entry.val)
+			return 0;
+	}
 
 	if (unlikely(PageTransHuge(page)))
 		if (unlikely(split_huge_page_to_list(page, list))) {
-			swapcache_free(entry);
+			if (huge)
+				swapcache_free_huge(entry);
+			else
+				swapcache_free(entry);
 			return 0;
 		}
 
+	if (huge)
+		add_tails_to_swap(page, entry);
+
 	/*
 	 * Radix-tree node allocations from PF_MEMALLOC contexts could
 	 * completely exhaust the page allocator. __GFP_NOMEMALLOC
@@ -722,6 +722,129 @@ swp_entry_t get_swap_page_of_type(int type)
 	return (swp_entry_t) {0};
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define SWAP_HUGE_NR		HPAGE_PMD_NR
+/* Aligned windows examined per device before giving up on a huge run */
+#define SWAP_HUGE_SCAN_LIMIT	64
+
+/*
+ * Find SWAP_HUGE_NR free entries starting at a SWAP_HUGE_NR-aligned offset
+ * and mark them all SWAP_HAS_CACHE. Unlike scan_swap_map() this never drops
+ * si->lock and only does a bounded search: a THP that finds no run simply
+ * falls back to order-0 entries.
+ */
+static unsigned long scan_swap_map_huge(struct swap_info_struct *si)
+{
+	unsigned long offset, i;
+	int tries;
+
+	if (si->pages - si->inuse_pages < SWAP_HUGE_NR)
+		return 0;
+
+	if (si->cluster_info) {
+		unsigned long idx, nr = SWAP_HUGE_NR / SWAPFILE_CLUSTER;
+
+		/*
+		 * inc_cluster_info_page() takes free clusters off the head of
+		 * the free list, so only accept a run of whole clusters that
+		 * are consecutive at the head of that list.
+		 */
+		if (SWAP_HUGE_NR % SWAPFILE_CLUSTER ||
+		    cluster_is_null(&si->free_cluster_head))
+			return 0;
+
+		idx = cluster_next(&si->free_cluster_head);
+		offset = idx * SWAPFILE_CLUSTER;
+		if (offset % SWAP_HUGE_NR || offset + SWAP_HUGE_NR > si->max)
+			return 0;
+
+		for (i = 0; i < nr - 1; i++) {
+			if (cluster_next(&si->free_cluster_tail) == idx + i ||
+			    cluster_next(&si->cluster_info[idx + i]) != idx + i + 1)
+				return 0;
+		}
+		if (!cluster_is_free(&si->cluster_info[idx + nr - 1]) ||
+		    memchr_inv(si->swap_map + offset, 0, SWAP_HUGE_NR))
+			return 0;
+		goto found;
+	}
+
+	offset = ALIGN(si->cluster_next, SWAP_HUGE_NR);
+	for (tries = 0; tries < SWAP_HUGE_SCAN_LIMIT; tries++) {
+		if (offset + SWAP_HUGE_NR - 1 > si->highest_bit) {
+			offset = ALIGN(si->lowest_bit, SWAP_HUGE_NR);
+			if (offset + SWAP_HUGE_NR - 1 > si->highest_bit)
+				return 0;
+		}
+		if (!memchr_inv(si->swap_map + offset, 0, SWAP_HUGE_NR))
+			goto found;
+		offset += SWAP_HUGE_NR;
+	}
+	return 0;
+
+found:
+	for (i = 0; i < SWAP_HUGE_NR; i++) {
+		si->swap_map[offset + i] = SWAP_HAS_CACHE;
+		inc_cluster_info_page(si, si->cluster_info, offset + i);
+	}
+
+	if (offset <= si->lowest_bit && si->lowest_bit < offset + SWAP_HUGE_NR)
+		si->lowest_bit = offset + SWAP_HUGE_NR;
+	if (offset <= si->highest_bit && si->highest_bit < offset + SWAP_HUGE_NR)
+		si->highest_bit = offset - 1;
+	si->inuse_pages += SWAP_HUGE_NR;
+	if (si->inuse_pages == si->pages) {
+		si->lowest_bit = si->max;
+		si->highest_bit = 0;
+		spin_lock(&swap_avail_lock);
+		plist_del(&si->avail_list, &swap_avail_head);
+		spin_unlock(&swap_avail_lock);
+	}
+	si->cluster_next = offset + SWAP_HUGE_NR;
+
+	return offset;
+}
+
+/*
+ * Allocate HPAGE_PMD_NR contiguous, aligned swap entries for a transparent
+ * huge page, so that its subpages land next to each other in swap (and in
+ * zswap's tree). Returns the first entry, or 0 if no device has a free
+ * run.
+ *
+ * Devices are tried in swap_info order rather than by priority; huge runs
+ * are an optimisation and get_swap_page() still honours priorities for
+ * everything else.
+ */
+swp_entry_t get_huge_swap_page(void)
+{
+	struct swap_info_struct *si;
+	unsigned long offset;
+	int type;
+
+	if (atomic_long_read(&nr_swap_pages) < SWAP_HUGE_NR)
+		return (swp_entry_t) {0};
+	atomic_long_sub(SWAP_HUGE_NR, &nr_swap_pages);
+
+	spin_lock(&swap_lock);
+	for (type = 0; type < nr_swapfiles; type++) {
+		si = swap_info[type];
+		spin_lock(&si->lock);
+		offset = 0;
+		if ((si->flags & SWP_WRITEOK) && si->highest_bit)
+			offset = scan_swap_map_huge(si);
+		spin_unlock(&si->lock);
+		if (offset) {
+			spin_unlock(&swap_lock);
+			return swp_entry(type, offset);
+		}
+	}
+	spin_unlock(&swap_lock);
+
+	atomic_long_add(SWAP_HUGE_NR, &nr_swap_pages);
+	return (swp_entry_t) {0};
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
 static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
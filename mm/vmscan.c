@@ -46,6 +46,7 @@
 #include <linux/oom.h>
 #include <linux/prefetch.h>
 #include <linux/printk.h>
+#include <linux/frontswap.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -99,6 +100,9 @@ struct scan_control {
 	/* One of the zones is ready for compaction */
 	unsigned int compaction_ready:1;
 
+	/* Only scan anonymous LRUs (proactive reclaim) */
+	unsigned int anon_only:1;
+
 	/* Incremented by the number of inactive pages that were scanned */
 	unsigned long nr_scanned;
 
@@ -602,6 +606,66 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 	return PAGE_CLEAN;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * @page is the head of a THP that add_to_swap() split onto a huge swap run,
+ * now locked, unmapped and dirty.  Unmap its tail pages as well and store
+ * the whole run in frontswap in one go.  Returns true if that worked, with
+ * all the pages clean, the head still locked and the tails unlocked, to be
+ * freed when shrink_page_list() gets to them.  Otherwise the pages are left
+ * to be written out one at a time.
+ */
+static bool pageout_huge_run(struct page *page, enum ttu_flags ttu_flags)
+{
+	swp_entry_t entry = { .val = page_private(page) };
+	bool stored = false;
+	int i, nr_locked;
+
+	if (swp_offset(entry) % HPAGE_PMD_NR)
+		return false;
+
+	for (nr_locked = 1; nr_locked < HPAGE_PMD_NR; nr_locked++) {
+		struct page *tail = page + nr_locked;
+		swp_entry_t tail_entry = swp_entry(swp_type(entry),
+					swp_offset(entry) + nr_locked);
+
+		if (!trylock_page(tail))
+			break;
+		if (!PageSwapCache(tail) || PageWriteback(tail) ||
+		    page_private(tail) != tail_entry.val ||
+		    (page_mapped(tail) &&
+		     try_to_unmap(tail, ttu_flags|TTU_BATCH_FLUSH) !=
+		     SWAP_SUCCESS)) {
+			unlock_page(tail);
+			break;
+		}
+	}
+	if (nr_locked < HPAGE_PMD_NR)
+		goto out;
+
+	/* No CPU writes to the tails once we read them */
+	try_to_unmap_flush_dirty();
+	if (frontswap_store_batch(page, HPAGE_PMD_NR))
+		goto out;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		clear_page_dirty_for_io(page + i);
+	mod_zone_page_state(page_zone(page), NR_VMSCAN_WRITE, HPAGE_PMD_NR);
+	stored = true;
+out:
+	for (i = 1; i < nr_locked; i++)
+		unlock_page(page + i);
+	count_vm_event(stored ? THP_SWPOUT : THP_SWPOUT_FALLBACK);
+	return stored;
+}
+#else
+static inline bool pageout_huge_run(struct page *page,
+				    enum ttu_flags ttu_flags)
+{
+	return false;
+}
+#endif
+
 /*
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
@@ -905,7 +969,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		struct page *page;
 		int may_enter_fs;
 		enum page_references references = PAGEREF_RECLAIM_CLEAN;
-		bool dirty, writeback;
+		bool dirty, writeback, huge = false;
+		pageout_t res;
 
 		cond_resched();
 
@@ -1047,6 +1112,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		if (PageAnon(page) && !PageSwapCache(page)) {
 			if (!(sc->gfp_mask & __GFP_IO))
 				goto keep_locked;
+			huge = PageTransHuge(page);
 			if (!add_to_swap(page, page_list))
 				goto activate_locked;
 			may_enter_fs = 1;
@@ -1107,7 +1173,11 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			 * starts and then write it out here.
 			 */
 			try_to_unmap_flush_dirty();
-			switch (pageout(page, mapping, sc)) {
+			if (huge && pageout_huge_run(page, ttu_flags))
+				res = PAGE_CLEAN;
+			else
+				res = pageout(page, mapping, sc);
+			switch (res) {
 			case PAGE_KEEP:
 				goto keep_locked;
 			case PAGE_ACTIVATE:
@@ -2000,6 +2070,11 @@ static void get_scan_count(struct lruvec *lruvec, int swappiness,
 		goto out;
 	}
 
+	if (sc->anon_only) {
+		scan_balance = SCAN_ANON;
+		goto out;
+	}
+
 	/*
 	 * Global reclaim will swap to prevent OOM even with no
 	 * swappiness, but memcg users want to use this knob to
@@ -3132,6 +3207,244 @@ static bool kswapd_shrink_zone(struct zone *zone,
 	return sc->nr_scanned >= sc->nr_to_reclaim;
 }
 
+/*
+ * Number of reclaim threads per node, including the primary kswapd. On large
+ * hosts a single kswapd cannot push pages out (e.g. compress them into zswap)
+ * as fast as they are allocated, and allocators fall into direct reclaim.
+ * Helpers only run while balance_pgdat() sees a backlog big enough to keep
+ * them busy.
+ */
+int kswapd_threads __read_mostly = 1;
+static DEFINE_MUTEX(kswapd_threads_lock);
+
+/* One helper is woken for every this many pages below the high watermarks */
+#define KSWAPD_HELPER_BACKLOG	(SWAP_CLUSTER_MAX * 64)
+
+static unsigned long pgdat_reclaim_backlog(pg_data_t *pgdat, int end_zone)
+{
+	unsigned long backlog = 0;
+	int i;
+
+	for (i = 0; i <= end_zone; i++) {
+		struct zone *zone = pgdat->node_zones + i;
+		unsigned long free, high;
+
+		if (!populated_zone(zone))
+			continue;
+
+		free = zone_page_state(zone, NR_FREE_PAGES);
+		high = high_wmark_pages(zone);
+		if (free < high)
+			backlog += high - free;
+	}
+
+	return backlog;
+}
+
+/*
+ * Size the set of running helpers from the reclaim backlog of zones
+ * 0..end_zone and wake them if there is work.
+ */
+static void kswapd_wake_helpers(pg_data_t *pgdat, int end_zone)
+{
+	unsigned long wanted = 0;
+	int nr_threads = READ_ONCE(kswapd_threads);
+
+	if (nr_threads > 1) {
+		wanted = pgdat_reclaim_backlog(pgdat, end_zone) /
+						KSWAPD_HELPER_BACKLOG;
+		wanted = min_t(unsigned long, wanted, nr_threads - 1);
+	}
+
+	WRITE_ONCE(pgdat->kswapd_helpers_wanted, wanted);
+	if (wanted) {
+		WRITE_ONCE(pgdat->kswapd_helper_seq,
+			   pgdat->kswapd_helper_seq + 1);
+		if (waitqueue_active(&pgdat->kswapd_helper_wait))
+			wake_up_interruptible_all(&pgdat->kswapd_helper_wait);
+	}
+}
+
+static inline bool kswapd_helper_wanted(struct kswapd_thread *kt)
+{
+	return READ_ONCE(kt->pgdat->kswapd_helpers_wanted) >= kt->id;
+}
+
+/*
+ * A helper runs one pass per kswapd_wake_helpers() call. After a pass that
+ * ended because its zones were balanced or it ran out of priority, it waits
+ * for kswapd's next balancing round instead of spinning on the same state
+ * for as long as kswapd keeps kswapd_helpers_wanted set.
+ */
+static inline bool kswapd_helper_woken(struct kswapd_thread *kt)
+{
+	return kswapd_helper_wanted(kt) &&
+	       READ_ONCE(kt->pgdat->kswapd_helper_seq) != kt->wake_seq;
+}
+
+/*
+ * Order-0 reclaim on behalf of a busy kswapd. Balancing decisions, slab
+ * shrinking and compaction stay with the primary kswapd; helpers only add
+ * LRU scanning and pageout bandwidth.
+ *
+ * Scanning is partitioned two ways. Each helper starts its pass on a
+ * different zone, and threads sharing a zone isolate disjoint batches of
+ * SWAP_CLUSTER_MAX pages from the LRU tails under zone->lru_lock, so the
+ * expensive part of reclaim (unmapping, swap-out, compression) runs in
+ * parallel.
+ */
+static void kswapd_helper_reclaim(struct kswapd_thread *kt)
+{
+	pg_data_t *pgdat = kt->pgdat;
+	struct scan_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.priority = DEF_PRIORITY,
+		.may_writepage = !laptop_mode,
+		.may_unmap = 1,
+		.may_swap = 1,
+	};
+	u64 start = ktime_get_ns();
+
+	kt->nr_runs++;
+
+	do {
+		unsigned long nr_reclaimed = sc.nr_reclaimed;
+		int nr_zones = pgdat->nr_zones;
+		bool balanced = true;
+		int n;
+
+		for (n = 0; n < nr_zones; n++) {
+			struct zone *zone;
+
+			zone = pgdat->node_zones + (kt->id + n) % nr_zones;
+
+			if (!populated_zone(zone))
+				continue;
+
+			if (sc.priority != DEF_PRIORITY &&
+			    !zone_reclaimable(zone))
+				continue;
+
+			if (zone_balanced(zone, 0, 0, 0))
+				continue;
+
+			balanced = false;
+			sc.nr_to_reclaim = KSWAPD_HELPER_BACKLOG;
+			shrink_zone(zone, &sc, false);
+		}
+
+		if (balanced)
+			break;
+
+		if (sc.priority < DEF_PRIORITY - 2)
+			sc.may_writepage = 1;
+
+		if (sc.nr_reclaimed == nr_reclaimed)
+			sc.priority--;
+	} while (sc.priority >= 1 && kswapd_helper_wanted(kt) &&
+		 !freezing(current) && !kthread_should_stop());
+
+	kt->nr_scanned += sc.nr_scanned;
+	kt->nr_reclaimed += sc.nr_reclaimed;
+	kt->run_ns += ktime_get_ns() - start;
+}
+
+static int kswapd_helper(void *p)
+{
+	struct kswapd_thread *kt = p;
+	pg_data_t *pgdat = kt->pgdat;
+	struct task_struct *tsk = current;
+	struct reclaim_state reclaim_state = {
+		.reclaimed_slab = 0,
+	};
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	lockdep_set_current_reclaim_state(GFP_KERNEL);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+	current->reclaim_state = &reclaim_state;
+
+	/* See kswapd() */
+	tsk->flags |= PF_MEMALLOC | PF_SWAPWRITE | PF_KSWAPD;
+	set_freezable();
+
+	for ( ; ; ) {
+		wait_event_freezable(pgdat->kswapd_helper_wait,
+				     kswapd_helper_woken(kt) ||
+				     kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+
+		kt->wake_seq = READ_ONCE(pgdat->kswapd_helper_seq);
+		kswapd_helper_reclaim(kt);
+		cond_resched();
+	}
+
+	tsk->flags &= ~(PF_MEMALLOC | PF_SWAPWRITE | PF_KSWAPD);
+	current->reclaim_state = NULL;
+	lockdep_clear_current_reclaim_state();
+
+	return 0;
+}
+
+/*
+ * Start or stop helpers so that @pgdat has @nr_threads reclaim threads in
+ * total. Caller must hold mem_hotplug_begin/end() or get/put_online_mems()
+ * and kswapd_threads_lock.
+ */
+static void kswapd_update_helpers(pg_data_t *pgdat, int nr_threads)
+{
+	int i;
+
+	for (i = 1; i < KSWAPD_MAX_THREADS; i++) {
+		struct kswapd_thread *kt = &pgdat->kswapd_threads[i];
+
+		if (i < nr_threads && !kt->task) {
+			struct task_struct *task;
+
+			kt->pgdat = pgdat;
+			kt->id = i;
+			kt->wake_seq = READ_ONCE(pgdat->kswapd_helper_seq);
+			task = kthread_run(kswapd_helper, kt, "kswapd%d:%d",
+					   pgdat->node_id, i);
+			if (IS_ERR(task)) {
+				pr_err("Failed to start kswapd helper %d on node %d\n",
+				       i, pgdat->node_id);
+				break;
+			}
+			WRITE_ONCE(kt->task, task);
+		} else if (i >= nr_threads && kt->task) {
+			kthread_stop(kt->task);
+			WRITE_ONCE(kt->task, NULL);
+		}
+	}
+}
+
+int kswapd_threads_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int nid, ret;
+
+	/* Hotplug calls kswapd_run/stop under mem_hotplug_begin() */
+	get_online_mems();
+	mutex_lock(&kswapd_threads_lock);
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		goto out;
+
+	for_each_node_state(nid, N_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		if (pgdat->kswapd)
+			kswapd_update_helpers(pgdat, kswapd_threads);
+	}
+out:
+	mutex_unlock(&kswapd_threads_lock);
+	put_online_mems();
+	return ret;
+}
+
 /*
  * For kswapd, balance_pgdat() will work across all this node's zones until
  * they are all at high_wmark_pages(zone).
@@ -3168,7 +3481,11 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		.may_unmap = 1,
 		.may_swap = 1,
 	};
+	struct kswapd_thread *kt = &pgdat->kswapd_threads[0];
+	u64 start = ktime_get_ns();
+
 	count_vm_event(PAGEOUTRUN);
+	kt->nr_runs++;
 
 	do {
 		unsigned long nr_attempted = 0;
@@ -3224,6 +3541,8 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		if (i < 0)
 			goto out;
 
+		kswapd_wake_helpers(pgdat, end_zone);
+
 		for (i = 0; i <= end_zone; i++) {
 			struct zone *zone = pgdat->node_zones + i;
 
@@ -3288,7 +3607,9 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 			if (kswapd_shrink_zone(zone, end_zone,
 					       &sc, &nr_attempted))
 				raise_priority = false;
+			kt->nr_scanned += sc.nr_scanned;
 		}
+		kt->nr_reclaimed += sc.nr_reclaimed;
 
 		/*
 		 * If the low watermark is met there is no need for processes
@@ -3331,6 +3652,10 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order,
 		 !pgdat_balanced(pgdat, order, *classzone_idx));
 
 out:
+	/* Helpers stop once the node no longer needs them */
+	WRITE_ONCE(pgdat->kswapd_helpers_wanted, 0);
+	kt->run_ns += ktime_get_ns() - start;
+
 	/*
 	 * Return the order we were reclaiming at so prepare_kswapd_sleep()
 	 * makes a decision on the order we were last reclaiming at. However,
@@ -3587,14 +3912,30 @@ static int cpu_callback(struct notifier_block *nfb, unsigned long action,
 
 			mask = cpumask_of_node(pgdat->node_id);
 
-			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids)
+			if (cpumask_any_and(cpu_online_mask, mask) < nr_cpu_ids) {
+				int i;
+
 				/* One of our CPUs online: restore mask */
 				set_cpus_allowed_ptr(pgdat->kswapd, mask);
+				if (pgdat->proactive_reclaimd)
+					set_cpus_allowed_ptr(
+						pgdat->proactive_reclaimd, mask);
+				for (i = 1; i < KSWAPD_MAX_THREADS; i++) {
+					struct task_struct *task;
+
+					task = pgdat->kswapd_threads[i].task;
+					if (task)
+						set_cpus_allowed_ptr(task, mask);
+				}
+			}
 		}
 	}
 	return NOTIFY_OK;
 }
 
+static void proactive_reclaim_run(pg_data_t *pgdat);
+static void proactive_reclaim_stop(pg_data_t *pgdat);
+
 /*
  * This kswapd start function will be called by init and node-hot-add.
  * On node-hot-add, kswapd will moved to proper cpus if cpus are hot-added.
@@ -3614,7 +3955,18 @@ int kswapd_run(int nid)
 		pr_err("Failed to start kswapd on node %d\n", nid);
 		ret = PTR_ERR(pgdat->kswapd);
 		pgdat->kswapd = NULL;
+		return ret;
 	}
+
+	pgdat->kswapd_threads[0].pgdat = pgdat;
+	pgdat->kswapd_threads[0].task = pgdat->kswapd;
+
+	mutex_lock(&kswapd_threads_lock);
+	kswapd_update_helpers(pgdat, kswapd_threads);
+	mutex_unlock(&kswapd_threads_lock);
+
+	proactive_reclaim_run(pgdat);
+
 	return ret;
 }
 
@@ -3624,11 +3976,19 @@ int kswapd_run(int nid)
  */
 void kswapd_stop(int nid)
 {
-	struct task_struct *kswapd = NODE_DATA(nid)->kswapd;
+	pg_data_t *pgdat = NODE_DATA(nid);
+	struct task_struct *kswapd = pgdat->kswapd;
+
+	proactive_reclaim_stop(pgdat);
+
+	mutex_lock(&kswapd_threads_lock);
+	kswapd_update_helpers(pgdat, 1);
+	mutex_unlock(&kswapd_threads_lock);
 
 	if (kswapd) {
 		kthread_stop(kswapd);
-		NODE_DATA(nid)->kswapd = NULL;
+		pgdat->kswapd = NULL;
+		pgdat->kswapd_threads[0].task = NULL;
 	}
 }
 
@@ -3645,6 +4005,156 @@ static int __init kswapd_init(void)
 
 module_init(kswapd_init)
 
+/*
+ * Proactive reclaim
+ *
+ * Watermark-driven reclaim only starts once a zone is already short of
+ * memory, so swap-out comes in bursts that coincide with allocation spikes.
+ * If vm.proactive_reclaim_free_kbytes is non-zero, a per-node thread
+ * instead keeps that much memory free on every node by pushing cold
+ * anonymous pages out to swap (i.e. into zswap when it is enabled), at no
+ * more than vm.proactive_reclaim_rate_kbytes per second per node.
+ */
+int sysctl_proactive_reclaim_free_kbytes __read_mostly;
+int sysctl_proactive_reclaim_rate_kbytes __read_mostly = 64 * 1024;
+
+#define PROACTIVE_RECLAIM_INTERVAL	(HZ / 10)
+
+/* Proactive reclaim never scans harder than this many priority levels */
+#define PROACTIVE_RECLAIM_PRIORITIES	3
+
+static unsigned long proactive_reclaim_node(pg_data_t *pgdat,
+					    unsigned long nr_to_reclaim)
+{
+	struct scan_control sc = {
+		.nr_to_reclaim = nr_to_reclaim,
+		.gfp_mask = GFP_KERNEL,
+		.priority = DEF_PRIORITY,
+		.may_writepage = !laptop_mode,
+		.may_unmap = 1,
+		.may_swap = 1,
+		.anon_only = 1,
+	};
+	int i;
+
+	do {
+		for (i = pgdat->nr_zones - 1; i >= 0; i--) {
+			struct zone *zone = pgdat->node_zones + i;
+
+			if (!populated_zone(zone))
+				continue;
+
+			shrink_zone(zone, &sc, false);
+			if (sc.nr_reclaimed >= sc.nr_to_reclaim)
+				return sc.nr_reclaimed;
+		}
+	} while (--sc.priority > DEF_PRIORITY - PROACTIVE_RECLAIM_PRIORITIES);
+
+	return sc.nr_reclaimed;
+}
+
+/*
+ * One proactive reclaim thread per node, like kswapd. It has reclaim
+ * reserves (PF_MEMALLOC) for the same reason kswapd has, so this must not
+ * run from a shared worker. It sleeps until the target is set and then
+ * reclaims at most a rate-limited batch every PROACTIVE_RECLAIM_INTERVAL.
+ */
+static int proactive_reclaimd(void *p)
+{
+	pg_data_t *pgdat = p;
+	struct task_struct *tsk = current;
+	struct reclaim_state reclaim_state = {
+		.reclaimed_slab = 0,
+	};
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+
+	lockdep_set_current_reclaim_state(GFP_KERNEL);
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(tsk, cpumask);
+	tsk->reclaim_state = &reclaim_state;
+	tsk->flags |= PF_MEMALLOC | PF_SWAPWRITE;
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		unsigned long target, batch, free;
+
+		target = READ_ONCE(sysctl_proactive_reclaim_free_kbytes) >>
+							(PAGE_SHIFT - 10);
+		if (!target) {
+			wait_event_freezable(pgdat->proactive_reclaim_wait,
+				READ_ONCE(sysctl_proactive_reclaim_free_kbytes) ||
+				kthread_should_stop());
+			continue;
+		}
+
+		batch = READ_ONCE(sysctl_proactive_reclaim_rate_kbytes) >>
+							(PAGE_SHIFT - 10);
+		batch = max_t(unsigned long, SWAP_CLUSTER_MAX,
+			      batch * PROACTIVE_RECLAIM_INTERVAL / HZ);
+
+		free = node_page_state(pgdat->node_id, NR_FREE_PAGES);
+		if (free < target && get_nr_swap_pages() > 0)
+			proactive_reclaim_node(pgdat, min(target - free, batch));
+
+		wait_event_freezable_timeout(pgdat->proactive_reclaim_wait,
+					     kthread_should_stop(),
+					     PROACTIVE_RECLAIM_INTERVAL);
+	}
+
+	tsk->flags &= ~(PF_MEMALLOC | PF_SWAPWRITE);
+	tsk->reclaim_state = NULL;
+	lockdep_clear_current_reclaim_state();
+
+	return 0;
+}
+
+static void proactive_reclaim_run(pg_data_t *pgdat)
+{
+	struct task_struct *task;
+
+	if (pgdat->proactive_reclaimd)
+		return;
+
+	task = kthread_run(proactive_reclaimd, pgdat, "kpreclaimd%d",
+			   pgdat->node_id);
+	if (IS_ERR(task)) {
+		pr_err("Failed to start proactive reclaim on node %d\n",
+		       pgdat->node_id);
+		return;
+	}
+	pgdat->proactive_reclaimd = task;
+}
+
+static void proactive_reclaim_stop(pg_data_t *pgdat)
+{
+	if (pgdat->proactive_reclaimd) {
+		kthread_stop(pgdat->proactive_reclaimd);
+		pgdat->proactive_reclaimd = NULL;
+	}
+}
+
+int proactive_reclaim_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int nid, ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	/* The threads go back to sleep by themselves once the target is 0 */
+	if (!sysctl_proactive_reclaim_free_kbytes)
+		return 0;
+
+	for_each_node_state(nid, N_MEMORY) {
+		pg_data_t *pgdat = NODE_DATA(nid);
+
+		wake_up_interruptible(&pgdat->proactive_reclaim_wait);
+	}
+	return 0;
+}
+
 #ifdef CONFIG_NUMA
 /*
  * Zone reclaim mode
@@ -845,6 +845,9 @@ const char * const vmstat_text[] = {
 	"thp_split",
 	"thp_zero_page_alloc",
 	"thp_zero_page_alloc_failed",
+	"thp_swpout",
+	"thp_swpout_fallback",
+	"thp_swpin",
 #endif
 #ifdef CONFIG_MEMORY_BALLOON
 	"balloon_inflate",
@@ -1295,6 +1298,60 @@ static const struct file_operations proc_zoneinfo_file_operations = {
 	.release	= seq_release,
 };
 
+/*
+ * Output per-thread reclaim throughput of the kswapd threads of @pgdat.
+ */
+static int kswapdinfo_show(struct seq_file *m, void *arg)
+{
+	pg_data_t *pgdat = (pg_data_t *)arg;
+	int i;
+
+	for (i = 0; i < KSWAPD_MAX_THREADS; i++) {
+		struct kswapd_thread *kt = &pgdat->kswapd_threads[i];
+		u64 ms, rate = 0;
+
+		if (!READ_ONCE(kt->task) && !kt->nr_runs)
+			continue;
+
+		ms = div_u64(kt->run_ns, NSEC_PER_MSEC);
+		if (ms)
+			rate = div64_u64((u64)kt->nr_reclaimed * MSEC_PER_SEC,
+					 ms);
+
+		seq_printf(m, "Node %d, thread %2d %s"
+			   "\n        runs      %lu"
+			   "\n        scanned   %lu"
+			   "\n        reclaimed %lu"
+			   "\n        run_ms    %llu"
+			   "\n        pages/s   %llu"
+			   "\n",
+			   pgdat->node_id, i,
+			   READ_ONCE(kt->task) ? "active" : "stopped",
+			   kt->nr_runs, kt->nr_scanned, kt->nr_reclaimed,
+			   ms, rate);
+	}
+	return 0;
+}
+
+static const struct seq_operations kswapdinfo_op = {
+	.start	= frag_start,
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= kswapdinfo_show,
+};
+
+static int kswapdinfo_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &kswapdinfo_op);
+}
+
+static const struct file_operations proc_kswapdinfo_file_operations = {
+	.open		= kswapdinfo_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 enum writeback_stat_item {
 	NR_DIRTY_THRESHOLD,
 	NR_DIRTY_BG_THRESHOLD,
@@ -1557,6 +1614,7 @@ static int __init setup_vmstat(void)
 	proc_create("pagetypeinfo", S_IRUGO, NULL, &pagetypeinfo_file_ops);
 	proc_create("vmstat", S_IRUGO, NULL, &proc_vmstat_file_operations);
 	proc_create("zoneinfo", S_IRUGO, NULL, &proc_zoneinfo_file_operations);
+	proc_create("kswapdinfo", S_IRUGO, NULL, &proc_kswapdinfo_file_operations);
 #endif
 	return 0;
 }
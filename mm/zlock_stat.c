@@ -0,0 +1,252 @@
+/*
+ * zlock_stat.c - contention statistics for the zswap and ztier locks
+ *
+ * See include/linux/zlock_stat.h.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <linux/zlock_stat.h>
+
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+DEFINE_STATIC_KEY_FALSE(zlock_stats_key);
+EXPORT_SYMBOL_GPL(zlock_stats_key);
+
+static const char * const zlock_site_names[ZLOCK_NR_SITES] = {
+    [ZLOCK_STORE]       = "store",
+    [ZLOCK_LOAD]        = "load",
+    [ZLOCK_INVALIDATE]  = "invalidate",
+    [ZLOCK_WRITEBACK]   = "writeback",
+    [ZLOCK_RECLAIM]     = "reclaim",
+};
+
+// Protects zlock_classes and zlock_stats_user.
+static DEFINE_MUTEX(zlock_mutex);
+static LIST_HEAD(zlock_classes);
+// Whether the debugfs file holds a reference on the statistics.
+static bool zlock_stats_user;
+
+static int zlock_bucket(u64 ns)
+{
+    return ns ? min_t(int, ilog2(ns), ZLOCK_HIST_BUCKETS - 1) : 0;
+}
+
+void __zlock_lock_timed(struct zlock *zl, enum zlock_site site)
+{
+    struct zlock_site_stats *st;
+    u64 start = 0, now;
+
+    if (spin_trylock(&zl->lock)) {
+        now = local_clock();
+    } else {
+        start = local_clock();
+        spin_lock(&zl->lock);
+        now = local_clock();
+    }
+
+    st = &this_cpu_ptr(zl->class->stats)->site[site];
+    st->acquired++;
+    if (start) {
+        st->contended++;
+        st->wait_ns += now - start;
+        st->wait_hist[zlock_bucket(now - start)]++;
+    }
+
+    zl->held_since = now ?: 1;
+    zl->site = site;
+}
+EXPORT_SYMBOL_GPL(__zlock_lock_timed);
+
+void __zlock_unlock_timed(struct zlock *zl)
+{
+    struct zlock_site_stats *st;
+    u64 held = local_clock() - zl->held_since;
+
+    st = &this_cpu_ptr(zl->class->stats)->site[zl->site];
+
+    st->hold_ns += held;
+    st->hold_hist[zlock_bucket(held)]++;
+    spin_unlock(&zl->lock);
+}
+EXPORT_SYMBOL_GPL(__zlock_unlock_timed);
+
+int zlock_class_register(struct zlock_class *class, const char *name)
+{
+    class->stats = alloc_percpu(struct zlock_cpu_stats);
+    if (!class->stats)
+        return -ENOMEM;
+    class->name = name;
+
+    mutex_lock(&zlock_mutex);
+    list_add_tail(&class->list, &zlock_classes);
+    mutex_unlock(&zlock_mutex);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(zlock_class_register);
+
+void zlock_class_unregister(struct zlock_class *class)
+{
+    mutex_lock(&zlock_mutex);
+    list_del(&class->list);
+    mutex_unlock(&zlock_mutex);
+
+    free_percpu(class->stats);
+    class->stats = NULL;
+}
+EXPORT_SYMBOL_GPL(zlock_class_unregister);
+
+void zlock_class_read(struct zlock_class *class, enum zlock_site site,
+        struct zlock_site_stats *sum)
+{
+    struct zlock_site_stats *st;
+    int cpu, i;
+
+    memset(sum, 0, sizeof(*sum));
+
+    // Racy against updates, which is fine for statistics.
+    for_each_possible_cpu(cpu) {
+        st = &per_cpu_ptr(class->stats, cpu)->site[site];
+        sum->acquired += st->acquired;
+        sum->contended += st->contended;
+        sum->wait_ns += st->wait_ns;
+        sum->hold_ns += st->hold_ns;
+        for (i = 0; i < ZLOCK_HIST_BUCKETS; i++) {
+            sum->wait_hist[i] += st->wait_hist[i];
+            sum->hold_hist[i] += st->hold_hist[i];
+        }
+    }
+}
+EXPORT_SYMBOL_GPL(zlock_class_read);
+
+void zlock_stats_get(void)
+{
+    static_branch_inc(&zlock_stats_key);
+}
+EXPORT_SYMBOL_GPL(zlock_stats_get);
+
+void zlock_stats_put(void)
+{
+    static_branch_dec(&zlock_stats_key);
+}
+EXPORT_SYMBOL_GPL(zlock_stats_put);
+
+/*********************************
+* debugfs file
+**********************************/
+
+static void zlock_show_hist(struct seq_file *m, const char *what, u64 *hist)
+{
+    int i;
+
+    seq_printf(m, "    %s", what);
+    for (i = 0; i < ZLOCK_HIST_BUCKETS; i++)
+        if (hist[i])
+            seq_printf(m, " %s%lluns:%llu",
+                       i == ZLOCK_HIST_BUCKETS - 1 ? ">=" : "",
+                       1ULL << i, hist[i]);
+    seq_puts(m, "\n");
+}
+
+static int zlock_stats_show(struct seq_file *m, void *v)
+{
+    struct zlock_site_stats sum;
+    struct zlock_class *class;
+    int site;
+
+    mutex_lock(&zlock_mutex);
+
+    seq_printf(m, "enabled %d\n",
+               static_key_enabled(&zlock_stats_key) ? 1 : 0);
+    seq_printf(m, "# %-12s %-10s %12s %12s %14s %14s\n", "lock", "site",
+               "acquired", "contended", "wait_ns", "hold_ns");
+
+    list_for_each_entry(class, &zlock_classes, list) {
+        for (site = 0; site < ZLOCK_NR_SITES; site++) {
+            zlock_class_read(class, site, &sum);
+            if (!sum.acquired)
+                continue;
+
+            seq_printf(m, "%-14s %-10s %12llu %12llu %14llu %14llu\n",
+                       class->name, zlock_site_names[site], sum.acquired,
+                       sum.contended, sum.wait_ns, sum.hold_ns);
+            if (sum.contended)
+                zlock_show_hist(m, "wait", sum.wait_hist);
+            zlock_show_hist(m, "hold", sum.hold_hist);
+        }
+    }
+
+    mutex_unlock(&zlock_mutex);
+    return 0;
+}
+
+static int zlock_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, zlock_stats_show, NULL);
+}
+
+static void zlock_stats_reset(void)
+{
+    struct zlock_class *class;
+    int cpu;
+
+    list_for_each_entry(class, &zlock_classes, list)
+        for_each_possible_cpu(cpu)
+            memset(per_cpu_ptr(class->stats, cpu), 0,
+                   sizeof(struct zlock_cpu_stats));
+}
+
+/*
+ * "1" turns statistics on, "0" turns them off again (unless someone else
+ * wants them, such as the zswap benchmark), "reset" clears them.
+ */
+static ssize_t zlock_stats_write(struct file *file, const char __user *ubuf,
+        size_t count, loff_t *ppos)
+{
+    char buf[8];
+    size_t len = min(count, sizeof(buf) - 1);
+    ssize_t ret = count;
+
+    if (copy_from_user(buf, ubuf, len))
+        return -EFAULT;
+    buf[len] = '\0';
+
+    mutex_lock(&zlock_mutex);
+    if (sysfs_streq(buf, "1")) {
+        if (!zlock_stats_user)
+            zlock_stats_get();
+        zlock_stats_user = true;
+    } else if (sysfs_streq(buf, "0")) {
+        if (zlock_stats_user)
+            zlock_stats_put();
+        zlock_stats_user = false;
+    } else if (sysfs_streq(buf, "reset")) {
+        zlock_stats_reset();
+    } else {
+        ret = -EINVAL;
+    }
+    mutex_unlock(&zlock_mutex);
+
+    return ret;
+}
+
+const struct file_operations zlock_stats_fops = {
+    .open       = zlock_stats_open,
+    .read       = seq_read,
+    .write      = zlock_stats_write,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+EXPORT_SYMBOL_GPL(zlock_stats_fops);
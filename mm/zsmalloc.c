@@ -38,6 +38,9 @@
  *		Basically forming list of zspages in a fullness group.
  *	page->mapping: class index and fullness group of the zspage
  *	page->inuse: the number of objects that are used in this zspage
+ *	page->ztier_lru: links together first pages of all zspages of the
+ *		pool in LRU order of allocation, if the pool has an evict
+ *		handler (see zs_reclaim_page)
  *
  * Usage of struct page flags:
  *	PG_private: identifies the first component page
@@ -121,9 +124,16 @@
  * It's okay to add the status bit in the least bit because
  * header keeps handle which is 4byte-aligned address so we
  * have room for two bit at least.
+ *
+ * An object freed while its zspage is under reclaim keeps its handle
+ * alive (the evict handler may still be using it) and records it in the
+ * head with OBJ_DEFERRED_HANDLE_TAG instead. The handle is freed when the
+ * reclaim of the zspage finishes.
  */
 #define OBJ_ALLOCATED_TAG 1
-#define OBJ_TAG_BITS 1
+#define OBJ_DEFERRED_HANDLE_TAG 2
+#define OBJ_TAG_BITS 2
+#define OBJ_TAG_MASK	((_AC(1, UL) << OBJ_TAG_BITS) - 1)
 #define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
@@ -134,6 +144,15 @@
 /* each chunk includes extra space to keep handle */
 #define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
 
+/*
+ * Pools with an evict handler poison the first word of an object's payload
+ * when the object is allocated and when it is freed under reclaim, so that
+ * the handler can tell objects that are not populated yet (or are already
+ * gone) from live ones. These are the same patterns ztier uses.
+ */
+#define ZS_POISON_ALLOC		0xBBBBBBBBBBBBBBBBUL
+#define ZS_POISON_FREE		0xAAAAAAAAAAAAAAAAUL
+
 /*
  * On systems with 4K page size, this gives 255 size classes! There is a
  * trader-off here:
@@ -158,7 +177,8 @@ enum fullness_group {
 	_ZS_NR_FULLNESS_GROUPS,
 
 	ZS_EMPTY,
-	ZS_FULL
+	ZS_FULL,
+	ZS_RECLAIM	/* isolated by zs_reclaim_page() */
 };
 
 enum zs_stat_type {
@@ -262,6 +282,19 @@ struct zs_pool {
 #ifdef CONFIG_ZSMALLOC_STAT
 	struct dentry *stat_dentry;
 #endif
+
+	/*
+	 * First pages of all zspages, most recently allocated from first.
+	 * Only maintained if the pool has an evict handler. Nests inside
+	 * class->lock.
+	 */
+	struct list_head lru;
+	spinlock_t lru_lock;
+
+#ifdef CONFIG_ZPOOL
+	struct zpool *zpool;
+	const struct zpool_ops *zpool_ops;
+#endif
 };
 
 /*
@@ -316,11 +349,21 @@ static void record_obj(unsigned long handle, unsigned long obj)
 
 #ifdef CONFIG_ZPOOL
 
+static int zs_reclaim_page(struct zs_pool *pool, unsigned int retries);
+
 static void *zs_zpool_create(const char *name, gfp_t gfp,
 			     const struct zpool_ops *zpool_ops,
 			     struct zpool *zpool)
 {
-	return zs_create_pool(name, gfp);
+	struct zs_pool *pool;
+
+	pool = zs_create_pool(name, gfp);
+	if (pool) {
+		pool->zpool = zpool;
+		pool->zpool_ops = zpool_ops;
+	}
+
+	return pool;
 }
 
 static void zs_zpool_destroy(void *pool)
@@ -342,7 +385,20 @@ static void zs_zpool_free(void *pool, unsigned long handle)
 static int zs_zpool_shrink(void *pool, unsigned int pages,
 			unsigned int *reclaimed)
 {
-	return -EINVAL;
+	unsigned int total = 0;
+	int ret = -EINVAL;
+
+	while (total < pages) {
+		ret = zs_reclaim_page(pool, 8);
+		if (ret < 0)
+			break;
+		total++;
+	}
+
+	if (reclaimed)
+		*reclaimed = total;
+
+	return ret;
 }
 
 static void *zs_zpool_map(void *pool, unsigned long handle,
@@ -391,6 +447,15 @@ static struct zpool_driver zs_zpool_driver = {
 MODULE_ALIAS("zpool-zsmalloc");
 #endif /* CONFIG_ZPOOL */
 
+static bool zs_pool_evictable(struct zs_pool *pool)
+{
+#ifdef CONFIG_ZPOOL
+	return pool->zpool_ops && pool->zpool_ops->evict;
+#else
+	return false;
+#endif
+}
+
 static unsigned int get_maxobj_per_zspage(int size, int pages_per_zspage)
 {
 	return pages_per_zspage * PAGE_SIZE / size;
@@ -611,9 +676,8 @@ static inline void zs_pool_stat_destroy(struct zs_pool *pool)
 /*
  * For each size class, zspages are divided into different groups
  * depending on how "full" they are. This was done so that we could
- * easily find empty or nearly empty zspages when we try to shrink
- * the pool (not yet implemented). This function returns fullness
- * status of the given page.
+ * easily find empty or nearly empty zspages when we try to compact
+ * the pool. This function returns fullness status of the given page.
  */
 static enum fullness_group get_fullness_group(struct page *page)
 {
@@ -715,6 +779,11 @@ static enum fullness_group fix_fullness_group(struct size_class *class,
 	BUG_ON(!is_first_page(page));
 
 	get_zspage_mapping(page, &class_idx, &currfg);
+
+	/* zs_reclaim_page() puts the zspage back when it is done with it */
+	if (currfg == ZS_RECLAIM)
+		return currfg;
+
 	newfg = get_fullness_group(page);
 	if (newfg == currfg)
 		goto out;
@@ -727,6 +796,35 @@ out:
 	return newfg;
 }
 
+/*
+ * Move the given zspage to the head of the pool's LRU list (adding it if
+ * it is not there yet). Caller must hold class->lock.
+ */
+static void lru_touch_zspage(struct zs_pool *pool, struct page *first_page)
+{
+	BUG_ON(!is_first_page(first_page));
+
+	spin_lock(&pool->lru_lock);
+	list_move(&first_page->ztier_lru, &pool->lru);
+	spin_unlock(&pool->lru_lock);
+}
+
+/*
+ * Remove the given zspage from the pool's LRU list before it is freed.
+ * Caller must hold class->lock.
+ */
+static void lru_remove_zspage(struct zs_pool *pool, struct page *first_page)
+{
+	BUG_ON(!is_first_page(first_page));
+
+	if (!zs_pool_evictable(pool))
+		return;
+
+	spin_lock(&pool->lru_lock);
+	list_del_init(&first_page->ztier_lru);
+	spin_unlock(&pool->lru_lock);
+}
+
 /*
  * We have to decide on how many pages to link together
  * to form a zspage for each size class. This is important
@@ -979,6 +1077,7 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 			set_page_private(page, 0);
 			first_page = page;
 			first_page->inuse = 0;
+			INIT_LIST_HEAD(&first_page->ztier_lru);
 		}
 		if (i == 1)
 			set_page_private(first_page, (unsigned long)page);
@@ -1373,6 +1472,33 @@ static unsigned long obj_malloc(struct page *first_page,
 	return obj;
 }
 
+/* Overwrite the first word of the payload of the given object */
+static void obj_poison(struct size_class *class, unsigned long obj,
+				unsigned long pattern)
+{
+	struct page *page;
+	unsigned long obj_idx, off;
+	unsigned long *word;
+	void *vaddr;
+
+	obj_to_location(obj, &page, &obj_idx);
+	off = obj_idx_to_offset(page, obj_idx, class->size);
+	if (!class->huge)
+		off += ZS_HANDLE_SIZE;
+
+	/* Both are ZS_ALIGN'ed, so the word never spans two pages */
+	if (off >= PAGE_SIZE) {
+		page = get_next_page(page);
+		BUG_ON(!page);
+		off -= PAGE_SIZE;
+	}
+
+	vaddr = kmap_atomic(page);
+	word = vaddr + off;
+	*word = pattern;
+	kunmap_atomic(vaddr);
+}
+
 
 /**
  * zs_malloc - Allocate block of given size from pool.
@@ -1424,6 +1550,15 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(class, first_page);
 	record_obj(handle, obj);
+
+	/*
+	 * Do this before dropping the lock, so that zs_reclaim_page() never
+	 * sees an allocated object that is not poisoned or populated yet.
+	 */
+	if (zs_pool_evictable(pool)) {
+		obj_poison(class, obj, ZS_POISON_ALLOC);
+		lru_touch_zspage(pool, first_page);
+	}
 	spin_unlock(&class->lock);
 
 	return handle;
@@ -1459,6 +1594,39 @@ static void obj_free(struct zs_pool *pool, struct size_class *class,
 	zs_stat_dec(class, OBJ_USED, 1);
 }
 
+/*
+ * Free an object of a zspage that is under reclaim. The freelist of such a
+ * zspage is rebuilt by restore_freelist() when reclaim is done, so just tag
+ * the head and keep the handle around until then.
+ */
+static void obj_free_deferred(struct size_class *class, unsigned long obj,
+				unsigned long handle)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+	void *vaddr;
+
+	BUG_ON(!obj);
+
+	obj_poison(class, obj, ZS_POISON_FREE);
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	if (class->huge) {
+		set_page_private(first_page, handle | OBJ_DEFERRED_HANDLE_TAG);
+	} else {
+		vaddr = kmap_atomic(f_page);
+		link = (struct link_free *)(vaddr + f_offset);
+		link->handle = handle | OBJ_DEFERRED_HANDLE_TAG;
+		kunmap_atomic(vaddr);
+	}
+	first_page->inuse--;
+	zs_stat_dec(class, OBJ_USED, 1);
+}
+
 void zs_free(struct zs_pool *pool, unsigned long handle)
 {
 	struct page *first_page, *f_page;
@@ -1479,6 +1647,14 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 	class = pool->size_class[class_idx];
 
 	spin_lock(&class->lock);
+	get_zspage_mapping(first_page, &class_idx, &fullness);
+	if (fullness == ZS_RECLAIM) {
+		obj_free_deferred(class, obj, handle);
+		spin_unlock(&class->lock);
+		unpin_tag(handle);
+		return;
+	}
+
 	obj_free(pool, class, obj);
 	fullness = fix_fullness_group(class, first_page);
 	if (fullness == ZS_EMPTY) {
@@ -1486,6 +1662,7 @@ void zs_free(struct zs_pool *pool, unsigned long handle)
 				class->size, class->pages_per_zspage));
 		atomic_long_sub(class->pages_per_zspage,
 				&pool->pages_allocated);
+		lru_remove_zspage(pool, first_page);
 		free_zspage(first_page);
 	}
 	spin_unlock(&class->lock);
@@ -1562,13 +1739,15 @@ static void zs_object_copy(unsigned long dst, unsigned long src,
 
 /*
  * Find alloced object in zspage from index object and
- * return handle.
+ * return handle. On success, @obj_idx is updated to the
+ * index of the object found.
  */
-static unsigned long find_alloced_obj(struct page *page, int index,
+static unsigned long find_alloced_obj(struct page *page, unsigned long *obj_idx,
 					struct size_class *class)
 {
 	unsigned long head;
 	int offset = 0;
+	unsigned long index = *obj_idx;
 	unsigned long handle = 0;
 	void *addr = kmap_atomic(page);
 
@@ -1590,6 +1769,7 @@ static unsigned long find_alloced_obj(struct page *page, int index,
 	}
 
 	kunmap_atomic(addr);
+	*obj_idx = index;
 	return handle;
 }
 
@@ -1615,7 +1795,7 @@ static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
 	int ret = 0;
 
 	while (1) {
-		handle = find_alloced_obj(s_page, index, class);
+		handle = find_alloced_obj(s_page, &index, class);
 		if (!handle) {
 			s_page = get_next_page(s_page);
 			if (!s_page)
@@ -1689,6 +1869,7 @@ static enum fullness_group putback_zspage(struct zs_pool *pool,
 		atomic_long_sub(class->pages_per_zspage,
 				&pool->pages_allocated);
 
+		lru_remove_zspage(pool, first_page);
 		free_zspage(first_page);
 	}
 
@@ -1795,6 +1976,172 @@ unsigned long zs_compact(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_compact);
 
+#ifdef CONFIG_ZPOOL
+/*
+ * Rebuild the freelist of a zspage coming back from reclaim, freeing the
+ * handles of objects that were freed in the meantime. Caller must hold
+ * class->lock.
+ */
+static void restore_freelist(struct zs_pool *pool, struct size_class *class,
+				struct page *first_page)
+{
+	struct page *page = first_page;
+	void *freelist = NULL;
+	int nr = 0;
+
+	/*
+	 * Only the first ->objects objects count; the last one may be a
+	 * partial object that must never be handed out.
+	 */
+	while (page) {
+		struct link_free *link;
+		unsigned long head, obj_idx = 0;
+		unsigned long off = 0;
+		void *vaddr;
+
+		if (!is_first_page(page))
+			off = page->index;
+
+		vaddr = kmap_atomic(page);
+		for (; off < PAGE_SIZE && nr < first_page->objects;
+				off += class->size, obj_idx++, nr++) {
+			link = (struct link_free *)(vaddr + off);
+			head = obj_to_head(class, page, link);
+			if (head & OBJ_ALLOCATED_TAG)
+				continue;
+
+			if (head & OBJ_DEFERRED_HANDLE_TAG)
+				free_handle(pool, head & ~OBJ_TAG_MASK);
+
+			link->next = freelist;
+			if (class->huge)
+				set_page_private(first_page, 0);
+			freelist = location_to_obj(page, obj_idx);
+		}
+		kunmap_atomic(vaddr);
+
+		page = get_next_page(page);
+	}
+
+	first_page->freelist = freelist;
+}
+
+/**
+ * zs_reclaim_page - evicts objects from a zspage and frees it
+ * @pool: pool from which a zspage will attempt to be evicted
+ * @retries: number of zspages on the LRU list for which eviction will
+ *	be attempted before failing
+ *
+ * This is the zsmalloc equivalent of zbud_reclaim_page() and
+ * ztier_reclaim_page(). The zspage least recently allocated from is taken
+ * off the LRU list and isolated from its size class (ZS_RECLAIM), which
+ * locks out both allocation and compaction. The evict handler is then
+ * called for each allocated object without holding any lock.
+ *
+ * The handler is expected to write the object back and zs_free() it. Since
+ * the handler may still be looking at an object while somebody else frees
+ * it, zs_free() does not release the zspage or the handle of an object of
+ * an isolated zspage; the handle is kept in the object head instead and
+ * released by restore_freelist(). Objects pinned by a concurrent user
+ * (zs_map_object(), or migration) are skipped, which makes the zspage fail
+ * to empty and go back to its class.
+ *
+ * Returns: 0 if a zspage is successfully freed, otherwise -EINVAL if there
+ * are no zspages to evict or an eviction handler is not registered,
+ * -EAGAIN if the retry limit was hit.
+ */
+static int zs_reclaim_page(struct zs_pool *pool, unsigned int retries)
+{
+	struct size_class *class;
+	struct page *first_page, *page;
+	enum fullness_group fullness;
+	unsigned long handle, obj_idx;
+	unsigned int class_idx;
+	int ret;
+
+	if (!zs_pool_evictable(pool) || retries == 0)
+		return -EINVAL;
+
+	while (retries-- > 0) {
+		spin_lock(&pool->lru_lock);
+		if (list_empty(&pool->lru)) {
+			spin_unlock(&pool->lru_lock);
+			return -EINVAL;
+		}
+
+		first_page = list_last_entry(&pool->lru, struct page,
+						ztier_lru);
+		get_zspage_mapping(first_page, &class_idx, &fullness);
+		class = pool->size_class[class_idx];
+
+		/*
+		 * lru_lock nests inside class->lock, so we can only trylock
+		 * here. On failure, give the zspage another round.
+		 */
+		if (!spin_trylock(&class->lock)) {
+			list_move(&first_page->ztier_lru, &pool->lru);
+			spin_unlock(&pool->lru_lock);
+			continue;
+		}
+		list_del_init(&first_page->ztier_lru);
+		spin_unlock(&pool->lru_lock);
+
+		/* Lock out allocation and compaction */
+		get_zspage_mapping(first_page, &class_idx, &fullness);
+		remove_zspage(first_page, class, fullness);
+		set_zspage_mapping(first_page, class_idx, ZS_RECLAIM);
+		spin_unlock(&class->lock);
+
+		ret = 0;
+		obj_idx = 0;
+		page = first_page;
+		while (page) {
+			handle = find_alloced_obj(page, &obj_idx, class);
+			if (!handle) {
+				page = get_next_page(page);
+				obj_idx = 0;
+				continue;
+			}
+
+			/*
+			 * The handle cannot go away until we are done (see
+			 * obj_free_deferred), and the handler needs to map it.
+			 */
+			unpin_tag(handle);
+
+			ret = pool->zpool_ops->evict(pool->zpool, handle);
+			if (ret)
+				break;
+
+			obj_idx++;
+			cond_resched();
+		}
+
+		spin_lock(&class->lock);
+		restore_freelist(pool, class, first_page);
+
+		if (!first_page->inuse) {
+			zs_stat_dec(class, OBJ_ALLOCATED, get_maxobj_per_zspage(
+					class->size, class->pages_per_zspage));
+			atomic_long_sub(class->pages_per_zspage,
+					&pool->pages_allocated);
+			free_zspage(first_page);
+			spin_unlock(&class->lock);
+			return 0;
+		}
+
+		/* Put the zspage back where it came from */
+		fullness = get_fullness_group(first_page);
+		insert_zspage(first_page, class, fullness);
+		set_zspage_mapping(first_page, class_idx, fullness);
+		lru_touch_zspage(pool, first_page);
+		spin_unlock(&class->lock);
+	}
+
+	return -EAGAIN;
+}
+#endif /* CONFIG_ZPOOL */
+
 void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
 {
 	memcpy(stats, &pool->stats, sizeof(struct zs_pool_stats));
@@ -1940,6 +2287,8 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 	}
 
 	pool->flags = flags;
+	INIT_LIST_HEAD(&pool->lru);
+	spin_lock_init(&pool->lru_lock);
 
 	if (zs_pool_stat_create(name, pool))
 		goto err;
@@ -35,7 +35,11 @@
 #include <linux/swapfile.h>
 #include <linux/crypto.h>
 #include <linux/mempool.h>
+#include <linux/vmalloc.h>
 #include <linux/zpool.h>
+#include <linux/memcontrol.h>
+#include <linux/zlock_stat.h>
+#include <linux/zswap.h>
 
 #include <linux/mm_types.h>
 #include <linux/page-flags.h>
@@ -86,9 +90,6 @@ static u64 zswap_compress_8_to_1; // >= 512B
 static u64 zswap_compress_4_to_1; // >= 1KB
 static u64 zswap_compress_2_to_1; // >= 2KB
 
-/* Debugging */
-static volatile u64 lock_holder; // don't optimize!
-
 /*********************************
 * tunables
 **********************************/
@@ -165,6 +166,7 @@ struct zswap_entry {
     unsigned int length;
     struct zswap_pool *pool;
     unsigned long handle;
+    struct memcg_zswap_owner *memcg_owner;
 };
 
 struct zswap_header {
@@ -178,13 +180,24 @@ struct zswap_header {
  */
 struct zswap_tree {
     struct rb_root rbroot;
-    spinlock_t lock;
+    struct zlock lock;
 };
 
 static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
 
+/* Contention statistics of the tree locks of all swap types */
+static struct zlock_class zswap_tree_lock_class;
+
 static struct radix_bitmap zswap_zero_bitmap[MAX_SWAPFILES];
 
+/*
+ * The swap type used by the benchmark module, while zswap_bench_busy. Swap
+ * types are handed out from 0 up, so the last one is the least likely to be
+ * wanted by a real swap area in the meantime.
+ */
+#define ZSWAP_BENCH_TYPE (MAX_SWAPFILES - 1)
+static int zswap_bench_busy;
+
 /* RCU-protected iteration */
 static LIST_HEAD(zswap_pools);
 /* protects zswap_pools list modification */
@@ -346,6 +359,7 @@ static void zswap_free_entry(struct zswap_entry *entry)
 {
     zpool_free(entry->pool->zpool, entry->handle);
     zswap_pool_put(entry->pool);
+    mem_cgroup_zswap_uncharge(entry->memcg_owner, entry->length);
     zswap_entry_cache_free(entry);
     atomic_dec(&zswap_stored_pages);
     zswap_update_total_size();
@@ -904,6 +918,11 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
         return -EINVAL;
     }
 
+    // The benchmark's entries have no swap slot to go to.
+    if (swp_type(swpentry) == ZSWAP_BENCH_TYPE &&
+        READ_ONCE(zswap_bench_busy))
+        return -EBUSY;
+
     if (swap_info[0]->max <= swp_offset(swpentry)
         || !swap_info[0]->swap_map[swp_offset(swpentry)]) {
         bool v = swap_info[0]->max > swp_offset(swpentry);
@@ -918,15 +937,13 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
     offset = swp_offset(swpentry);
 
     /* find and ref zswap entry */
-    spin_lock(&tree->lock);
-    lock_holder = 1;
+    zlock_lock(&tree->lock, ZLOCK_WRITEBACK);
     is_zeroed =
         radix_bitmap_is_init(&zswap_zero_bitmap[swp_type(swpentry)]) &&
         radix_bitmap_get(&zswap_zero_bitmap[swp_type(swpentry)],
             RADIX_BITMAP_VAL_MASK(offset));
     entry = zswap_entry_find_get(&tree->rbroot, offset);
-    lock_holder = 0x1A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 
     // There is no good reason to writeback a page of zeros.
     if (is_zeroed) {
@@ -983,8 +1000,7 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
     page_cache_release(page);
     zswap_written_back_pages++;
 
-    spin_lock(&tree->lock);
-    lock_holder = 2;
+    zlock_lock(&tree->lock, ZLOCK_WRITEBACK);
 
     /* drop local reference */
     zswap_entry_put(tree, entry);
@@ -1000,8 +1016,7 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
         zswap_entry_put(tree, entry);
     }
 
-    lock_holder = 0x2A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 
     goto end;
 
@@ -1013,11 +1028,9 @@ static int zswap_writeback_entry(struct zpool *pool, unsigned long handle)
     * it it either okay to return !0
     */
 fail:
-    spin_lock(&tree->lock);
-    lock_holder = 3;
+    zlock_lock(&tree->lock, ZLOCK_WRITEBACK);
     zswap_entry_put(tree, entry);
-    lock_holder = 0x3A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 
 end:
     return ret;
@@ -1039,6 +1052,90 @@ static int zswap_shrink(void)
     return ret;
 }
 
+/*********************************
+* store helpers
+**********************************/
+/*
+ * Make sure the zero-page bitmap of @type exists. Called with the tree lock
+ * held, which is dropped for the allocation.
+ */
+static int zswap_zero_bitmap_prepare(struct zswap_tree *tree, unsigned type)
+{
+    struct radix_bitmap_l0 *alloc_l0_bitmap;
+
+    if (radix_bitmap_is_init(&zswap_zero_bitmap[type]))
+        return 0;
+
+    zlock_unlock(&tree->lock);
+    alloc_l0_bitmap = mk_radix_bitmap_l0(
+                __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM);
+    zlock_lock(&tree->lock, ZLOCK_STORE);
+
+    if (!alloc_l0_bitmap) {
+        pr_err("bitmap creation failed, type %d\n", type);
+        return -ENOMEM;
+    }
+
+    if (radix_bitmap_is_init(&zswap_zero_bitmap[type]))
+        vfree(alloc_l0_bitmap);
+    else
+        radix_bitmap_init(&zswap_zero_bitmap[type], alloc_l0_bitmap);
+
+    return 0;
+}
+
+/*
+ * Record @offset as a zero page. Called with the tree lock held, which is
+ * dropped if a new level of the bitmap has to be allocated.
+ */
+static int zswap_zero_bitmap_set(struct zswap_tree *tree, unsigned type,
+                pgoff_t offset)
+{
+    struct radix_bitmap_l1 *alloc_l1_bitmap;
+
+    if (!radix_bitmap_set(&zswap_zero_bitmap[type],
+                RADIX_BITMAP_VAL_MASK(offset), NULL))
+        return 0;
+
+    // Allocate without the lock to avoid deadlock.
+    zlock_unlock(&tree->lock);
+    alloc_l1_bitmap = mk_radix_bitmap_l1(
+            __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM);
+    zlock_lock(&tree->lock, ZLOCK_STORE);
+
+    if (!alloc_l1_bitmap)
+        return -ENOMEM;
+
+    // Somebody may have added the level while we were not looking.
+    if (!radix_bitmap_set(&zswap_zero_bitmap[type],
+                RADIX_BITMAP_VAL_MASK(offset), NULL)) {
+        vfree(alloc_l1_bitmap);
+        return 0;
+    }
+
+    return radix_bitmap_set(&zswap_zero_bitmap[type],
+            RADIX_BITMAP_VAL_MASK(offset), alloc_l1_bitmap);
+}
+
+static void zswap_count_length(unsigned int length)
+{
+    if (length >= PAGE_SIZE >> 1) {
+        zswap_compress_2_to_1++;
+    } else if (length >= PAGE_SIZE >> 2) {
+        zswap_compress_4_to_1++;
+    } else if (length >= PAGE_SIZE >> 3) {
+        zswap_compress_8_to_1++;
+    } else if (length >= PAGE_SIZE >> 4) {
+        zswap_compress_16_to_1++;
+    } else if (length >= PAGE_SIZE >> 5) {
+        zswap_compress_32_to_1++;
+    } else if (length >= PAGE_SIZE >> 6) {
+        zswap_compress_64_to_1++;
+    } else {
+        zswap_compress_a_lot++;
+    }
+}
+
 /*********************************
 * frontswap hooks
 **********************************/
@@ -1048,8 +1145,6 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 {
     struct zswap_tree *tree = zswap_trees[type];
     struct zswap_entry *entry, *dupentry;
-    struct radix_bitmap_l0 *alloc_l0_bitmap;
-    struct radix_bitmap_l1 *alloc_l1_bitmap;
     struct crypto_comp *tfm;
     int ret;
     unsigned int dlen = PAGE_SIZE, len;
@@ -1073,22 +1168,11 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
      */
 
     // remove any entry from bitmap before putting elsewhere
-    spin_lock(&tree->lock);
-    lock_holder = 5;
-
-    if (!radix_bitmap_is_init(&zswap_zero_bitmap[type])) {
-        spin_unlock(&tree->lock);
-
-        alloc_l0_bitmap = mk_radix_bitmap_l0(
-                    __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM);
+    zlock_lock(&tree->lock, ZLOCK_STORE);
 
-        if (!alloc_l0_bitmap) {
-            pr_err("bitmap creation failed, type %d\n", type);
-            return -ENOMEM;
-        }
-
-        spin_lock(&tree->lock);
-        radix_bitmap_init(&zswap_zero_bitmap[type], alloc_l0_bitmap);
+    if (zswap_zero_bitmap_prepare(tree, type)) {
+        zlock_unlock(&tree->lock);
+        return -ENOMEM;
     }
 
     radix_bitmap_unset(&zswap_zero_bitmap[type],
@@ -1104,8 +1188,7 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
         zswap_entry_put(tree, entry);
     }
 
-    lock_holder = 0x5A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 
     /* reclaim space if needed */
     if (zswap_is_full()) {
@@ -1121,40 +1204,9 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
     /* if the page is all 0s, then we can just insert a bitmap entry */
     src = kmap_atomic(page);
     if (is_zeroed(src)) {
-        spin_lock(&tree->lock);
-        lock_holder = 4;
-
-        // Set a bit in the bitmap
-        bitmap_res = radix_bitmap_set(&zswap_zero_bitmap[type],
-               RADIX_BITMAP_VAL_MASK(offset),
-               NULL);
-
-        if (bitmap_res == -ENOMEM) {
-            lock_holder = 0x4A1;
-            spin_unlock(&tree->lock);
-
-            // Attempt to reserve some space. We need to do this without
-            // the lock to avoid deadlock.
-            alloc_l1_bitmap = mk_radix_bitmap_l1(
-                    __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM);
-
-            if (!alloc_l1_bitmap) {
-                //printk(KERN_INFO "ENOMEM 4\n");
-                kunmap_atomic(src);
-                return -ENOMEM;
-            }
-
-            spin_lock(&tree->lock);
-            lock_holder = 0x4A2;
-
-            // Retry set
-            bitmap_res = radix_bitmap_set(&zswap_zero_bitmap[type],
-                   RADIX_BITMAP_VAL_MASK(offset),
-                   alloc_l1_bitmap);
-        }
-
-        lock_holder = 0x4A3;
-        spin_unlock(&tree->lock);
+        zlock_lock(&tree->lock, ZLOCK_STORE);
+        bitmap_res = zswap_zero_bitmap_set(tree, type, offset);
+        zlock_unlock(&tree->lock);
 
         kunmap_atomic(src);
 
@@ -1223,27 +1275,13 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
     entry->offset = offset;
     entry->handle = handle;
     entry->length = dlen;
+    entry->memcg_owner = mem_cgroup_zswap_charge(page, dlen);
 
     /* update stats */
-    if (entry->length >= PAGE_SIZE >> 1) {
-        zswap_compress_2_to_1++;
-    } else if (entry->length >= PAGE_SIZE >> 2) {
-        zswap_compress_4_to_1++;
-    } else if (entry->length >= PAGE_SIZE >> 3) {
-        zswap_compress_8_to_1++;
-    } else if (entry->length >= PAGE_SIZE >> 4) {
-        zswap_compress_16_to_1++;
-    } else if (entry->length >= PAGE_SIZE >> 5) {
-        zswap_compress_32_to_1++;
-    } else if (entry->length >= PAGE_SIZE >> 6) {
-        zswap_compress_64_to_1++;
-    } else {
-        zswap_compress_a_lot++;
-    }
+    zswap_count_length(entry->length);
 
     /* map */
-    spin_lock(&tree->lock);
-    lock_holder = 6;
+    zlock_lock(&tree->lock, ZLOCK_STORE);
     do {
         ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
         if (ret == -EEXIST) {
@@ -1254,8 +1292,7 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
             //zswap_entry_put(tree, dupentry);
         }
     } while (ret == -EEXIST);
-    lock_holder = 0x6A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 
 success:
     /* update stats */
@@ -1289,15 +1326,13 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
     bool is_zeroed;
 
     /* find */
-    spin_lock(&tree->lock);
-    lock_holder = 7;
+    zlock_lock(&tree->lock, ZLOCK_LOAD);
     is_zeroed =
         radix_bitmap_is_init(&zswap_zero_bitmap[type]) &&
         radix_bitmap_get(&zswap_zero_bitmap[type],
                 RADIX_BITMAP_VAL_MASK(offset));
     entry = zswap_entry_find_get(&tree->rbroot, offset);
-    lock_holder = 0x7A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
     if (!entry && !is_zeroed) {
         /* entry was written back */
         return -1;
@@ -1325,15 +1360,268 @@ static int zswap_frontswap_load(unsigned type, pgoff_t offset,
     zpool_unmap_handle(entry->pool->zpool, entry->handle);
     BUG_ON(ret);
 
-    spin_lock(&tree->lock);
-    lock_holder = 8;
+    zlock_lock(&tree->lock, ZLOCK_LOAD);
     zswap_entry_put(tree, entry);
-    lock_holder = 0x8A;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 
     return 0;
 }
 
+/*
+ * Stores the @nr pages from @page on at @offset and the offsets after it as
+ * one unit, for the huge swap runs THPs are swapped out in. The pages are
+ * compressed and allocated in one pass on a single pool reference, and
+ * entered into the tree in one tree lock section. All pages are stored or
+ * none is.
+ */
+static int zswap_frontswap_store_batch(unsigned type, pgoff_t offset,
+                struct page *page, unsigned int nr)
+{
+    struct zswap_tree *tree = zswap_trees[type];
+    struct zswap_entry **entries, *entry, *dupentry;
+    struct zswap_pool *pool;
+    struct crypto_comp *tfm;
+    struct zswap_header *zhdr;
+    unsigned int i, j, dlen, nr_zero = 0;
+    unsigned long handle;
+    bool zero;
+    u8 *src, *dst;
+    int ret;
+
+    if (!zswap_enabled || !tree)
+        return -ENODEV;
+
+    // A NULL slot stands for a zero page.
+    entries = kcalloc(nr, sizeof(*entries), GFP_NOWAIT | __GFP_NOWARN);
+    if (!entries) {
+        zswap_reject_kmemcache_fail++;
+        return -ENOMEM;
+    }
+
+    /* drop any old copies, as zswap_frontswap_store() does */
+    zlock_lock(&tree->lock, ZLOCK_STORE);
+    ret = zswap_zero_bitmap_prepare(tree, type);
+    if (ret) {
+        zlock_unlock(&tree->lock);
+        goto free_entries;
+    }
+    for (i = 0; i < nr; i++) {
+        radix_bitmap_unset(&zswap_zero_bitmap[type],
+                RADIX_BITMAP_VAL_MASK(offset + i));
+        entry = zswap_rb_search(&tree->rbroot, offset + i);
+        if (entry) {
+            zswap_rb_erase(&tree->rbroot, entry);
+            zswap_entry_put(tree, entry);
+        }
+    }
+    zlock_unlock(&tree->lock);
+
+    /* reclaim space if needed */
+    if (zswap_is_full()) {
+        zswap_pool_limit_hit++;
+        if (zswap_shrink()) {
+            zswap_reject_reclaim_fail++;
+            ret = -ENOMEM;
+            goto free_entries;
+        }
+    }
+
+    pool = zswap_pool_current_get();
+    if (!pool) {
+        ret = -EINVAL;
+        goto free_entries;
+    }
+
+    /* compress and allocate */
+    for (i = 0; i < nr; i++) {
+        src = kmap_atomic(page + i);
+        zero = is_zeroed(src);
+        kunmap_atomic(src);
+        if (zero) {
+            nr_zero++;
+            continue;
+        }
+
+        entry = zswap_entry_cache_alloc(GFP_KERNEL);
+        if (!entry) {
+            zswap_reject_kmemcache_fail++;
+            ret = -ENOMEM;
+            goto unwind;
+        }
+
+        dlen = PAGE_SIZE;
+        dst = get_cpu_var(zswap_dstmem);
+        tfm = *get_cpu_ptr(pool->tfm);
+        src = kmap_atomic(page + i);
+        ret = crypto_comp_compress(tfm, src, PAGE_SIZE, dst, &dlen);
+        kunmap_atomic(src);
+        put_cpu_ptr(pool->tfm);
+        if (ret) {
+            ret = -EINVAL;
+            goto put_dstmem;
+        }
+
+        ret = zpool_malloc(pool->zpool, dlen + sizeof(struct zswap_header),
+                   __GFP_NORETRY | __GFP_NOWARN | __GFP_KSWAPD_RECLAIM,
+                   &handle);
+        if (ret) {
+            if (ret == -ENOSPC)
+                zswap_reject_compress_poor++;
+            else
+                zswap_reject_alloc_fail++;
+            goto put_dstmem;
+        }
+        zhdr = zpool_map_handle(pool->zpool, handle, ZPOOL_MM_RW);
+        zhdr->swpentry = swp_entry(type, offset + i);
+        memcpy(zhdr + 1, dst, dlen);
+        zpool_unmap_handle(pool->zpool, handle);
+        put_cpu_var(zswap_dstmem);
+
+        // We hold a reference, so this can't fail.
+        WARN_ON(!zswap_pool_get(pool));
+        entry->pool = pool;
+        entry->offset = offset + i;
+        entry->handle = handle;
+        entry->length = dlen;
+        entry->memcg_owner = mem_cgroup_zswap_charge(page + i, dlen);
+        entries[i] = entry;
+    }
+
+    /* map, zero pages first as only those can fail */
+    zlock_lock(&tree->lock, ZLOCK_STORE);
+    for (i = 0; i < nr; i++) {
+        if (entries[i])
+            continue;
+        ret = zswap_zero_bitmap_set(tree, type, offset + i);
+        if (ret) {
+            for (j = 0; j < i; j++)
+                if (!entries[j])
+                    radix_bitmap_unset(&zswap_zero_bitmap[type],
+                            RADIX_BITMAP_VAL_MASK(offset + j));
+            zlock_unlock(&tree->lock);
+            goto unwind_all;
+        }
+    }
+    for (i = 0; i < nr; i++) {
+        if (!entries[i])
+            continue;
+        ret = zswap_rb_insert(&tree->rbroot, entries[i], &dupentry);
+        BUG_ON(ret == -EEXIST);
+    }
+    zlock_unlock(&tree->lock);
+
+    /* update stats */
+    for (i = 0; i < nr; i++)
+        if (entries[i])
+            zswap_count_length(entries[i]->length);
+    zswap_compress_zeros += nr_zero;
+    atomic_add(nr, &zswap_stored_pages);
+    zswap_update_total_size();
+
+    zswap_pool_put(pool);
+    kfree(entries);
+    return 0;
+
+put_dstmem:
+    put_cpu_var(zswap_dstmem);
+    zswap_entry_cache_free(entry);
+unwind:
+    nr = i;
+unwind_all:
+    for (i = 0; i < nr; i++) {
+        entry = entries[i];
+        if (!entry)
+            continue;
+        zpool_free(pool->zpool, entry->handle);
+        zswap_pool_put(pool);
+        mem_cgroup_zswap_uncharge(entry->memcg_owner, entry->length);
+        zswap_entry_cache_free(entry);
+    }
+    zswap_pool_put(pool);
+free_entries:
+    kfree(entries);
+    return ret;
+}
+
+/*
+ * Loads the @nr pages at @offset and the offsets after it into the pages
+ * from @page on, taking the tree lock once to find them all and once to
+ * let go of them. Fails without touching the pages if any of them is not
+ * in zswap.
+ */
+static int zswap_frontswap_load_batch(unsigned type, pgoff_t offset,
+                struct page *page, unsigned int nr)
+{
+    struct zswap_tree *tree = zswap_trees[type];
+    struct zswap_entry **entries, *entry;
+    struct crypto_comp *tfm;
+    unsigned int i, j, dlen;
+    bool zero_init;
+    u8 *src, *dst;
+    int ret = 0;
+
+    if (!tree)
+        return -1;
+
+    // A NULL slot stands for a zero page.
+    entries = kcalloc(nr, sizeof(*entries), GFP_KERNEL);
+    if (!entries)
+        return -1;
+
+    /* find */
+    zlock_lock(&tree->lock, ZLOCK_LOAD);
+    zero_init = radix_bitmap_is_init(&zswap_zero_bitmap[type]);
+    for (i = 0; i < nr; i++) {
+        if (zero_init && radix_bitmap_get(&zswap_zero_bitmap[type],
+                    RADIX_BITMAP_VAL_MASK(offset + i)))
+            continue;
+        entries[i] = zswap_entry_find_get(&tree->rbroot, offset + i);
+        if (!entries[i]) {
+            /* written back */
+            for (j = 0; j < i; j++)
+                if (entries[j])
+                    zswap_entry_put(tree, entries[j]);
+            ret = -1;
+            break;
+        }
+    }
+    zlock_unlock(&tree->lock);
+    if (ret)
+        goto out;
+
+    /* decompress */
+    for (i = 0; i < nr; i++) {
+        entry = entries[i];
+        if (!entry) {
+            clear_highpage(page + i);
+            continue;
+        }
+
+        dlen = PAGE_SIZE;
+        dst = kmap_atomic(page + i);
+        src = (u8 *)zpool_map_handle(entry->pool->zpool, entry->handle,
+                ZPOOL_MM_RO) + sizeof(struct zswap_header);
+        tfm = *get_cpu_ptr(entry->pool->tfm);
+        ret = crypto_comp_decompress(tfm, src, entry->length, dst, &dlen);
+        put_cpu_ptr(entry->pool->tfm);
+        kunmap_atomic(dst);
+        zpool_unmap_handle(entry->pool->zpool, entry->handle);
+        BUG_ON(ret);
+
+        cond_resched();
+    }
+
+    zlock_lock(&tree->lock, ZLOCK_LOAD);
+    for (i = 0; i < nr; i++)
+        if (entries[i])
+            zswap_entry_put(tree, entries[i]);
+    zlock_unlock(&tree->lock);
+
+out:
+    kfree(entries);
+    return ret;
+}
+
 /* frees an entry in zswap */
 static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
 {
@@ -1341,8 +1629,7 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
     struct zswap_entry *entry;
 
     /* find */
-    spin_lock(&tree->lock);
-    lock_holder = 9;
+    zlock_lock(&tree->lock, ZLOCK_INVALIDATE);
     // Invalidate in the bitmap
     if (radix_bitmap_is_init(&zswap_zero_bitmap[type])) {
         radix_bitmap_unset(&zswap_zero_bitmap[type],
@@ -1353,8 +1640,7 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
     entry = zswap_rb_search(&tree->rbroot, offset);
     if (!entry) {
         /* entry was written back */
-        lock_holder = 0x9A1;
-        spin_unlock(&tree->lock);
+        zlock_unlock(&tree->lock);
         return;
     }
 
@@ -1364,8 +1650,7 @@ static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
     /* drop the initial reference from entry creation */
     zswap_entry_put(tree, entry);
 
-    lock_holder = 0x9A2;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
 }
 
 /* frees all zswap entries for the given swap type */
@@ -1377,8 +1662,7 @@ static void zswap_frontswap_invalidate_area(unsigned type)
     if (!tree)
         return;
 
-    spin_lock(&tree->lock);
-    lock_holder = 0xA;
+    zlock_lock(&tree->lock, ZLOCK_INVALIDATE);
     // Invalidate the entire bitmap
     if (radix_bitmap_is_init(&zswap_zero_bitmap[type])) {
         radix_bitmap_clear(&zswap_zero_bitmap[type]);
@@ -1388,8 +1672,7 @@ static void zswap_frontswap_invalidate_area(unsigned type)
     rbtree_postorder_for_each_entry_safe(entry, n, &tree->rbroot, rbnode)
         zswap_free_entry(entry);
     tree->rbroot = RB_ROOT;
-    lock_holder = 0xAA;
-    spin_unlock(&tree->lock);
+    zlock_unlock(&tree->lock);
     kfree(tree);
     zswap_trees[type] = NULL;
 }
@@ -1405,8 +1688,7 @@ static void zswap_frontswap_init(unsigned type)
     }
 
     tree->rbroot = RB_ROOT;
-    spin_lock_init(&tree->lock);
-    lock_holder = 0;
+    zlock_init(&tree->lock, &zswap_tree_lock_class);
     zswap_trees[type] = tree;
 }
 
@@ -1415,9 +1697,105 @@ static struct frontswap_ops zswap_frontswap_ops = {
     .load = zswap_frontswap_load,
     .invalidate_page = zswap_frontswap_invalidate_page,
     .invalidate_area = zswap_frontswap_invalidate_area,
+    .store_batch = zswap_frontswap_store_batch,
+    .load_batch = zswap_frontswap_load_batch,
     .init = zswap_frontswap_init
 };
 
+/*********************************
+* benchmark hooks
+**********************************/
+int zswap_bench_open(void)
+{
+    int type = ZSWAP_BENCH_TYPE;
+
+    if (cmpxchg(&zswap_bench_busy, 0, 1))
+        return -EBUSY;
+
+    if (swap_info[type] || zswap_trees[type]) {
+        smp_store_release(&zswap_bench_busy, 0);
+        return -EBUSY;
+    }
+
+    zswap_frontswap_init(type);
+    if (!zswap_trees[type]) {
+        smp_store_release(&zswap_bench_busy, 0);
+        return -ENOMEM;
+    }
+
+    zlock_stats_get();
+    return type;
+}
+EXPORT_SYMBOL_GPL(zswap_bench_open);
+
+void zswap_bench_close(int type)
+{
+    zlock_stats_put();
+
+    zswap_frontswap_invalidate_area(type);
+    if (radix_bitmap_is_init(&zswap_zero_bitmap[type])) {
+        radix_bitmap_destroy(&zswap_zero_bitmap[type]);
+        memset(&zswap_zero_bitmap[type], 0, sizeof(struct radix_bitmap));
+    }
+    zswap_update_total_size();
+
+    smp_store_release(&zswap_bench_busy, 0);
+}
+EXPORT_SYMBOL_GPL(zswap_bench_close);
+
+int zswap_bench_store(int type, pgoff_t offset, struct page *page)
+{
+    return zswap_frontswap_store(type, offset, page);
+}
+EXPORT_SYMBOL_GPL(zswap_bench_store);
+
+int zswap_bench_load(int type, pgoff_t offset, struct page *page)
+{
+    return zswap_frontswap_load(type, offset, page);
+}
+EXPORT_SYMBOL_GPL(zswap_bench_load);
+
+int zswap_bench_store_batch(int type, pgoff_t offset, struct page *page,
+                unsigned int nr)
+{
+    return zswap_frontswap_store_batch(type, offset, page, nr);
+}
+EXPORT_SYMBOL_GPL(zswap_bench_store_batch);
+
+int zswap_bench_load_batch(int type, pgoff_t offset, struct page *page,
+                unsigned int nr)
+{
+    return zswap_frontswap_load_batch(type, offset, page, nr);
+}
+EXPORT_SYMBOL_GPL(zswap_bench_load_batch);
+
+void zswap_bench_invalidate(int type, pgoff_t offset)
+{
+    zswap_frontswap_invalidate_page(type, offset);
+}
+EXPORT_SYMBOL_GPL(zswap_bench_invalidate);
+
+u64 zswap_bench_pool_size(void)
+{
+    zswap_update_total_size();
+    return zswap_pool_total_size;
+}
+EXPORT_SYMBOL_GPL(zswap_bench_pool_size);
+
+void zswap_bench_lock_stats(u64 *acquired, u64 *hold_ns)
+{
+    struct zlock_site_stats sum;
+    int site;
+
+    *acquired = *hold_ns = 0;
+    for (site = 0; site < ZLOCK_NR_SITES; site++) {
+        zlock_class_read(&zswap_tree_lock_class, site, &sum);
+        *acquired += sum.acquired;
+        *hold_ns += sum.hold_ns;
+    }
+}
+EXPORT_SYMBOL_GPL(zswap_bench_lock_stats);
+
 /*********************************
 * debugfs functions
 **********************************/
@@ -1453,6 +1831,8 @@ static int __init zswap_debugfs_init(void)
             zswap_debugfs_root, &zswap_pool_total_size);
     debugfs_create_atomic_t("stored_pages", S_IRUGO,
             zswap_debugfs_root, &zswap_stored_pages);
+    debugfs_create_file("lock_stats", S_IRUGO | S_IWUSR,
+            zswap_debugfs_root, NULL, &zlock_stats_fops);
 
     debugfs_create_u64("compress_zeros", S_IRUGO,
             zswap_debugfs_root, &zswap_compress_zeros);
@@ -1497,6 +1877,11 @@ static int __init init_zswap(void)
 
     zswap_init_started = true;
 
+    if (zlock_class_register(&zswap_tree_lock_class, "zswap_tree")) {
+        pr_err("lock stats allocation failed\n");
+        goto lock_class_fail;
+    }
+
     if (zswap_entry_cache_create()) {
         pr_err("entry cache creation failed\n");
         goto cache_fail;
@@ -1540,6 +1925,8 @@ pool_fail:
 dstmem_fail:
     zswap_entry_cache_destroy();
 cache_fail:
+    zlock_class_unregister(&zswap_tree_lock_class);
+lock_class_fail:
     return -ENOMEM;
 }
 /* must be late so crypto has time to come up */
@@ -0,0 +1,561 @@
+/*
+ * zswap_bench.c - zswap microbenchmark
+ *
+ * Drives zswap's store, load and invalidate paths directly from a number of
+ * kernel threads, with page contents drawn from a chosen distribution, or
+ * with batch > 1 the batched store and load that THP swap runs use, and
+ * reports for each path the throughput and latency percentiles, along with
+ * how densely the pool holds the stored pages and for what share of the
+ * time the zswap tree lock was held.
+ *
+ * Each thread works on its own range of offsets of a swap type reserved
+ * for the benchmark (see zswap_bench_open()), so nothing here touches real
+ * swap entries, but the pool and its limit are shared with the rest of the
+ * system: run it on an otherwise idle machine.
+ *
+ * Set the parameters in /sys/module/zswap_bench/parameters/, then
+ *   echo 1 > /sys/kernel/debug/zswap_bench/run
+ *   cat /sys/kernel/debug/zswap_bench/result
+ * tools/testing/selftests/zswap/zswap_bench does that over a matrix of
+ * distributions and thread counts.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/zswap.h>
+
+// Distinct source pages per thread; stores cycle through them.
+#define BENCH_SRC_PAGES 64
+
+// The largest batch, that of a THP swap run on x86.
+#define BENCH_MAX_BATCH 512
+
+#define BENCH_MAX_THREADS 256
+#define BENCH_MAX_OPS (1UL << 24)
+
+/*********************************
+* parameters
+**********************************/
+
+/* Page contents: zero, same (one repeated word), text or random */
+static char *pattern = "text";
+module_param(pattern, charp, 0644);
+
+static unsigned int threads = 1;
+module_param(threads, uint, 0644);
+
+/* Pages stored, loaded and invalidated by each thread */
+static unsigned long pages = 16384;
+module_param(pages, ulong, 0644);
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0644);
+
+/*
+ * Pages per store and load call. Above 1, the batched entry points THP swap
+ * runs use are measured instead; pages must be a multiple of it.
+ */
+static unsigned int batch = 1;
+module_param(batch, uint, 0644);
+
+/*********************************
+* page contents
+**********************************/
+
+enum bench_pattern {
+    PATTERN_ZERO,
+    PATTERN_SAME,
+    PATTERN_TEXT,
+    PATTERN_RANDOM,
+    NR_PATTERNS,
+};
+
+static const char * const pattern_names[NR_PATTERNS] = {
+    [PATTERN_ZERO]      = "zero",
+    [PATTERN_SAME]      = "same",
+    [PATTERN_TEXT]      = "text",
+    [PATTERN_RANDOM]    = "random",
+};
+
+// Enough vocabulary that the text compresses roughly like prose does.
+static const char * const bench_words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as",
+    "was", "with", "be", "by", "on", "not", "he", "this", "are", "or",
+    "his", "from", "at", "which", "but", "have", "an", "had", "they", "you",
+    "were", "their", "one", "all", "we", "can", "her", "has", "there",
+    "been", "if", "more", "when", "will", "would", "who", "so", "no",
+    "memory", "page", "swap", "compressed", "kernel", "process", "time",
+    "system", "number", "between", "through", "however", "because",
+    "simulation", "allocation", "performance", "throughput", "latency",
+};
+
+static int parse_pattern(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NR_PATTERNS; i++)
+        if (sysfs_streq(name, pattern_names[i]))
+            return i;
+    return -EINVAL;
+}
+
+static void fill_text(u8 *dst, struct rnd_state *rnd)
+{
+    unsigned int pos = 0, len;
+    const char *word;
+
+    while (pos < PAGE_SIZE) {
+        word = bench_words[prandom_u32_state(rnd) % ARRAY_SIZE(bench_words)];
+        len = min_t(unsigned int, strlen(word), PAGE_SIZE - pos);
+        memcpy(dst + pos, word, len);
+        pos += len;
+        if (pos < PAGE_SIZE)
+            dst[pos++] = prandom_u32_state(rnd) % 12 ? ' ' : '\n';
+    }
+}
+
+static void fill_page(struct page *page, enum bench_pattern pat,
+        struct rnd_state *rnd)
+{
+    u8 *dst = kmap(page);
+    u64 word, *words = (u64 *)dst;
+    int i;
+
+    switch (pat) {
+    case PATTERN_ZERO:
+        memset(dst, 0, PAGE_SIZE);
+        break;
+    case PATTERN_SAME:
+        // Never 0, which zswap would store in its bitmap instead.
+        word = ((u64)prandom_u32_state(rnd) << 32) | 1;
+        for (i = 0; i < PAGE_SIZE / sizeof(u64); i++)
+            words[i] = word;
+        break;
+    case PATTERN_TEXT:
+        fill_text(dst, rnd);
+        break;
+    case PATTERN_RANDOM:
+        prandom_bytes_state(rnd, dst, PAGE_SIZE);
+        break;
+    default:
+        BUG();
+    }
+
+    kunmap(page);
+}
+
+/*********************************
+* threads
+**********************************/
+
+enum bench_phase {
+    PHASE_STORE,
+    PHASE_LOAD,
+    PHASE_INVALIDATE,
+    NR_PHASES,
+};
+
+static const char * const phase_names[NR_PHASES] = {
+    [PHASE_STORE]       = "store",
+    [PHASE_LOAD]        = "load",
+    [PHASE_INVALIDATE]  = "invalidate",
+};
+
+struct bench_thread {
+    int id;
+    struct task_struct *task;
+    // bench_nr_src and batch consecutive pages.
+    struct page *src;
+    struct page *dst;
+
+    // Stores zswap turned down, and the first error it gave.
+    unsigned long rejected;
+    int error;
+    // Loads that found nothing, or the wrong contents.
+    unsigned long missing;
+    unsigned long mismatched;
+};
+
+static int bench_type;
+static enum bench_phase bench_phase;
+// Latency of every call of the current phase, in ns.
+static u32 *bench_lat;
+// Source pages per thread, a multiple of the batch.
+static unsigned int bench_nr_src;
+
+/* Pages handled per call in @phase. */
+static unsigned int bench_step(enum bench_phase phase)
+{
+    return phase == PHASE_INVALIDATE ? 1 : batch;
+}
+
+static atomic_t bench_running;
+static DECLARE_WAIT_QUEUE_HEAD(bench_wait);
+
+static pgoff_t bench_offset(struct bench_thread *t, unsigned long i)
+{
+    return (pgoff_t)t->id * pages + i;
+}
+
+/* Checks the @nr pages loaded into dst against the pages stored from @i. */
+static unsigned int bench_check(struct bench_thread *t, unsigned long i,
+        unsigned int nr)
+{
+    unsigned int j, bad = 0;
+    void *a, *b;
+
+    for (j = 0; j < nr; j++) {
+        a = kmap(t->dst + j);
+        b = kmap(t->src + (i + j) % bench_nr_src);
+        bad += !!memcmp(a, b, PAGE_SIZE);
+        kunmap(t->src + (i + j) % bench_nr_src);
+        kunmap(t->dst + j);
+    }
+    return bad;
+}
+
+static int bench_thread_fn(void *data)
+{
+    struct bench_thread *t = data;
+    unsigned int step = bench_step(bench_phase);
+    u32 *lat = bench_lat + (unsigned long)t->id * (pages / step);
+    struct page *src;
+    unsigned long i;
+    u64 start;
+    int ret;
+
+    for (i = 0; i < pages; i += step) {
+        pgoff_t offset = bench_offset(t, i);
+
+        // The batch never wraps, as bench_nr_src is a multiple of it.
+        src = t->src + i % bench_nr_src;
+        start = ktime_get_ns();
+        switch (bench_phase) {
+        case PHASE_STORE:
+            if (step > 1)
+                ret = zswap_bench_store_batch(bench_type, offset, src, step);
+            else
+                ret = zswap_bench_store(bench_type, offset, src);
+            lat[i / step] = min_t(u64, ktime_get_ns() - start, U32_MAX);
+            if (ret) {
+                t->rejected += step;
+                if (!t->error)
+                    t->error = ret;
+            }
+            break;
+        case PHASE_LOAD:
+            if (step > 1)
+                ret = zswap_bench_load_batch(bench_type, offset, t->dst, step);
+            else
+                ret = zswap_bench_load(bench_type, offset, t->dst);
+            lat[i / step] = min_t(u64, ktime_get_ns() - start, U32_MAX);
+            if (ret)
+                t->missing += step;
+            else
+                t->mismatched += bench_check(t, i, step);
+            break;
+        case PHASE_INVALIDATE:
+            zswap_bench_invalidate(bench_type, offset);
+            lat[i] = min_t(u64, ktime_get_ns() - start, U32_MAX);
+            break;
+        default:
+            BUG();
+        }
+
+        cond_resched();
+    }
+
+    if (atomic_dec_and_test(&bench_running))
+        wake_up(&bench_wait);
+    return 0;
+}
+
+/*********************************
+* running and reporting
+**********************************/
+
+static DEFINE_MUTEX(bench_mutex);
+static char bench_result[2048];
+static size_t bench_result_len;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static u32 percentile(u32 *sorted, unsigned long n, unsigned int pct)
+{
+    return n ? sorted[(n - 1) * pct / 100] : 0;
+}
+
+__printf(1, 2) static void bench_report(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    bench_result_len += vscnprintf(bench_result + bench_result_len,
+                                   sizeof(bench_result) - bench_result_len,
+                                   fmt, args);
+    va_end(args);
+}
+
+/*
+ * Runs one phase on all threads at once and reports on it: pages per second,
+ * and the latency of the calls, each of which handles a batch of pages.
+ */
+static int bench_phase_run(struct bench_thread *ts, enum bench_phase phase)
+{
+    unsigned long n = (unsigned long)threads * (pages / bench_step(phase));
+    u64 start, elapsed, acq0, hold0, acq1, hold1;
+    unsigned int i;
+
+    bench_phase = phase;
+    atomic_set(&bench_running, threads);
+
+    for (i = 0; i < threads; i++) {
+        ts[i].task = kthread_create(bench_thread_fn, &ts[i],
+                                    "zswap_bench/%u", i);
+        if (IS_ERR(ts[i].task)) {
+            // Let the ones already created run, so that all offsets are
+            // in a known state for the next phase.
+            atomic_sub(threads - i, &bench_running);
+            while (i--)
+                wake_up_process(ts[i].task);
+            wait_event(bench_wait, !atomic_read(&bench_running));
+            return -ENOMEM;
+        }
+    }
+
+    zswap_bench_lock_stats(&acq0, &hold0);
+    start = ktime_get_ns();
+    for (i = 0; i < threads; i++)
+        wake_up_process(ts[i].task);
+    wait_event(bench_wait, !atomic_read(&bench_running));
+    elapsed = max_t(u64, ktime_get_ns() - start, 1);
+    zswap_bench_lock_stats(&acq1, &hold1);
+
+    sort(bench_lat, n, sizeof(*bench_lat), cmp_u32, NULL);
+
+    bench_report("%-10s %12llu %10u %10u %10u %7llu.%llu %8llu\n",
+                 phase_names[phase],
+                 div64_u64((u64)threads * pages * NSEC_PER_SEC, elapsed),
+                 percentile(bench_lat, n, 50), percentile(bench_lat, n, 99),
+                 n ? bench_lat[n - 1] : 0,
+                 div64_u64((hold1 - hold0) * 100, elapsed),
+                 div64_u64((hold1 - hold0) * 1000, elapsed) % 10,
+                 acq1 - acq0);
+    return 0;
+}
+
+static void bench_free_threads(struct bench_thread *ts)
+{
+    unsigned int i;
+
+    for (i = 0; i < threads; i++) {
+        if (ts[i].src)
+            __free_pages(ts[i].src, get_order(bench_nr_src * PAGE_SIZE));
+        if (ts[i].dst)
+            __free_pages(ts[i].dst, get_order(batch * PAGE_SIZE));
+    }
+    vfree(ts);
+}
+
+static struct bench_thread *bench_alloc_threads(enum bench_pattern pat)
+{
+    struct bench_thread *ts;
+    struct rnd_state rnd;
+    unsigned int i, j;
+
+    ts = vzalloc(threads * sizeof(*ts));
+    if (!ts)
+        return NULL;
+
+    // Batches are handed over as runs of consecutive pages.
+    for (i = 0; i < threads; i++) {
+        ts[i].id = i;
+        prandom_seed_state(&rnd, ((u64)seed << 32) | i);
+
+        ts[i].dst = alloc_pages(GFP_KERNEL, get_order(batch * PAGE_SIZE));
+        if (!ts[i].dst)
+            goto fail;
+        ts[i].src = alloc_pages(GFP_KERNEL,
+                                get_order(bench_nr_src * PAGE_SIZE));
+        if (!ts[i].src)
+            goto fail;
+        for (j = 0; j < bench_nr_src; j++)
+            fill_page(ts[i].src + j, pat, &rnd);
+    }
+
+    return ts;
+
+fail:
+    bench_free_threads(ts);
+    return NULL;
+}
+
+static int bench_run(void)
+{
+    struct bench_thread *ts;
+    unsigned long rejected = 0, missing = 0, mismatched = 0, stored;
+    u64 pool_before, pool_after;
+    int pat, error = 0, ret;
+    unsigned int i;
+
+    pat = parse_pattern(pattern);
+    if (pat < 0)
+        return -EINVAL;
+    if (!threads || threads > BENCH_MAX_THREADS || !pages ||
+        pages > BENCH_MAX_OPS / threads)
+        return -EINVAL;
+    if (!batch || batch > BENCH_MAX_BATCH || pages % batch)
+        return -EINVAL;
+    bench_nr_src = roundup(BENCH_SRC_PAGES, batch);
+
+    bench_lat = vmalloc((unsigned long)threads * pages * sizeof(*bench_lat));
+    if (!bench_lat)
+        return -ENOMEM;
+
+    ret = -ENOMEM;
+    ts = bench_alloc_threads(pat);
+    if (!ts)
+        goto free_lat;
+
+    ret = zswap_bench_open();
+    if (ret < 0)
+        goto free_threads;
+    bench_type = ret;
+
+    bench_result_len = 0;
+    bench_report("pattern %s threads %u pages %lu batch %u\n",
+                 pattern_names[pat], threads, pages, batch);
+    bench_report("%-10s %12s %10s %10s %10s %9s %8s\n", "op", "pages/s",
+                 "p50(ns)", "p99(ns)", "max(ns)", "lock(%)", "locks");
+
+    pool_before = zswap_bench_pool_size();
+    ret = bench_phase_run(ts, PHASE_STORE);
+    pool_after = zswap_bench_pool_size();
+    if (!ret)
+        ret = bench_phase_run(ts, PHASE_LOAD);
+    if (!ret)
+        ret = bench_phase_run(ts, PHASE_INVALIDATE);
+
+    for (i = 0; i < threads; i++) {
+        rejected += ts[i].rejected;
+        missing += ts[i].missing;
+        mismatched += ts[i].mismatched;
+        if (!error)
+            error = ts[i].error;
+    }
+
+    stored = (unsigned long)threads * pages - rejected;
+    bench_report("pool bytes per stored page %llu (%lu stored)\n",
+                 stored && pool_after > pool_before ?
+                 div64_u64(pool_after - pool_before, stored) : 0, stored);
+    bench_report("rejected %lu (first error %d) missing %lu mismatched %lu\n",
+                 rejected, error, missing, mismatched);
+
+    zswap_bench_close(bench_type);
+
+    if (!ret && mismatched)
+        pr_err("%lu pages came back from zswap corrupted\n", mismatched);
+    // Nothing stored at all is almost always zswap being disabled.
+    if (!ret && !stored)
+        ret = error;
+
+free_threads:
+    bench_free_threads(ts);
+free_lat:
+    vfree(bench_lat);
+    bench_lat = NULL;
+    return ret;
+}
+
+/*********************************
+* debugfs
+**********************************/
+
+static struct dentry *bench_debugfs_root;
+
+static ssize_t bench_run_write(struct file *file, const char __user *buf,
+        size_t count, loff_t *ppos)
+{
+    int ret;
+
+    mutex_lock(&bench_mutex);
+    ret = bench_run();
+    mutex_unlock(&bench_mutex);
+
+    return ret ? ret : count;
+}
+
+static const struct file_operations bench_run_fops = {
+    .owner  = THIS_MODULE,
+    .open   = simple_open,
+    .write  = bench_run_write,
+    .llseek = noop_llseek,
+};
+
+static ssize_t bench_result_read(struct file *file, char __user *buf,
+        size_t count, loff_t *ppos)
+{
+    ssize_t ret;
+
+    mutex_lock(&bench_mutex);
+    ret = simple_read_from_buffer(buf, count, ppos, bench_result,
+                                  bench_result_len);
+    mutex_unlock(&bench_mutex);
+
+    return ret;
+}
+
+static const struct file_operations bench_result_fops = {
+    .owner  = THIS_MODULE,
+    .open   = simple_open,
+    .read   = bench_result_read,
+    .llseek = default_llseek,
+};
+
+static int __init zswap_bench_init(void)
+{
+    bench_debugfs_root = debugfs_create_dir("zswap_bench", NULL);
+    if (!bench_debugfs_root)
+        return -ENOMEM;
+
+    debugfs_create_file("run", S_IWUSR, bench_debugfs_root, NULL,
+                        &bench_run_fops);
+    debugfs_create_file("result", S_IRUSR, bench_debugfs_root, NULL,
+                        &bench_result_fops);
+
+    return 0;
+}
+
+static void __exit zswap_bench_exit(void)
+{
+    debugfs_remove_recursive(bench_debugfs_root);
+}
+
+module_init(zswap_bench_init);
+module_exit(zswap_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("zswap store/load microbenchmark");
@@ -26,6 +26,7 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
+#include <linux/zlock_stat.h>
 #include <linux/ztier.h>
 #include <linux/zpool.h>
 #include <linux/poison.h>
@@ -55,9 +56,6 @@ static const unsigned long RECLAIM_FLAG = (1ul << 63);
 // Everything except the RECLAIM_FLAG
 static const unsigned long TIER_MASK = GENMASK(62, 0);
 
-/* Debugging */
-static volatile u64 lock_holder; // don't optimize!
-
 /*****************
  * Structures
 *****************/
@@ -67,7 +65,7 @@ static volatile u64 lock_holder; // don't optimize!
  */
 struct ztier_pool {
     // Lock to protect the tree
-    spinlock_t lock;
+    struct zlock lock;
 
     // A set of free lists. Each free list is a rbtree to make it easier to
     // find pages that are completely unused.
@@ -128,6 +126,9 @@ struct ztier_chunk {
 /* for debugging */
 static struct ztier_pool *my_ztier_pool = NULL;
 
+/* Contention statistics of the locks of all pools */
+static struct zlock_class ztier_lock_class;
+
 #ifdef CONFIG_ZPOOL
 
 static int ztier_zpool_evict(struct ztier_pool *pool, unsigned long handle)
@@ -538,7 +539,7 @@ static int ztier_scrub_and_panic(const char * str,
 
     debug_print_on = true;
 
-    spin_lock(&my_ztier_pool->lock);
+    spin_lock(&my_ztier_pool->lock.lock);
 
     /* sanity check trees */
 
@@ -652,7 +653,7 @@ static int ztier_scrub_and_panic(const char * str,
 
     // TODO
 
-    spin_unlock(&my_ztier_pool->lock);
+    spin_unlock(&my_ztier_pool->lock.lock);
 
     debug_print_on = false;
 
@@ -777,8 +778,7 @@ static void ztier_attempt_evict_page_chunks(struct ztier_pool *pool,
     BUG_ON(tier >= NUM_TIERS);
     BUG_ON(!(page->ztier_private & RECLAIM_FLAG));
 
-    spin_lock(&pool->lock);
-    lock_holder = 0x1;
+    zlock_lock(&pool->lock, ZLOCK_RECLAIM);
 
     // For each chunk in the page
     for (i = 0; i < PAGE_SIZE; i += TIER_SIZES[tier]) {
@@ -787,8 +787,7 @@ static void ztier_attempt_evict_page_chunks(struct ztier_pool *pool,
         // If the chunk is not already under_reclaim
         if (!ztier_rb_contains(&pool->under_reclaim, chunk_struct(handle)))
         {
-            lock_holder = 0x1A;
-            spin_unlock(&pool->lock);
+            zlock_unlock(&pool->lock);
 
             BUG_ON(handle % TIER_SIZES[tier] != 0);
 
@@ -798,8 +797,7 @@ static void ztier_attempt_evict_page_chunks(struct ztier_pool *pool,
                 return;
             }
 
-            spin_lock(&pool->lock);
-            lock_holder = 0x2;
+            zlock_lock(&pool->lock, ZLOCK_RECLAIM);
         } else
         if ( ((*(unsigned int *)handle) != 0xAAAAAAAA &&
               (*(unsigned int *)handle) != 0xCCCCCCCC))
@@ -810,8 +808,7 @@ static void ztier_attempt_evict_page_chunks(struct ztier_pool *pool,
         }
     }
 
-    lock_holder = 0x2A;
-    spin_unlock(&pool->lock);
+    zlock_unlock(&pool->lock);
 }
 
 /*
@@ -896,8 +893,7 @@ struct ztier_pool *ztier_create_pool(gfp_t gfp, const struct ztier_ops *ops)
     if (!pool)
         return NULL;
 
-    spin_lock_init(&pool->lock);
-    lock_holder = 0;
+    zlock_init(&pool->lock, &ztier_lock_class);
     for (i = 0; i < NUM_TIERS; i++) {
         pool->free_lists[i] = RB_ROOT;
         INIT_LIST_HEAD(&pool->used_pages[i]);
@@ -971,8 +967,7 @@ int ztier_alloc(struct ztier_pool *pool, size_t size, gfp_t gfp,
     }
     BUG_ON(!tree);
 
-    spin_lock(&pool->lock);
-    lock_holder = 0x3;
+    zlock_lock(&pool->lock, ZLOCK_STORE);
 
     // look in the free list for the first chunk
     free = rb_first(tree);
@@ -980,14 +975,12 @@ int ztier_alloc(struct ztier_pool *pool, size_t size, gfp_t gfp,
     // if there is no free chunk, allocate a new page and add it to the pool
     if (!free) {
         // Allocate a new page
-        lock_holder = 0x3A;
-        spin_unlock(&pool->lock);
+        zlock_unlock(&pool->lock);
         page = alloc_page(gfp);
         if (!page) {
             return -ENOMEM;
         }
-        spin_lock(&pool->lock);
-        lock_holder = 0x4;
+        zlock_lock(&pool->lock, ZLOCK_STORE);
 
         // split into chunks, adding each chunk to the tree
         ztier_init_page(pool, page, tier);
@@ -1003,8 +996,7 @@ int ztier_alloc(struct ztier_pool *pool, size_t size, gfp_t gfp,
 
     rb_erase(free, tree);
 
-    lock_holder = 0x4A;
-    spin_unlock(&pool->lock);
+    zlock_unlock(&pool->lock);
 
     // return the allocation
     *handle = (unsigned long)struct_chunk(rb_entry(free, struct ztier_chunk, node));
@@ -1043,11 +1035,17 @@ void ztier_free(struct ztier_pool *pool, unsigned long handle)
     struct ztier_chunk *chunk = chunk_struct(handle);
     int tier;
     bool is_reclaim;
+    enum zlock_site site;
 
     BUG_ON(!handle);
 
-    spin_lock(&pool->lock);
-    lock_holder = 0x5;
+    // Frees of chunks in a page under reclaim come from the eviction
+    // handler; everything else is an invalidation. An unlocked peek is
+    // good enough to tell them apart in the lock statistics.
+    site = READ_ONCE(page->ztier_private) & RECLAIM_FLAG ?
+        ZLOCK_WRITEBACK : ZLOCK_INVALIDATE;
+
+    zlock_lock(&pool->lock, site);
 
     tier = page->ztier_private & TIER_MASK;
     is_reclaim = !!(page->ztier_private & RECLAIM_FLAG);
@@ -1068,8 +1066,7 @@ void ztier_free(struct ztier_pool *pool, unsigned long handle)
         ztier_rb_insert(&pool->free_lists[tier], chunk);
     }
 
-    lock_holder = 0x5A;
-    spin_unlock(&pool->lock);
+    zlock_unlock(&pool->lock);
 }
 
 /**
@@ -1142,16 +1139,14 @@ int ztier_reclaim_page(struct ztier_pool *pool, unsigned int retries)
     struct page *current_page = NULL;
     int reclaim_tier = 0xDEADBEEF;
 
-    spin_lock(&pool->lock);
-    lock_holder = 0x6;
+    zlock_lock(&pool->lock, ZLOCK_RECLAIM);
 
     if (!pool->ops ||
         !pool->ops->evict ||
         ztier_all_tiers_empty(pool) ||
         retries == 0)
     {
-        lock_holder = 0x6A1;
-        spin_unlock(&pool->lock);
+        zlock_unlock(&pool->lock);
         return -EINVAL;
     }
 
@@ -1165,8 +1160,7 @@ int ztier_reclaim_page(struct ztier_pool *pool, unsigned int retries)
         // means trying to evict fewer pages -> less I/O).
         page = ztier_reclaim_select_page(pool, &current_tier, &current_page);
         if (!page) {
-            lock_holder = 0x6A2;
-            spin_unlock(&pool->lock);
+            zlock_unlock(&pool->lock);
             return -EAGAIN;
         }
 
@@ -1190,21 +1184,18 @@ int ztier_reclaim_page(struct ztier_pool *pool, unsigned int retries)
         // move all free chunks of the page from the free list to under_reclaim
         ztier_page_chunks_under_reclaim(pool, page);
 
-        //lock_holder = 0x6A3;
-        spin_unlock(&pool->lock);
+        zlock_unlock(&pool->lock);
 
         // for each chunk of the page not in the under_reclaim set, attempt an
         // eviction.
         ztier_attempt_evict_page_chunks(pool, page);
 
-        spin_lock(&pool->lock);
-        lock_holder = 0x7;
+        zlock_lock(&pool->lock, ZLOCK_RECLAIM);
 
         // if all chunks of the selected page are now in under_reclaim, remove
         // the chunks from under_reclaim, free the page, and return sucess
         if (ztier_page_chunks_reclaimed(pool, page)) {
-            lock_holder = 0x7A1;
-            spin_unlock(&pool->lock);
+            zlock_unlock(&pool->lock);
             return 0;
         }
 
@@ -1217,8 +1208,7 @@ int ztier_reclaim_page(struct ztier_pool *pool, unsigned int retries)
         ztier_page_chunks_from_under_reclaim(pool, page);
     }
 
-    lock_holder = 0x6A4;
-    spin_unlock(&pool->lock);
+    zlock_unlock(&pool->lock);
 
     return -EAGAIN;
 }
@@ -1259,6 +1249,10 @@ static int __init init_ztier(void)
 {
     // Make sure a struct rb_node can fit in the minimal tier size
     BUILD_BUG_ON(sizeof(struct rb_node) > TIER_SIZES[NUM_TIERS-1]);
+
+    if (zlock_class_register(&ztier_lock_class, "ztier_pool"))
+        return -ENOMEM;
+
     pr_info("loaded\n");
 
 #ifdef CONFIG_ZPOOL
@@ -1274,6 +1268,8 @@ static void __exit exit_ztier(void)
     zpool_unregister_driver(&ztier_zpool_driver);
 #endif
 
+    zlock_class_unregister(&ztier_lock_class);
+
     pr_info("unloaded\n");
 }
 
@@ -38,6 +38,7 @@ extern int bench_futex_wake_parallel(int argc, const char **argv,
 extern int bench_futex_requeue(int argc, const char **argv, const char *prefix);
 /* pi futexes */
 extern int bench_futex_lock_pi(int argc, const char **argv, const char *prefix);
+extern int bench_syscall_basic(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,885 @@
+/*
+ * builtin-zerosim.c
+ *
+ * Capture and analysis of traces from the 0sim kernel tracer
+ * (kernel/zerosim-trace.c):
+ *
+ *  record   ... arm the tracer, run a workload and save the snapshot
+ *  report   ... time by category, top syscalls and IRQs, per-vCPU
+ *               breakdown of guest time and exits by exit reason
+ *  timeline ... convert to the Trace Event JSON format understood by
+ *               chrome://tracing, Perfetto and friends
+ */
+#include "builtin.h"
+#include "perf.h"
+
+#include "util/util.h"
+#include "util/parse-options.h"
+#include "util/debug.h"
+#include "util/tsc.h"
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <asm/vmx.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/list.h>
+#include <linux/hash.h>
+
+/* Must match struct trace and the event flags in kernel/zerosim-trace.c */
+struct zs_event {
+	u64	timestamp;
+	u32	id;
+	u32	flags;
+	u32	pid;
+	u32	extra;
+};
+
+#define ZS_TASK_SWITCH		0x00000001
+#define ZS_INTERRUPT		0x00000002
+#define ZS_FAULT		0x00000003
+#define ZS_SYSCALL		0x00000004
+#define ZS_SOFTIRQ		0x00000005
+#define ZS_VMENTEREXIT		0x00000006
+#define ZS_VMDELAY		0x00000007
+#define ZS_NR_TYPES		8
+
+#define ZS_START		0x80000000
+#define ZS_TYPE(flags)		((flags) & ~ZS_START)
+
+/* On-disk format written by 'perf zerosim record' */
+#define ZEROSIM_FILE_MAGIC	0x314352544d49535aULL	/* "ZSIMTRC1" */
+#define ZEROSIM_FILE_VERSION	1
+
+struct zs_file_header {
+	u64	magic;
+	u32	version;
+	u32	nr_cpus;
+	u64	nr_per_cpu;	/* the snapshot holds nr_cpus rings of this many events */
+	u64	tsc_khz;	/* 0 if unknown */
+};
+
+static const char	*input_name_zs	= "zerosim.data";
+static const char	*output_name_zs;
+static u64		nr_events	= 1 << 16;
+static unsigned int	duration	= 1;
+static u64		tsc_khz;
+
+/* Categories the time of each cpu is split into */
+enum zs_cat {
+	ZS_CAT_OTHER,
+	ZS_CAT_SYSCALL,
+	ZS_CAT_FAULT,
+	ZS_CAT_IRQ,
+	ZS_CAT_SOFTIRQ,
+	ZS_CAT_GUEST,
+	ZS_CAT_DELAY,
+	ZS_CAT_NR,
+};
+
+static const char * const zs_cat_names[ZS_CAT_NR] = {
+	[ZS_CAT_OTHER]		= "other",
+	[ZS_CAT_SYSCALL]	= "syscall",
+	[ZS_CAT_FAULT]		= "fault",
+	[ZS_CAT_IRQ]		= "irq",
+	[ZS_CAT_SOFTIRQ]	= "softirq",
+	[ZS_CAT_GUEST]		= "guest",
+	[ZS_CAT_DELAY]		= "delay",
+};
+
+static const enum zs_cat zs_type_cat[ZS_NR_TYPES] = {
+	[ZS_INTERRUPT]		= ZS_CAT_IRQ,
+	[ZS_FAULT]		= ZS_CAT_FAULT,
+	[ZS_SYSCALL]		= ZS_CAT_SYSCALL,
+	[ZS_SOFTIRQ]		= ZS_CAT_SOFTIRQ,
+	[ZS_VMENTEREXIT]	= ZS_CAT_GUEST,
+	[ZS_VMDELAY]		= ZS_CAT_DELAY,
+};
+
+struct exit_reason_name {
+	unsigned long	exit_code;
+	const char	*reason;
+};
+
+static const struct exit_reason_name vmx_exit_reasons[] = {
+	VMX_EXIT_REASONS
+};
+
+static const char *exit_reason_str(u32 reason)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(vmx_exit_reasons); i++)
+		if (vmx_exit_reasons[i].exit_code == reason)
+			return vmx_exit_reasons[i].reason;
+	return "UNKNOWN";
+}
+
+/* An event waiting for its end */
+struct zs_frame {
+	u32	type;
+	u32	id;
+	u64	start;
+};
+
+#define ZS_MAX_DEPTH		16
+#define ZS_NR_REASONS		80
+#define ZS_NR_SYSCALLS		1024
+#define ZS_NR_VECTORS		256
+
+struct zs_stack {
+	int		depth;
+	struct zs_frame	frames[ZS_MAX_DEPTH];
+};
+
+/* Per-task state: syscalls, faults, guest mode and delays follow the task */
+struct zs_task {
+	struct list_head	node;
+	u32			pid;
+	struct zs_stack		stack;
+
+	/* vCPU threads only */
+	int			vcpu_id;
+	bool			exited;
+	u32			last_reason;
+	u64			last_exit;
+	u64			nr_entries;
+	u64			guest;
+	u64			delay;
+	u64			exit_time[ZS_NR_REASONS];
+	u64			exit_count[ZS_NR_REASONS];
+};
+
+/* Per-cpu state: interrupts and softirqs nest on the cpu, not the task */
+struct zs_cpu {
+	u32		curr;
+	bool		seen;
+	u64		last;
+	struct zs_stack	stack;
+	u64		cat[ZS_CAT_NR];
+};
+
+#define ZS_TASK_HASH_BITS	10
+#define ZS_TASK_HASH_SIZE	(1UL << ZS_TASK_HASH_BITS)
+
+struct zs_state {
+	struct zs_file_header	hdr;
+	struct zs_event		*events;
+	u64			nr;
+	u64			first, last;
+
+	struct zs_cpu		*cpus;
+	struct list_head	tasks[ZS_TASK_HASH_SIZE];
+
+	u64			syscall_time[ZS_NR_SYSCALLS];
+	u64			syscall_count[ZS_NR_SYSCALLS];
+	u64			irq_time[ZS_NR_VECTORS];
+	u64			irq_count[ZS_NR_VECTORS];
+	u64			unmatched;
+
+	/* timeline output, if any */
+	FILE			*json;
+	bool			json_first;
+};
+
+static struct zs_task *zs_task(struct zs_state *zs, u32 pid, bool create)
+{
+	struct list_head *head = &zs->tasks[hash_long(pid, ZS_TASK_HASH_BITS)];
+	struct zs_task *t;
+
+	list_for_each_entry(t, head, node)
+		if (t->pid == pid)
+			return t;
+
+	if (!create)
+		return NULL;
+
+	t = zalloc(sizeof(*t));
+	if (!t)
+		return NULL;
+	t->pid = pid;
+	t->vcpu_id = -1;
+	list_add(&t->node, head);
+	return t;
+}
+
+static double zs_usecs(struct zs_state *zs, u64 cycles)
+{
+	if (!zs->hdr.tsc_khz)
+		return cycles;
+	return cycles * 1000.0 / zs->hdr.tsc_khz;
+}
+
+static void zs_json_event(struct zs_state *zs, const char *cat, const char *name,
+			  int pid, u32 tid, u64 start, u64 end)
+{
+	if (!zs->json)
+		return;
+
+	fprintf(zs->json, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+		"\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+		zs->json_first ? "" : ",", name, cat,
+		zs_usecs(zs, start - zs->first), zs_usecs(zs, end - start),
+		pid, tid);
+	zs->json_first = false;
+}
+
+static void zs_json_name(struct zs_state *zs, const char *what, int pid,
+			 u32 tid, const char *name)
+{
+	if (!zs->json)
+		return;
+
+	fprintf(zs->json, "%s\n{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,"
+		"\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+		zs->json_first ? "" : ",", what, pid, tid, name);
+	zs->json_first = false;
+}
+
+/* Timeline lanes: one per host cpu, and one per vCPU thread */
+#define ZS_PID_CPUS		0
+#define ZS_PID_VCPUS		1
+
+static void zs_push(struct zs_state *zs, struct zs_stack *s,
+		    struct zs_event *ev)
+{
+	struct zs_frame *f;
+
+	if (s->depth >= ZS_MAX_DEPTH) {
+		zs->unmatched++;
+		return;
+	}
+
+	f = &s->frames[s->depth++];
+	f->type = ZS_TYPE(ev->flags);
+	f->id = ev->id;
+	f->start = ev->timestamp;
+}
+
+/*
+ * Pop the innermost frame of the event's type. Frames above it never saw
+ * their end (the ring wrapped, or tracing started in the middle), so they
+ * are dropped.
+ */
+static struct zs_frame *zs_pop(struct zs_state *zs, struct zs_stack *s,
+			       struct zs_event *ev)
+{
+	int i;
+
+	for (i = s->depth - 1; i >= 0; i--) {
+		if (s->frames[i].type == ZS_TYPE(ev->flags)) {
+			zs->unmatched += s->depth - 1 - i;
+			s->depth = i;
+			return &s->frames[i];
+		}
+	}
+
+	zs->unmatched++;
+	return NULL;
+}
+
+static enum zs_cat zs_current_cat(struct zs_state *zs, struct zs_cpu *cpu)
+{
+	struct zs_task *t;
+
+	if (cpu->stack.depth)
+		return zs_type_cat[cpu->stack.frames[cpu->stack.depth - 1].type];
+
+	t = zs_task(zs, cpu->curr, false);
+	if (t && t->stack.depth)
+		return zs_type_cat[t->stack.frames[t->stack.depth - 1].type];
+
+	return ZS_CAT_OTHER;
+}
+
+static int zs_process_event(struct zs_state *zs, u32 cpu_nr,
+			    struct zs_event *ev)
+{
+	struct zs_cpu *cpu = &zs->cpus[cpu_nr];
+	u32 type = ZS_TYPE(ev->flags);
+	bool start = ev->flags & ZS_START;
+	struct zs_stack *stack;
+	struct zs_frame *f;
+	struct zs_task *t;
+	u64 now = ev->timestamp, dur;
+	char name[64];
+
+	/* Charge the time since the last event on this cpu */
+	if (cpu->seen && now > cpu->last)
+		cpu->cat[zs_current_cat(zs, cpu)] += now - cpu->last;
+	cpu->seen = true;
+	cpu->last = now;
+
+	if (!type || type >= ZS_NR_TYPES)
+		return 0;
+
+	if (type == ZS_TASK_SWITCH) {
+		cpu->curr = ev->id;
+		return 0;
+	}
+
+	if (type == ZS_INTERRUPT || type == ZS_SOFTIRQ) {
+		stack = &cpu->stack;
+		t = NULL;
+	} else {
+		cpu->curr = ev->pid;
+		t = zs_task(zs, ev->pid, true);
+		if (!t)
+			return -ENOMEM;
+		stack = &t->stack;
+	}
+
+	if (start) {
+		if (type == ZS_VMENTEREXIT) {
+			t->vcpu_id = ev->extra;
+			t->nr_entries++;
+			if (t->exited && t->last_reason < ZS_NR_REASONS) {
+				t->exit_time[t->last_reason] += now - t->last_exit;
+				t->exit_count[t->last_reason]++;
+				zs_json_event(zs, "exit",
+					      exit_reason_str(t->last_reason),
+					      ZS_PID_VCPUS, t->pid,
+					      t->last_exit, now);
+			}
+			t->exited = false;
+		}
+		zs_push(zs, stack, ev);
+		return 0;
+	}
+
+	f = zs_pop(zs, stack, ev);
+	if (!f)
+		return 0;
+	dur = now - f->start;
+
+	switch (type) {
+	case ZS_SYSCALL:
+		if (f->id < ZS_NR_SYSCALLS) {
+			zs->syscall_time[f->id] += dur;
+			zs->syscall_count[f->id]++;
+		}
+		snprintf(name, sizeof(name), "syscall %u", f->id);
+		break;
+	case ZS_INTERRUPT:
+		if (f->id < ZS_NR_VECTORS) {
+			zs->irq_time[f->id] += dur;
+			zs->irq_count[f->id]++;
+		}
+		snprintf(name, sizeof(name), "irq %u", f->id);
+		break;
+	case ZS_FAULT:
+		snprintf(name, sizeof(name), "fault %#x", f->id);
+		break;
+	case ZS_SOFTIRQ:
+		snprintf(name, sizeof(name), "softirq");
+		break;
+	case ZS_VMENTEREXIT:
+		t->guest += dur;
+		t->exited = true;
+		t->last_exit = now;
+		t->last_reason = ev->id;
+		snprintf(name, sizeof(name), "guest");
+		zs_json_event(zs, "guest", name, ZS_PID_VCPUS, t->pid,
+			      f->start, now);
+		break;
+	case ZS_VMDELAY:
+		t->delay += dur;
+		snprintf(name, sizeof(name), "delay");
+		zs_json_event(zs, "delay", name, ZS_PID_VCPUS, t->pid,
+			      f->start, now);
+		break;
+	default:
+		return 0;
+	}
+
+	zs_json_event(zs, zs_cat_names[zs_type_cat[type]], name,
+		      ZS_PID_CPUS, cpu_nr, f->start, now);
+	return 0;
+}
+
+/* Index into the snapshot, ordered by timestamp across cpus */
+struct zs_ref {
+	u64	timestamp;
+	u32	cpu;
+	u64	idx;
+};
+
+static int zs_ref_cmp(const void *a, const void *b)
+{
+	const struct zs_ref *ra = a, *rb = b;
+
+	if (ra->timestamp != rb->timestamp)
+		return ra->timestamp < rb->timestamp ? -1 : 1;
+	if (ra->cpu != rb->cpu)
+		return ra->cpu < rb->cpu ? -1 : 1;
+	return ra->idx < rb->idx ? -1 : ra->idx > rb->idx;
+}
+
+static int zs_load(struct zs_state *zs, const char *path)
+{
+	FILE *f;
+	u64 total;
+	unsigned int i;
+	int err = -1;
+
+	for (i = 0; i < ZS_TASK_HASH_SIZE; i++)
+		INIT_LIST_HEAD(&zs->tasks[i]);
+
+	f = fopen(path, "r");
+	if (!f) {
+		pr_err("failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fread(&zs->hdr, sizeof(zs->hdr), 1, f) != 1 ||
+	    zs->hdr.magic != ZEROSIM_FILE_MAGIC ||
+	    zs->hdr.version != ZEROSIM_FILE_VERSION) {
+		pr_err("%s is not a zerosim trace\n", path);
+		goto out;
+	}
+
+	total = zs->hdr.nr_cpus * zs->hdr.nr_per_cpu;
+	zs->events = calloc(total, sizeof(*zs->events));
+	zs->cpus = calloc(zs->hdr.nr_cpus, sizeof(*zs->cpus));
+	if (!zs->events || !zs->cpus) {
+		pr_err("not enough memory for %" PRIu64 " events\n", total);
+		goto out;
+	}
+
+	if (fread(zs->events, sizeof(*zs->events), total, f) != total) {
+		pr_err("%s is truncated\n", path);
+		goto out;
+	}
+
+	zs->nr = total;
+	err = 0;
+out:
+	fclose(f);
+	return err;
+}
+
+static int zs_process(struct zs_state *zs)
+{
+	struct zs_ref *refs;
+	struct zs_event *ev;
+	u64 i, n = 0;
+	int err = 0;
+
+	refs = calloc(zs->nr, sizeof(*refs));
+	if (!refs)
+		return -ENOMEM;
+
+	/* Unused slots of the rings are all zeroes */
+	for (i = 0; i < zs->nr; i++) {
+		ev = &zs->events[i];
+		if (!ev->timestamp && !ev->flags)
+			continue;
+		refs[n].timestamp = ev->timestamp;
+		refs[n].cpu = i / zs->hdr.nr_per_cpu;
+		refs[n].idx = i;
+		n++;
+	}
+
+	qsort(refs, n, sizeof(*refs), zs_ref_cmp);
+
+	if (n) {
+		zs->first = refs[0].timestamp;
+		zs->last = refs[n - 1].timestamp;
+	}
+
+	for (i = 0; i < n && !err; i++)
+		err = zs_process_event(zs, refs[i].cpu,
+				       &zs->events[refs[i].idx]);
+
+	free(refs);
+	return err;
+}
+
+static void zs_free(struct zs_state *zs)
+{
+	struct zs_task *t, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < ZS_TASK_HASH_SIZE; i++) {
+		list_for_each_entry_safe(t, tmp, &zs->tasks[i], node) {
+			list_del(&t->node);
+			free(t);
+		}
+	}
+	free(zs->events);
+	free(zs->cpus);
+}
+
+static void print_top(struct zs_state *zs, const char *what,
+		      u64 *total, u64 *count, unsigned int nr, unsigned int top)
+{
+	unsigned int i, j, best;
+	bool *done = calloc(nr, sizeof(*done));
+
+	if (!done)
+		return;
+
+	printf("\n Top %ss by total time:\n\n", what);
+	printf(" %10s %12s %16s %12s\n", what, "count", "total (us)", "avg (us)");
+	for (j = 0; j < top; j++) {
+		best = nr;
+		for (i = 0; i < nr; i++)
+			if (!done[i] && count[i] &&
+			    (best == nr || total[i] > total[best]))
+				best = i;
+		if (best == nr)
+			break;
+		done[best] = true;
+		printf(" %10u %12" PRIu64 " %16.3f %12.3f\n", best, count[best],
+		       zs_usecs(zs, total[best]),
+		       zs_usecs(zs, total[best]) / count[best]);
+	}
+
+	free(done);
+}
+
+static void print_vcpu(struct zs_state *zs, struct zs_task *t)
+{
+	u64 exits = 0;
+	unsigned int i;
+
+	for (i = 0; i < ZS_NR_REASONS; i++)
+		exits += t->exit_time[i];
+
+	printf("\n vCPU %d (pid %u): %" PRIu64 " entries\n", t->vcpu_id,
+	       t->pid, t->nr_entries);
+	printf("   %-24s %16.3f us\n", "in guest", zs_usecs(zs, t->guest));
+	printf("   %-24s %16.3f us\n", "handling exits", zs_usecs(zs, exits));
+	printf("   %-24s %16.3f us\n", "  of which delayed", zs_usecs(zs, t->delay));
+
+	printf("\n   %-24s %12s %16s %12s\n", "exit reason", "count",
+	       "total (us)", "avg (us)");
+	for (i = 0; i < ZS_NR_REASONS; i++) {
+		if (!t->exit_count[i])
+			continue;
+		printf("   %-24s %12" PRIu64 " %16.3f %12.3f\n",
+		       exit_reason_str(i), t->exit_count[i],
+		       zs_usecs(zs, t->exit_time[i]),
+		       zs_usecs(zs, t->exit_time[i]) / t->exit_count[i]);
+	}
+}
+
+static int __cmd_report(void)
+{
+	struct zs_state *zs;
+	struct zs_task *t;
+	u64 cat[ZS_CAT_NR] = { 0 }, sum = 0;
+	unsigned int i, c;
+	int err;
+
+	zs = zalloc(sizeof(*zs));
+	if (!zs)
+		return -ENOMEM;
+
+	err = zs_load(zs, input_name_zs);
+	if (err)
+		goto out;
+	err = zs_process(zs);
+	if (err)
+		goto out;
+
+	if (!zs->hdr.tsc_khz)
+		pr_warning("TSC frequency unknown, times are in cycles\n");
+
+	for (c = 0; c < zs->hdr.nr_cpus; c++)
+		for (i = 0; i < ZS_CAT_NR; i++)
+			cat[i] += zs->cpus[c].cat[i];
+	for (i = 0; i < ZS_CAT_NR; i++)
+		sum += cat[i];
+
+	printf("# %u cpus, %.3f ms traced, %" PRIu64 " unmatched events\n",
+	       zs->hdr.nr_cpus, zs_usecs(zs, zs->last - zs->first) / 1000,
+	       zs->unmatched);
+
+	printf("\n Time by category (all cpus):\n\n");
+	for (i = 0; i < ZS_CAT_NR; i++)
+		printf(" %10s %16.3f us %6.2f%%\n", zs_cat_names[i],
+		       zs_usecs(zs, cat[i]), sum ? 100.0 * cat[i] / sum : 0.0);
+
+	print_top(zs, "syscall", zs->syscall_time, zs->syscall_count,
+		  ZS_NR_SYSCALLS, 10);
+	print_top(zs, "irq", zs->irq_time, zs->irq_count, ZS_NR_VECTORS, 10);
+
+	for (i = 0; i < ZS_TASK_HASH_SIZE; i++)
+		list_for_each_entry(t, &zs->tasks[i], node)
+			if (t->vcpu_id >= 0)
+				print_vcpu(zs, t);
+out:
+	zs_free(zs);
+	free(zs);
+	return err;
+}
+
+static int __cmd_timeline(void)
+{
+	struct zs_state *zs;
+	struct zs_task *t;
+	const char *path = output_name_zs ?: "zerosim.json";
+	char name[32];
+	unsigned int i;
+	int err;
+
+	zs = zalloc(sizeof(*zs));
+	if (!zs)
+		return -ENOMEM;
+
+	err = zs_load(zs, input_name_zs);
+	if (err)
+		goto out;
+
+	zs->json = fopen(path, "w");
+	if (!zs->json) {
+		pr_err("failed to create %s: %s\n", path, strerror(errno));
+		err = -1;
+		goto out;
+	}
+	zs->json_first = true;
+
+	if (!zs->hdr.tsc_khz)
+		pr_warning("TSC frequency unknown, timestamps are in cycles\n");
+
+	fprintf(zs->json, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	zs_json_name(zs, "process_name", ZS_PID_CPUS, 0, "host cpus");
+	zs_json_name(zs, "process_name", ZS_PID_VCPUS, 0, "vcpus");
+	for (i = 0; i < zs->hdr.nr_cpus; i++) {
+		snprintf(name, sizeof(name), "cpu %u", i);
+		zs_json_name(zs, "thread_name", ZS_PID_CPUS, i, name);
+	}
+
+	err = zs_process(zs);
+
+	for (i = 0; i < ZS_TASK_HASH_SIZE; i++) {
+		list_for_each_entry(t, &zs->tasks[i], node) {
+			if (t->vcpu_id < 0)
+				continue;
+			snprintf(name, sizeof(name), "vcpu %d", t->vcpu_id);
+			zs_json_name(zs, "thread_name", ZS_PID_VCPUS, t->pid,
+				     name);
+		}
+	}
+
+	fprintf(zs->json, "\n]}\n");
+	fclose(zs->json);
+
+	if (!err)
+		fprintf(stderr, "Wrote %s\n", path);
+out:
+	zs_free(zs);
+	free(zs);
+	return err;
+}
+
+#ifdef __NR_zerosim_trace_begin
+/* num_possible_cpus() of the running kernel, which sizes the snapshot */
+static int nr_possible_cpus(void)
+{
+	unsigned int first, last;
+	FILE *f = fopen("/sys/devices/system/cpu/possible", "r");
+	int ret;
+
+	if (!f)
+		return sysconf(_SC_NPROCESSORS_CONF);
+
+	ret = fscanf(f, "%u-%u", &first, &last);
+	fclose(f);
+	if (ret == 2)
+		return last + 1;
+	if (ret == 1)
+		return first + 1;
+	return sysconf(_SC_NPROCESSORS_CONF);
+}
+
+static u64 measure_tsc_khz(void)
+{
+	struct timespec t0, t1;
+	u64 c0, c1, ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	c0 = rdtsc();
+	usleep(100000);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	c1 = rdtsc();
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+	if (!ns || c1 <= c0)
+		return 0;
+	return (c1 - c0) * 1000000ULL / ns;
+}
+
+static int run_workload(const char **argv)
+{
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0) {
+		pr_err("failed to fork: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (!pid) {
+		execvp(argv[0], (char **)argv);
+		pr_err("failed to run %s: %s\n", argv[0], strerror(errno));
+		exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -1;
+	return 0;
+}
+
+static int __cmd_record(int argc, const char **argv)
+{
+	struct zs_file_header hdr = {
+		.magic		= ZEROSIM_FILE_MAGIC,
+		.version	= ZEROSIM_FILE_VERSION,
+	};
+	const char *path = output_name_zs ?: "zerosim.data";
+	struct zs_event *buf;
+	size_t len;
+	FILE *f;
+	int err = -1;
+
+	hdr.nr_cpus = nr_possible_cpus();
+	hdr.nr_per_cpu = nr_events;
+	len = hdr.nr_cpus * hdr.nr_per_cpu * sizeof(*buf);
+
+	buf = malloc(len);
+	if (!buf) {
+		pr_err("not enough memory for the snapshot (%zu bytes)\n", len);
+		return -ENOMEM;
+	}
+
+	if (syscall(__NR_zerosim_trace_size, (unsigned long)nr_events)) {
+		pr_err("failed to size the trace buffers: %s\n", strerror(errno));
+		goto out;
+	}
+
+	/* Calibrate before tracing so as not to show up in the trace */
+	hdr.tsc_khz = tsc_khz ?: measure_tsc_khz();
+
+	if (syscall(__NR_zerosim_trace_begin)) {
+		pr_err("failed to start tracing: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (argc)
+		run_workload(argv);
+	else
+		sleep(duration);
+
+	if (syscall(__NR_zerosim_trace_snapshot, buf, (unsigned long)len)) {
+		pr_err("failed to take the snapshot: %s\n", strerror(errno));
+		goto out;
+	}
+
+	f = fopen(path, "w");
+	if (!f) {
+		pr_err("failed to create %s: %s\n", path, strerror(errno));
+		goto out;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(buf, len, 1, f) != 1) {
+		pr_err("failed to write %s\n", path);
+		fclose(f);
+		goto out;
+	}
+	fclose(f);
+
+	fprintf(stderr, "Wrote %u x %" PRIu64 " events to %s\n",
+		hdr.nr_cpus, hdr.nr_per_cpu, path);
+	err = 0;
+out:
+	free(buf);
+	return err;
+}
+#else
+static int __cmd_record(int argc __maybe_unused,
+			const char **argv __maybe_unused)
+{
+	pr_err("perf was built against kernel headers without the zerosim tracer syscalls\n");
+	return -ENOSYS;
+}
+#endif
+
+int cmd_zerosim(int argc, const char **argv, const char *prefix __maybe_unused)
+{
+	const struct option record_options[] = {
+	OPT_STRING('o', "output", &output_name_zs, "file",
+		   "output file name (default: zerosim.data)"),
+	OPT_U64('m', "events", &nr_events, "size of each per-cpu ring, in events"),
+	OPT_UINTEGER('d', "duration", &duration,
+		     "seconds to trace for when no command is given"),
+	OPT_U64(0, "tsc-khz", &tsc_khz, "TSC frequency (default: measure it)"),
+	OPT_END()
+	};
+	const struct option report_options[] = {
+	OPT_STRING('i', "input", &input_name_zs, "file", "input file name"),
+	OPT_END()
+	};
+	const struct option timeline_options[] = {
+	OPT_STRING('i', "input", &input_name_zs, "file", "input file name"),
+	OPT_STRING('o', "output", &output_name_zs, "file",
+		   "output file name (default: zerosim.json)"),
+	OPT_END()
+	};
+	const struct option zerosim_options[] = {
+	OPT_INCR('v', "verbose", &verbose, "be more verbose"),
+	OPT_END()
+	};
+	const char * const record_usage[] = {
+		"perf zerosim record [<options>] [<command>]",
+		NULL
+	};
+	const char * const report_usage[] = {
+		"perf zerosim report [<options>]",
+		NULL
+	};
+	const char * const timeline_usage[] = {
+		"perf zerosim timeline [<options>]",
+		NULL
+	};
+	const char *const zerosim_subcommands[] = { "record", "report",
+						    "timeline", NULL };
+	const char *zerosim_usage[] = {
+		NULL,
+		NULL
+	};
+
+	argc = parse_options_subcommand(argc, argv, zerosim_options,
+					zerosim_subcommands, zerosim_usage,
+					PARSE_OPT_STOP_AT_NON_OPTION);
+	if (!argc)
+		usage_with_options(zerosim_usage, zerosim_options);
+
+	if (!strncmp(argv[0], "rec", 3)) {
+		argc = parse_options(argc, argv, record_options, record_usage,
+				     PARSE_OPT_STOP_AT_NON_OPTION);
+		return __cmd_record(argc, argv);
+	} else if (!strncmp(argv[0], "rep", 3)) {
+		argc = parse_options(argc, argv, report_options, report_usage, 0);
+		if (argc)
+			usage_with_options(report_usage, report_options);
+		return __cmd_report();
+	} else if (!strcmp(argv[0], "timeline")) {
+		argc = parse_options(argc, argv, timeline_options,
+				     timeline_usage, 0);
+		if (argc)
+			usage_with_options(timeline_usage, timeline_options);
+		return __cmd_timeline();
+	}
+
+	usage_with_options(zerosim_usage, zerosim_options);
+	return 0;
+}
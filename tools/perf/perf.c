@@ -66,6 +66,9 @@ static struct cmd_struct commands[] = {
 	{ "inject",	cmd_inject,	0 },
 	{ "mem",	cmd_mem,	0 },
 	{ "data",	cmd_data,	0 },
+#ifdef HAVE_ARCH_X86_64_SUPPORT
+	{ "zerosim",	cmd_zerosim,	0 },
+#endif
 };
 
 struct pager_config {
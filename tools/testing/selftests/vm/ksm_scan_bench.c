@@ -0,0 +1,208 @@
+/*
+ * KSM scan throughput benchmark.
+ *
+ * Fills an anonymous area with pages of which only every dup'th one is
+ * distinct, marks it MADV_MERGEABLE, lets ksmd run flat out and reports
+ * how many pages per second it gets through over two full scans (the
+ * first of which only feeds the unstable tree, the second merges).
+ *
+ * Usage: ksm_scan_bench [size_mb [dup [workers]]]
+ * Must be run as root; the ksm sysfs knobs are restored on exit, also on
+ * errors and on SIGINT or SIGTERM.  Fails if ksmd does not complete a
+ * scan within SCAN_TIMEOUT seconds.
+ *
+ * This program is released under the GPL v2.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE 4096
+
+#define KSM_PATH "/sys/kernel/mm/ksm/"
+
+/* seconds to wait for each full scan before giving up on ksmd */
+#define SCAN_TIMEOUT 120
+
+static unsigned long ksm_read(const char *name)
+{
+	char path[128];
+	unsigned long val;
+	FILE *f;
+
+	snprintf(path, sizeof(path), KSM_PATH "%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		err(2, "open %s", path);
+	if (fscanf(f, "%lu", &val) != 1)
+		errx(2, "read %s", path);
+	fclose(f);
+	return val;
+}
+
+static int ksm_write(const char *name, unsigned long val)
+{
+	char path[128];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), KSM_PATH "%s", name);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%lu", val) < 0;
+	if (fclose(f))
+		ret = -1;
+	return ret ? -1 : 0;
+}
+
+/* Knob values to put back on exit, whichever way we exit */
+static struct {
+	const char *name;
+	unsigned long val;
+	int saved;
+} knobs[] = {
+	{ "run" },
+	{ "pages_to_scan" },
+	{ "sleep_millisecs" },
+	{ "nr_workers" },
+};
+
+#define NR_KNOBS (sizeof(knobs) / sizeof(knobs[0]))
+
+static void restore_knobs(void)
+{
+	unsigned int i;
+	int failed = 0;
+
+	for (i = 0; i < NR_KNOBS; i++) {
+		if (knobs[i].saved && ksm_write(knobs[i].name, knobs[i].val)) {
+			warn("restore %s", knobs[i].name);
+			failed = 1;
+		}
+	}
+	if (failed) {
+		fflush(NULL);
+		_exit(2);
+	}
+}
+
+static void save_knob(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NR_KNOBS; i++) {
+		if (!strcmp(knobs[i].name, name)) {
+			knobs[i].val = ksm_read(name);
+			knobs[i].saved = 1;
+		}
+	}
+}
+
+static void on_signal(int sig)
+{
+	exit(128 + sig);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Wait until ksmd has done @n full scans past @start_scans */
+static unsigned long wait_scans(unsigned long start_scans, unsigned long n)
+{
+	double deadline = now() + n * SCAN_TIMEOUT;
+	unsigned long scans;
+
+	for (;;) {
+		scans = ksm_read("full_scans") - start_scans;
+		if (scans >= n)
+			return scans;
+		if (now() > deadline)
+			errx(2, "ksmd did not finish a full scan in %d s",
+			     SCAN_TIMEOUT);
+		usleep(1000);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size_mb = 256, dup = 8, workers = 0;
+	unsigned long npages, i, start_scans, scans;
+	double start, elapsed;
+	char *area;
+
+	if (argc > 1)
+		size_mb = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		dup = strtoul(argv[2], NULL, 0);
+	if (argc > 3)
+		workers = strtoul(argv[3], NULL, 0);
+	if (!size_mb || !dup)
+		errx(1, "usage: %s [size_mb [dup [workers]]]", argv[0]);
+
+	if (access(KSM_PATH "run", W_OK))
+		errx(1, "KSM not available, or not root");
+
+	npages = size_mb << 20 >> 12;
+	area = mmap(NULL, npages * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		err(2, "mmap");
+
+	/* identical up to the last word, so compares run the whole page */
+	for (i = 0; i < npages; i++) {
+		char *page = area + i * PAGE_SIZE;
+
+		memset(page, 0x5a, PAGE_SIZE);
+		*(unsigned long *)(page + PAGE_SIZE - sizeof(long)) = i / dup;
+	}
+
+	if (madvise(area, npages * PAGE_SIZE, MADV_MERGEABLE))
+		err(2, "MADV_MERGEABLE");
+
+	save_knob("run");
+	save_knob("pages_to_scan");
+	save_knob("sleep_millisecs");
+	if (workers)
+		save_knob("nr_workers");
+	atexit(restore_knobs);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (workers && ksm_write("nr_workers", workers))
+		err(2, "set nr_workers");
+
+	if (ksm_write("pages_to_scan", 10000))
+		err(2, "set pages_to_scan");
+	if (ksm_write("sleep_millisecs", 0))
+		err(2, "set sleep_millisecs");
+	if (ksm_write("run", 1))
+		err(2, "start ksmd");
+
+	/* wait for a scan boundary, so that we time whole scans */
+	wait_scans(ksm_read("full_scans"), 1);
+
+	start_scans = ksm_read("full_scans");
+	start = now();
+	scans = wait_scans(start_scans, 2);
+	elapsed = now() - start;
+
+	printf("%lu MB, dup %lu: %lu full scans in %.3f s, %.0f pages/s\n",
+	       size_mb, dup, scans, elapsed, scans * npages / elapsed);
+	printf("pages_shared %lu pages_sharing %lu\n",
+	       ksm_read("pages_shared"), ksm_read("pages_sharing"));
+
+	munmap(area, npages * PAGE_SIZE);
+	return 0;
+}
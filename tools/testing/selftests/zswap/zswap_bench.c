@@ -0,0 +1,114 @@
+/*
+ * zswap store/load benchmark.
+ *
+ * Runs the zswap_bench module (CONFIG_ZSWAP_BENCH) over each page content
+ * distribution and a few thread counts, and prints its results: ops/s and
+ * latency percentiles of store, load and invalidate, pool bytes per stored
+ * page, and the share of the time the zswap tree lock was held.
+ *
+ * Usage: zswap_bench [pattern [threads [pages [batch]]]]
+ * pattern is one of zero, same, text, random, or all (the default);
+ * threads defaults to 1, 2 and the number of online cpus; pages is per
+ * thread.  batch is the number of pages per store and load call (default
+ * 1); 512 measures the batched path of THP swap runs against it.  Must be
+ * run as root with zswap enabled and the module loaded.
+ *
+ * This program is released under the GPL v2.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+
+#define PARAM_PATH "/sys/module/zswap_bench/parameters/"
+#define DEBUGFS_PATH "/sys/kernel/debug/zswap_bench/"
+
+static const char * const patterns[] = { "zero", "same", "text", "random" };
+
+static void write_file(const char *path, const char *val)
+{
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f)
+		err(2, "open %s", path);
+	if (fputs(val, f) < 0 || fclose(f))
+		err(2, "write %s", path);
+}
+
+static void set_param(const char *name, unsigned long val)
+{
+	char path[128], buf[32];
+
+	snprintf(path, sizeof(path), PARAM_PATH "%s", name);
+	snprintf(buf, sizeof(buf), "%lu", val);
+	write_file(path, buf);
+}
+
+static void run(const char *pattern, unsigned long threads,
+		unsigned long pages, unsigned long batch)
+{
+	char buf[4096];
+	size_t n;
+	FILE *f;
+
+	write_file(PARAM_PATH "pattern", pattern);
+	set_param("threads", threads);
+	set_param("pages", pages);
+	set_param("batch", batch);
+	write_file(DEBUGFS_PATH "run", "1");
+
+	f = fopen(DEBUGFS_PATH "result", "r");
+	if (!f)
+		err(2, "open result");
+	n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+	printf("%s\n", buf);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long thread_counts[3] = { 1, 2, 0 };
+	unsigned long pages = 16384, batch = 1, ncpus;
+	const char *pattern = "all";
+	int i, j, nr_counts = 3;
+
+	if (argc > 1)
+		pattern = argv[1];
+	if (argc > 2) {
+		thread_counts[0] = strtoul(argv[2], NULL, 0);
+		nr_counts = 1;
+	}
+	if (argc > 3)
+		pages = strtoul(argv[3], NULL, 0);
+	if (argc > 4)
+		batch = strtoul(argv[4], NULL, 0);
+	for (i = 0; i < 4; i++)
+		if (!strcmp(pattern, patterns[i]))
+			break;
+	if (!thread_counts[0] || !pages || !batch || pages % batch ||
+	    (i == 4 && strcmp(pattern, "all")))
+		errx(1, "usage: %s [pattern [threads [pages [batch]]]]",
+		     argv[0]);
+
+	if (access(DEBUGFS_PATH "run", W_OK))
+		errx(1, "zswap_bench module not loaded, or not root");
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	thread_counts[2] = ncpus;
+	/* don't repeat a thread count on small machines */
+	if (nr_counts == 3 && ncpus <= 2)
+		nr_counts = ncpus;
+
+	for (i = 0; i < 4; i++) {
+		if (strcmp(pattern, "all") && strcmp(pattern, patterns[i]))
+			continue;
+		for (j = 0; j < nr_counts; j++)
+			run(patterns[i], thread_counts[j], pages, batch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Cost of the 0sim entry hooks on the syscall path.
+#
+# Runs 'perf bench syscall basic' with the zerosim tracer hooks patched out,
+# with only the interrupt accounting hooks held (the missing-time breakdown
+# knob on) and with tracing on, and prints the median usecs/op of each.
+# Results are appended to the output file under the given label, so that
+# runs on a kernel from before the hooks became static keys can be put next
+# to them.
+#
+# Usage: bench_entry.sh [options] <label>
+#   -o file	where to append the results (default: ./bench_entry.txt)
+#   -n runs	runs per configuration (default: 5)
+#   -l loops	getppid() calls per run (default: 10000000)
+#   -c cpu	cpu to run on (default: 1)
+#
+# Stop all VMs and close /proc/zerosim_missing first: either keeps the
+# interrupt hooks in, which the first configuration is meant to leave out.
+
+set -e -o pipefail
+
+out=bench_entry.txt
+runs=5
+loops=10000000
+cpu=1
+
+while getopts "o:n:l:c:" opt; do
+	case $opt in
+	o) out=$OPTARG ;;
+	n) runs=$OPTARG ;;
+	l) loops=$OPTARG ;;
+	c) cpu=$OPTARG ;;
+	*) exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+	echo "usage: $0 [-o file] [-n runs] [-l loops] [-c cpu] <label>" >&2
+	exit 1
+fi
+label=$1
+
+perf=${PERF:-perf}
+knob=/proc/zerosim_missing_breakdown
+trace=$(mktemp)
+
+breakdown=
+cleanup()
+{
+	[ -n "$breakdown" ] && echo "$breakdown" > $knob
+	rm -f "$trace"
+}
+trap cleanup EXIT
+
+if [ -w $knob ]; then
+	breakdown=$(cat $knob)
+	echo 0 > $knob
+fi
+
+# Median usecs/op of $runs runs of "$@" wrapped around the benchmark
+bench()
+{
+	local i
+
+	for i in $(seq "$runs"); do
+		taskset -c "$cpu" "$@" "$perf" bench syscall basic -l "$loops" |
+			awk '/usecs\/op/ { print $1 }'
+	done | sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+printf "%-12s %-10s %s\n" "$label" "hooks-out" "$(bench)" | tee -a "$out"
+
+if [ -w $knob ]; then
+	echo 1 > $knob
+	printf "%-12s %-10s %s\n" "$label" "irq-held" "$(bench)" | tee -a "$out"
+	echo 0 > $knob
+fi
+
+if "$perf" zerosim -h 2>&1 | grep -q record; then
+	printf "%-12s %-10s %s\n" "$label" "tracing" \
+		"$(bench "$perf" zerosim record -o "$trace" --)" | tee -a "$out"
+fi
@@ -0,0 +1,112 @@
+#!/bin/bash
+#
+# Host side of the 0sim timing-accuracy check (see zerosim_timing.c).
+#
+# Runs the workloads natively on the host for the baseline, then in a 0sim
+# guest reachable over ssh, and compares the two. Exits non-zero if any
+# workload class is off by more than the threshold, so that changes to the
+# timing path can be gated on it.
+#
+# Usage: run_timing.sh [options] <guest> [-- <zerosim_timing run options>]
+#   -o dir	where to keep the results (default: ./timing-<date>)
+#   -t pct	allowed median error per class (default: 5)
+#   -c cpus	cpus to run the native baseline on, e.g. the ones the vcpu
+#		threads are pinned to (taskset list; default: all)
+#   -m MB	memory limit for the native baseline, normally the guest's
+#		memory size, so that the mem sweep swaps on both sides
+#
+# <guest> is anything ssh accepts. The guest needs no more than a shell;
+# the statically linked zerosim_timing binary is copied over.
+
+set -e -o pipefail
+
+out="timing-$(date +%Y%m%d-%H%M%S)"
+threshold=5
+cpus=
+mem_limit=
+
+while getopts "o:t:c:m:" opt; do
+	case $opt in
+	o) out=$OPTARG ;;
+	t) threshold=$OPTARG ;;
+	c) cpus=$OPTARG ;;
+	m) mem_limit=$OPTARG ;;
+	*) exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 [-o dir] [-t pct] [-c cpus] [-m MB] <guest> [-- run options]" >&2
+	exit 1
+fi
+guest=$1
+shift
+[ "$1" = "--" ] && shift
+
+bin=$(dirname "$0")/zerosim_timing
+if [ ! -x "$bin" ]; then
+	echo "$bin not built, run make first" >&2
+	exit 1
+fi
+
+mkdir -p "$out"
+
+# Host-side 0sim state, for making sense of a failure afterwards.
+snapshot()
+{
+	for f in zerosim_missing zerosim_tsc_skew zerosim_hidden_missing; do
+		[ -r /proc/$f ] && cat /proc/$f > "$out/$f.$1"
+	done
+	return 0
+}
+
+cgroup=
+breakdown=
+cleanup()
+{
+	[ -n "$cgroup" ] && rmdir "$cgroup" 2>/dev/null
+	[ -n "$breakdown" ] &&
+		echo "$breakdown" > /proc/zerosim_missing_breakdown 2>/dev/null
+	return 0
+}
+trap cleanup EXIT
+
+run_native()
+{
+	local cmd=("$bin" run "$@")
+
+	[ -n "$cpus" ] && cmd=(taskset -c "$cpus" "${cmd[@]}")
+
+	if [ -n "$mem_limit" ]; then
+		if [ -f /sys/fs/cgroup/cgroup.controllers ]; then
+			cgroup=/sys/fs/cgroup/zerosim_timing.$$
+			mkdir "$cgroup"
+			echo $((mem_limit << 20)) > "$cgroup/memory.max"
+		else
+			cgroup=/sys/fs/cgroup/memory/zerosim_timing.$$
+			mkdir "$cgroup"
+			echo $((mem_limit << 20)) > "$cgroup/memory.limit_in_bytes"
+		fi
+		# Move a subshell in, so that only the baseline is limited.
+		(echo $BASHPID > "$cgroup/cgroup.procs" && exec "${cmd[@]}")
+	else
+		"${cmd[@]}"
+	fi
+}
+
+echo "native baseline..."
+run_native "$@" > "$out/native"
+
+echo "guest run on $guest..."
+scp -q "$bin" "$guest:/tmp/zerosim_timing"
+# Interrupt time only shows up in zerosim_missing while this is on.
+if [ -w /proc/zerosim_missing_breakdown ]; then
+	breakdown=$(cat /proc/zerosim_missing_breakdown)
+	echo 1 > /proc/zerosim_missing_breakdown
+fi
+snapshot before
+ssh "$guest" /tmp/zerosim_timing run "$@" > "$out/guest"
+snapshot after
+
+"$bin" compare -t "$threshold" "$out/native" "$out/guest" | tee "$out/summary"
@@ -0,0 +1,427 @@
+/*
+ * zerosim_timing - timing-accuracy check of the 0sim TSC model
+ *
+ * 0sim hides the host time a vcpu spends outside the guest by moving its
+ * TSC offset (vmx_vcpu_run, kvm_x86_elapse_time) and keeps vcpus in step
+ * with each other (vcpu_is_ahead). Done right, a workload timed inside the
+ * guest takes as long as it does on bare metal. This tool measures how far
+ * off that is.
+ *
+ *   zerosim_timing run [options] > file
+ *	Runs each workload class a number of times and prints one line per
+ *	sample, "<class> <ns>", timed with CLOCK_MONOTONIC. Run it once on
+ *	the host (the native baseline) and once in the guest, with the same
+ *	options.
+ *
+ *   zerosim_timing compare [-t pct] native guest
+ *	Takes the median native duration of each class as the expected one,
+ *	and prints the distribution of the relative error of the guest
+ *	samples against it. Exits with 1 if the median error of any class is
+ *	beyond +-pct percent, so that it can gate changes to the timing path.
+ *
+ * The workload classes exercise the different ways guest time gets
+ * disturbed:
+ *   loop	a dependent arithmetic chain; time passes only in the guest.
+ *   mem	writes one word per page over a buffer, after touching it once.
+ *		Sized above the guest's memory, the sweep swaps through zswap,
+ *		so every fault exits to the host.
+ *   ipi	two threads on different cpus wake each other through a futex,
+ *		so every round trip sends an IPI between vcpus.
+ *
+ * run_timing.sh drives both sides from the host.
+ *
+ * This program is released under the GPL v2.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+
+/* Default parameters, picked so that a sample takes tens of ms natively. */
+#define DEF_SAMPLES	50
+#define DEF_LOOP_ITERS	(1UL << 24)
+#define DEF_MEM_MB	256
+#define DEF_IPI_ROUNDS	2000
+
+#define MAX_CLASSES	16
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------ */
+/* workloads */
+
+static unsigned long loop_iters = DEF_LOOP_ITERS;
+static unsigned long mem_mb = DEF_MEM_MB;
+static unsigned long ipi_rounds = DEF_IPI_ROUNDS;
+
+static char *mem_buf;
+
+static void loop_run(void)
+{
+	uint64_t x = 1;
+	unsigned long i;
+
+	for (i = 0; i < loop_iters; i++) {
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+		/* keep the compiler from folding the chain */
+		asm volatile("" : "+r" (x));
+	}
+}
+
+static int mem_setup(void)
+{
+	size_t size = mem_mb << 20, i;
+
+	mem_buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem_buf == MAP_FAILED)
+		err(2, "mmap %lu MB", mem_mb);
+
+	/* populate, so that samples don't include first-touch faults */
+	for (i = 0; i < size; i += PAGE_SIZE)
+		mem_buf[i] = 1;
+	return 0;
+}
+
+static void mem_run(void)
+{
+	size_t size = mem_mb << 20, i;
+
+	for (i = 0; i < size; i += PAGE_SIZE)
+		(*(volatile char *)(mem_buf + i))++;
+}
+
+static int ipi_word;
+static int ipi_cpus[2];
+
+static void futex_wait(int *word, int val)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(int *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		err(2, "pin to cpu %d", cpu);
+}
+
+/*
+ * ipi_word is 1 while it is the partner's turn and 0 while it is ours; -1
+ * tells the partner to exit.
+ */
+static void *ipi_partner(void *arg)
+{
+	int v;
+
+	(void)arg;
+	pin(ipi_cpus[1]);
+	for (;;) {
+		while ((v = __atomic_load_n(&ipi_word, __ATOMIC_ACQUIRE)) == 0)
+			futex_wait(&ipi_word, 0);
+		if (v < 0)
+			return NULL;
+		__atomic_store_n(&ipi_word, 0, __ATOMIC_RELEASE);
+		futex_wake(&ipi_word);
+	}
+}
+
+static pthread_t ipi_thread;
+
+static int ipi_setup(void)
+{
+	cpu_set_t set;
+	int cpu, n = 0;
+
+	if (sched_getaffinity(0, sizeof(set), &set))
+		err(2, "sched_getaffinity");
+	for (cpu = 0; cpu < CPU_SETSIZE && n < 2; cpu++)
+		if (CPU_ISSET(cpu, &set))
+			ipi_cpus[n++] = cpu;
+	if (n < 2) {
+		warnx("ipi: needs two cpus, skipped");
+		return -1;
+	}
+
+	pin(ipi_cpus[0]);
+	if (pthread_create(&ipi_thread, NULL, ipi_partner, NULL))
+		errx(2, "pthread_create");
+	return 0;
+}
+
+static void ipi_run(void)
+{
+	unsigned long i;
+
+	for (i = 0; i < ipi_rounds; i++) {
+		__atomic_store_n(&ipi_word, 1, __ATOMIC_RELEASE);
+		futex_wake(&ipi_word);
+		while (__atomic_load_n(&ipi_word, __ATOMIC_ACQUIRE) != 0)
+			futex_wait(&ipi_word, 1);
+	}
+}
+
+static void ipi_teardown(void)
+{
+	__atomic_store_n(&ipi_word, -1, __ATOMIC_RELEASE);
+	futex_wake(&ipi_word);
+	pthread_join(ipi_thread, NULL);
+}
+
+static const struct workload {
+	const char *name;
+	int (*setup)(void);
+	void (*run)(void);
+	void (*teardown)(void);
+} workloads[] = {
+	{ "loop", NULL, loop_run, NULL },
+	{ "mem", mem_setup, mem_run, NULL },
+	{ "ipi", ipi_setup, ipi_run, ipi_teardown },
+};
+
+#define NR_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static int cmd_run(int argc, char **argv)
+{
+	unsigned long samples = DEF_SAMPLES, i;
+	const char *only = NULL;
+	const struct workload *w;
+	uint64_t start;
+	unsigned int n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:n:l:m:r:")) != -1) {
+		switch (opt) {
+		case 'c':
+			only = optarg;
+			break;
+		case 'n':
+			samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loop_iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mem_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			ipi_rounds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (!samples || !loop_iters || !mem_mb || !ipi_rounds)
+		errx(1, "zero count");
+
+	printf("# samples %lu loop %lu mem %lu MB ipi %lu\n",
+	       samples, loop_iters, mem_mb, ipi_rounds);
+
+	for (n = 0; n < NR_WORKLOADS; n++) {
+		w = &workloads[n];
+		if (only && strcmp(only, w->name))
+			continue;
+		if (w->setup && w->setup())
+			continue;
+
+		/* one unrecorded warmup */
+		w->run();
+		for (i = 0; i < samples; i++) {
+			start = now_ns();
+			w->run();
+			printf("%s %llu\n", w->name,
+			       (unsigned long long)(now_ns() - start));
+		}
+		fflush(stdout);
+
+		if (w->teardown)
+			w->teardown();
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* comparison */
+
+struct samples {
+	char name[32];
+	double *v;
+	size_t nr, alloc;
+};
+
+struct sample_set {
+	struct samples cls[MAX_CLASSES];
+	int nr;
+};
+
+static struct samples *find_class(struct sample_set *set, const char *name)
+{
+	int i;
+
+	for (i = 0; i < set->nr; i++)
+		if (!strcmp(set->cls[i].name, name))
+			return &set->cls[i];
+	return NULL;
+}
+
+static void read_samples(const char *path, struct sample_set *set)
+{
+	char line[256], name[32];
+	unsigned long long ns;
+	struct samples *s;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		err(2, "open %s", path);
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%31s %llu", name, &ns) != 2)
+			errx(2, "%s: bad line: %s", path, line);
+
+		s = find_class(set, name);
+		if (!s) {
+			if (set->nr == MAX_CLASSES)
+				errx(2, "%s: too many classes", path);
+			s = &set->cls[set->nr++];
+			strcpy(s->name, name);
+		}
+		if (s->nr == s->alloc) {
+			s->alloc = s->alloc ? 2 * s->alloc : 64;
+			s->v = realloc(s->v, s->alloc * sizeof(*s->v));
+			if (!s->v)
+				err(2, "realloc");
+		}
+		s->v[s->nr++] = ns;
+	}
+
+	fclose(f);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* v must be sorted */
+static double quantile(const double *v, size_t n, double q)
+{
+	return v[(size_t)((n - 1) * q)];
+}
+
+static int cmd_compare(int argc, char **argv)
+{
+	struct sample_set native = { .nr = 0 }, guest = { .nr = 0 };
+	double threshold = 5.0, expected, *errs;
+	struct samples *g, *nat;
+	int opt, i, failed = 0;
+	size_t j;
+
+	while ((opt = getopt(argc, argv, "t:")) != -1) {
+		switch (opt) {
+		case 't':
+			threshold = strtod(optarg, NULL);
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != 2)
+		errx(1, "usage: zerosim_timing compare [-t pct] native guest");
+
+	read_samples(argv[optind], &native);
+	read_samples(argv[optind + 1], &guest);
+
+	printf("%-6s %6s %12s %12s %8s %8s %8s %8s %8s  (error, %%)\n",
+	       "class", "n", "native(ns)", "guest(ns)",
+	       "p1", "p5", "p50", "p95", "p99");
+
+	for (i = 0; i < guest.nr; i++) {
+		g = &guest.cls[i];
+		nat = find_class(&native, g->name);
+		if (!nat || !nat->nr) {
+			printf("%-6s no native baseline\n", g->name);
+			failed = 1;
+			continue;
+		}
+
+		qsort(nat->v, nat->nr, sizeof(double), cmp_double);
+		qsort(g->v, g->nr, sizeof(double), cmp_double);
+		expected = quantile(nat->v, nat->nr, 0.5);
+
+		/* sorted samples give sorted errors */
+		errs = malloc(g->nr * sizeof(*errs));
+		if (!errs)
+			err(2, "malloc");
+		for (j = 0; j < g->nr; j++)
+			errs[j] = (g->v[j] - expected) * 100 / expected;
+
+		printf("%-6s %6zu %12.0f %12.0f %+8.2f %+8.2f %+8.2f %+8.2f %+8.2f",
+		       g->name, g->nr, expected, quantile(g->v, g->nr, 0.5),
+		       quantile(errs, g->nr, 0.01), quantile(errs, g->nr, 0.05),
+		       quantile(errs, g->nr, 0.5), quantile(errs, g->nr, 0.95),
+		       quantile(errs, g->nr, 0.99));
+		if (quantile(errs, g->nr, 0.5) > threshold ||
+		    quantile(errs, g->nr, 0.5) < -threshold) {
+			printf("  FAIL");
+			failed = 1;
+		}
+		printf("\n");
+		free(errs);
+	}
+
+	/* A class skipped or cut short in the guest must not pass either */
+	for (i = 0; i < native.nr; i++) {
+		nat = &native.cls[i];
+		if (!find_class(&guest, nat->name)) {
+			printf("%-6s no guest samples\n", nat->name);
+			failed = 1;
+		}
+	}
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && !strcmp(argv[1], "run"))
+		return cmd_run(argc - 1, argv + 1);
+	if (argc >= 2 && !strcmp(argv[1], "compare"))
+		return cmd_compare(argc - 1, argv + 1);
+
+	fprintf(stderr,
+		"usage: %s run [-c class] [-n samples] [-l loop_iters] [-m mem_mb] [-r ipi_rounds]\n"
+		"       %s compare [-t pct] native guest\n", argv[0], argv[0]);
+	return 1;
+}
@@ -78,6 +78,13 @@ module_param(halt_poll_ns_grow, int, S_IRUGO);
 static unsigned int halt_poll_ns_shrink;
 module_param(halt_poll_ns_shrink, int, S_IRUGO);
 
+/*
+ * Size and measure the polling window on the guest's clock rather than
+ * the host's, for architectures that hide host time from their guests.
+ */
+static bool halt_poll_guest_time;
+module_param(halt_poll_guest_time, bool, S_IRUGO | S_IWUSR);
+
 /*
  * Ordering of locks:
  *
@@ -240,6 +247,12 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 	}
 	vcpu->run = page_address(page);
 
+	vcpu->exit_hist = kzalloc(sizeof(*vcpu->exit_hist), GFP_KERNEL);
+	if (!vcpu->exit_hist) {
+		r = -ENOMEM;
+		goto fail_free_run;
+	}
+
 	kvm_vcpu_set_in_spin_loop(vcpu, false);
 	kvm_vcpu_set_dy_eligible(vcpu, false);
 	vcpu->preempted = false;
@@ -249,9 +262,11 @@ int kvm_vcpu_init(struct kvm_vcpu *vcpu, struct kvm *kvm, unsigned id)
 
 	r = kvm_arch_vcpu_init(vcpu);
 	if (r < 0)
-		goto fail_free_run;
+		goto fail_free_exit_hist;
 	return 0;
 
+fail_free_exit_hist:
+	kfree(vcpu->exit_hist);
 fail_free_run:
 	free_page((unsigned long)vcpu->run);
 fail:
@@ -263,6 +278,7 @@ void kvm_vcpu_uninit(struct kvm_vcpu *vcpu)
 {
 	put_pid(vcpu->pid);
 	kvm_arch_vcpu_uninit(vcpu);
+	kfree(vcpu->exit_hist);
 	free_page((unsigned long)vcpu->run);
 }
 EXPORT_SYMBOL_GPL(kvm_vcpu_uninit);
@@ -1996,19 +2012,44 @@ static int kvm_vcpu_check_block(struct kvm_vcpu *vcpu)
 	return 0;
 }
 
+/* @rescan: see kvm_arch_vcpu_guest_ns(); false inside the poll loop */
+static u64 kvm_vcpu_halt_clock(struct kvm_vcpu *vcpu, bool rescan)
+{
+	if (halt_poll_guest_time)
+		return kvm_arch_vcpu_guest_ns(vcpu, rescan);
+	return ktime_get_ns();
+}
+
+/* The guest clock may have been stepped back meanwhile */
+static u64 kvm_halt_clock_delta(u64 start, u64 cur)
+{
+	return cur > start ? cur - start : 0;
+}
+
+static void kvm_halt_poll_hist_add(u32 *hist, u64 start, u64 cur)
+{
+	u64 ns = kvm_halt_clock_delta(start, cur);
+	int bucket = 0;
+
+	if (ns >> 10)
+		bucket = min(ilog2(ns >> 10) + 1,
+			     KVM_HALT_POLL_HIST_BUCKETS - 1);
+	hist[bucket]++;
+}
+
 /*
  * The vCPU has executed a HLT instruction with in-kernel mode enabled.
  */
 void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 {
-	ktime_t start, cur;
+	u64 start, cur;
 	DEFINE_WAIT(wait);
 	bool waited = false;
 	u64 block_ns;
 
-	start = cur = ktime_get();
+	start = cur = kvm_vcpu_halt_clock(vcpu, true);
 	if (vcpu->halt_poll_ns) {
-		ktime_t stop = ktime_add_ns(ktime_get(), vcpu->halt_poll_ns);
+		u64 stop = start + vcpu->halt_poll_ns;
 
 		++vcpu->stat.halt_attempted_poll;
 		do {
@@ -2018,10 +2059,16 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 			 */
 			if (kvm_vcpu_check_block(vcpu) < 0) {
 				++vcpu->stat.halt_successful_poll;
+				kvm_halt_poll_hist_add(
+					vcpu->halt_poll_hist.success,
+					start, cur);
 				goto out;
 			}
-			cur = ktime_get();
-		} while (single_task_running() && ktime_before(cur, stop));
+			cur = kvm_vcpu_halt_clock(vcpu, false);
+		} while (single_task_running() && cur < stop);
+
+		kvm_halt_poll_hist_add(vcpu->halt_poll_hist.wasted,
+				       start, cur);
 	}
 
 	kvm_arch_vcpu_blocking(vcpu);
@@ -2037,11 +2084,11 @@ void kvm_vcpu_block(struct kvm_vcpu *vcpu)
 	}
 
 	finish_wait(&vcpu->wq, &wait);
-	cur = ktime_get();
+	cur = kvm_vcpu_halt_clock(vcpu, true);
 
 	kvm_arch_vcpu_unblocking(vcpu);
 out:
-	block_ns = ktime_to_ns(cur) - ktime_to_ns(start);
+	block_ns = kvm_halt_clock_delta(start, cur);
 
 	if (halt_poll_ns) {
 		if (block_ns <= vcpu->halt_poll_ns)
@@ -3442,6 +3489,132 @@ static const struct file_operations *stat_fops[] = {
 	[KVM_STAT_VM]   = &vm_stat_fops,
 };
 
+static void halt_poll_hist_show_one(struct seq_file *m, const char *name,
+				    struct kvm_vcpu *vcpu, u32 *hist)
+{
+	int i;
+
+	rcu_read_lock();
+	seq_printf(m, "%d %d %s", pid_nr(vcpu->pid), vcpu->vcpu_id, name);
+	rcu_read_unlock();
+	for (i = 0; i < KVM_HALT_POLL_HIST_BUCKETS; i++)
+		seq_printf(m, " %u", READ_ONCE(hist[i]));
+	seq_putc(m, '\n');
+}
+
+static int halt_poll_hist_show(struct seq_file *m, void *v)
+{
+	struct kvm_vcpu *vcpu;
+	struct kvm *kvm;
+	int i;
+
+	seq_puts(m, "# tid vcpu kind, then counts for polls taking <1us,");
+	seq_puts(m, " <2us, ... <16ms, >=16ms\n");
+
+	spin_lock(&kvm_lock);
+	list_for_each_entry(kvm, &vm_list, vm_list)
+		kvm_for_each_vcpu(i, vcpu, kvm) {
+			halt_poll_hist_show_one(m, "success", vcpu,
+						vcpu->halt_poll_hist.success);
+			halt_poll_hist_show_one(m, "wasted", vcpu,
+						vcpu->halt_poll_hist.wasted);
+		}
+	spin_unlock(&kvm_lock);
+	return 0;
+}
+
+static int halt_poll_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, halt_poll_hist_show, NULL);
+}
+
+static const struct file_operations halt_poll_hist_fops = {
+	.open		= halt_poll_hist_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int exit_hist_show(struct seq_file *m, void *v)
+{
+	struct kvm_exit_hist *sum;
+	struct task_struct *task;
+	struct kvm_vcpu *vcpu;
+	struct kvm *kvm;
+	int i, r, b;
+	pid_t pid;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	seq_puts(m, "# pid reason, then counts for exit-to-entry times of");
+	seq_puts(m, " 0, <2, <4, ... <2^30, >=2^30 cycles\n");
+
+	spin_lock(&kvm_lock);
+	list_for_each_entry(kvm, &vm_list, vm_list) {
+		memset(sum, 0, sizeof(*sum));
+		pid = 0;
+		kvm_for_each_vcpu(i, vcpu, kvm) {
+			if (!pid) {
+				rcu_read_lock();
+				task = pid_task(vcpu->pid, PIDTYPE_PID);
+				if (task)
+					pid = task_tgid_nr(task);
+				rcu_read_unlock();
+			}
+			for (r = 0; r < KVM_EXIT_HIST_REASONS; r++)
+				for (b = 0; b < KVM_EXIT_HIST_BUCKETS; b++)
+					sum->count[r][b] += READ_ONCE(
+						vcpu->exit_hist->count[r][b]);
+		}
+
+		for (r = 0; r < KVM_EXIT_HIST_REASONS; r++) {
+			if (!memchr_inv(sum->count[r], 0,
+					sizeof(sum->count[r])))
+				continue;
+			seq_printf(m, "%d %d", pid, r);
+			for (b = 0; b < KVM_EXIT_HIST_BUCKETS; b++)
+				seq_printf(m, " %u", sum->count[r][b]);
+			seq_putc(m, '\n');
+		}
+	}
+	spin_unlock(&kvm_lock);
+
+	kfree(sum);
+	return 0;
+}
+
+static int exit_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, exit_hist_show, NULL);
+}
+
+/* Any write clears the histograms of every vcpu of every VM. */
+static ssize_t exit_hist_write(struct file *file, const char __user *buf,
+			       size_t len, loff_t *ppos)
+{
+	struct kvm_vcpu *vcpu;
+	struct kvm *kvm;
+	int i;
+
+	spin_lock(&kvm_lock);
+	list_for_each_entry(kvm, &vm_list, vm_list)
+		kvm_for_each_vcpu(i, vcpu, kvm)
+			memset(vcpu->exit_hist, 0, sizeof(*vcpu->exit_hist));
+	spin_unlock(&kvm_lock);
+
+	return len;
+}
+
+static const struct file_operations exit_hist_fops = {
+	.open		= exit_hist_open,
+	.read		= seq_read,
+	.write		= exit_hist_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int kvm_init_debug(void)
 {
 	int r = -EEXIST;
@@ -3459,6 +3632,14 @@ static int kvm_init_debug(void)
 			goto out_dir;
 	}
 
+	if (!debugfs_create_file("halt_poll_histogram", 0444, kvm_debugfs_dir,
+				 NULL, &halt_poll_hist_fops))
+		goto out_dir;
+
+	if (!debugfs_create_file("exit_histogram", 0644, kvm_debugfs_dir,
+				 NULL, &exit_hist_fops))
+		goto out_dir;
+
 	return 0;
 
 out_dir:
@@ -3471,9 +3652,7 @@ static void kvm_exit_debug(void)
 {
 	struct kvm_stats_debugfs_item *p;
 
-	for (p = debugfs_entries; p->name; ++p)
-		debugfs_remove(p->dentry);
-	debugfs_remove(kvm_debugfs_dir);
+	debugfs_remove_recursive(kvm_debugfs_dir);
 }
 
 static int kvm_suspend(void)